@@ -0,0 +1,108 @@
+#include "batch.h"
+#include "workload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// batch driver benchmark, many small files assembled in one process against a process per file
+// the process per file numbers need ./masm, so run it from the repo root after make
+
+#define FILES (5000)
+#define SPAWNED_FILES (500)
+#define LINES_PER_FILE (200)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Runs ./masm once per file, the way a farm without the batch driver would
+ */
+static double spawn_each(const file_list_t *files, size_t count) {
+    double t0 = now();
+
+    for (size_t i = 0; i < count; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            return -1;
+        if (pid == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            execl("./masm", "./masm", files->paths[i], "-o", "/dev/null", (char *) NULL);
+            _exit(127);
+        }
+
+        int status;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) == 127)
+            return -1;
+    }
+    return count / (now() - t0);
+}
+
+int main() {
+    char dir[] = "/tmp/masm-bench-batch-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        printf("bench_batch: couldn't create a temp dir\n");
+        return 1;
+    }
+
+    workload_t w;
+    workload_defaults(&w);
+    w.lines = LINES_PER_FILE;
+
+    file_list_t files;
+    file_list_init(&files);
+
+    for (int i = 0; i < FILES; i++) {
+        char path[64];
+        size_t len;
+
+        w.seed = i + 1;
+        char *src = workload_generate(&w, &len);
+        snprintf(path, sizeof(path), "%s/f%d.asm", dir, i);
+
+        FILE *fp = fopen(path, "w");
+        if (src == NULL || fp == NULL || fwrite(src, 1, len, fp) != len || file_list_add(&files, path) != 0) {
+            printf("bench_batch: couldn't write %s\n", path);
+            return 1;
+        }
+        fclose(fp);
+        free(src);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_jobs = cpus > 4 ? cpus : 4;
+
+    printf("batch of %d files, %d lines each\n", FILES, LINES_PER_FILE);
+    for (int jobs = 1; jobs <= max_jobs; jobs *= 2) {
+        assemble_opts_t opts = { .jobs = jobs };
+        fflush(stdout);
+        if (assemble_batch(&files, &opts) != 0) {
+            printf("bench_batch: batch failed\n");
+            return 1;
+        }
+    }
+
+    if (access("./masm", X_OK) == 0) {
+        double rate = spawn_each(&files, SPAWNED_FILES);
+        if (rate > 0)
+            printf("process per file: %.0f files/s\n", rate);
+    }
+
+    // clean up the inputs and their outputs
+    for (size_t i = 0; i < files.count; i++) {
+        char out[64];
+        unlink(files.paths[i]);
+        snprintf(out, sizeof(out), "%.*s.bin", (int) (strlen(files.paths[i]) - 4), files.paths[i]);
+        unlink(out);
+    }
+    rmdir(dir);
+    file_list_free(&files);
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "disasm.h"
+#include "ir.h"
+#include "instr.h"
+#include "assemble.h"
+#include "workload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// decoding benchmark, a linear search over the instruction table against the opcode/funct tables,
+// one word at a time and in batches, and the full --verify round trip
+// the words come from assembling a generated program, so they're a realistic mix
+
+#define WORDS (1 << 22)
+#define PROGRAM_LINES (1 << 20)
+#define RUNS (5)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// what decoding looks like without the tables, the first id whose constant bits match
+static int linear_decode(uint32_t word) {
+    for (int id = 0; id < NUM_INSTR; id++) {
+        uint32_t mask = (uint32_t) INSTR_OPCODE_MSK << INSTR_OPCODE_POS;
+        if (OPCODES[id] == 0)
+            mask |= INSTR_FUNCT_MSK << INSTR_FUNCT_POS;
+        else if (OPCODES[id] == 1)
+            mask |= INSTR_RT_MSK << INSTR_RT_POS;
+        if ((word & mask) == INSTR_BASE[id])
+            return id;
+    }
+    return INVALID;
+}
+
+static void report(const char *name, double secs) {
+    printf("decode %-12s: %7.1f M words/s %8.1f MB/s\n", name, WORDS / secs / 1e6, WORDS * 4 / secs / 1e6);
+}
+
+int main() {
+    uint32_t *words = malloc(WORDS * sizeof(uint32_t));
+    uint8_t *expected = malloc(WORDS);
+    ir_batch_t ir;
+
+    ir_init(&ir, &MASM_DEFAULT_ALLOCATOR);
+    if (words == NULL || expected == NULL || ir_grow(&ir, DISASM_BATCH) != 0) {
+        printf("bench_disasm: out of memory\n");
+        return 1;
+    }
+
+    // assemble one program and tile its image out to WORDS
+    workload_t w;
+    workload_defaults(&w);
+    w.lines = PROGRAM_LINES;
+
+    size_t len;
+    char *src = workload_generate(&w, &len);
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+    const void *image;
+    size_t image_len;
+
+    if (src == NULL || ctx == NULL || masm_assemble_buffer(ctx, src, len, &image, &image_len) != 0 || image_len == 0) {
+        printf("bench_disasm: couldn't assemble the program\n");
+        return 1;
+    }
+    for (size_t i = 0; i < WORDS; i += image_len / sizeof(uint32_t)) {
+        size_t n = WORDS - i < image_len / sizeof(uint32_t) ? WORDS - i : image_len / sizeof(uint32_t);
+        memcpy(words + i, image, n * sizeof(uint32_t));
+    }
+    masm_ctx_destroy(ctx);
+    free(src);
+
+    double best = 1e9;
+    for (int r = 0; r < RUNS; r++) {
+        double start = now();
+        for (size_t i = 0; i < WORDS; i++)
+            expected[i] = linear_decode(words[i]);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    report("linear", best);
+
+    best = 1e9;
+    for (int r = 0; r < RUNS; r++) {
+        size_t wrong = 0;
+        double start = now();
+        for (size_t i = 0; i < WORDS; i++) {
+            instr_t in;
+            wrong += disasm_decode(words[i], &in) != expected[i];
+        }
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+        if (wrong > 0) {
+            printf("bench_disasm: disasm_decode doesn't match the linear search!\n");
+            return 1;
+        }
+    }
+    report("table", best);
+
+    best = 1e9;
+    for (int r = 0; r < RUNS; r++) {
+        size_t wrong = 0;
+        double start = now();
+        for (size_t i = 0; i < WORDS; i += DISASM_BATCH) {
+            disasm_decode_batch(words + i, DISASM_BATCH, &ir);
+            wrong += ir.id[i % DISASM_BATCH] != expected[i];
+        }
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+        if (wrong > 0) {
+            printf("bench_disasm: disasm_decode_batch doesn't match the linear search!\n");
+            return 1;
+        }
+    }
+    report("batch", best);
+
+    best = 1e9;
+    for (int r = 0; r < RUNS; r++) {
+        size_t at;
+        uint32_t got;
+        double start = now();
+        int ret = disasm_verify(words, WORDS, &MASM_DEFAULT_ALLOCATOR, &at, &got);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+        if (ret != 0) {
+            printf("bench_disasm: word %zu (%08x) came back as %08x\n", at, words[at], got);
+            return 1;
+        }
+    }
+    report("verify", best);
+    printf("verify: a 1 GB image takes %.2f s\n", best / (WORDS * 4.0) * (1 << 30));
+
+    ir_free(&ir);
+    free(words);
+    free(expected);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "instr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// mnemonic lookup microbenchmark, compares the hash table against the old strcmp scan
+
+#define NUM_KEYS (4096)
+#define ROUNDS   (2000)
+
+// the lookup find_instr used to do, kept here as the baseline
+static InstrID linear_find_instr(const char *str, size_t len) {
+    for (int i = 0; i < NUM_INSTR; i++) {
+        if (strlen(INSTRUCTIONS[i]) == len && memcmp(str, INSTRUCTIONS[i], len) == 0)
+            return i;
+    }
+    return INVALID;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef InstrID (*lookup_fn)(const char *str, size_t len);
+
+static double run(lookup_fn fn, const char **keys, const size_t *lens, long *checksum) {
+    long sum = 0;
+    double start = now();
+
+    for (int r = 0; r < ROUNDS; r++)
+        for (int i = 0; i < NUM_KEYS; i++)
+            sum += fn(keys[i], lens[i]);
+
+    double elapsed = now() - start;
+    *checksum = sum;
+    return (double) ROUNDS * NUM_KEYS / elapsed;
+}
+
+int main() {
+    static const char *misses[] = { "mov", "addx", "li", "nop", "la", "bgezal" };
+    const char *keys[NUM_KEYS];
+    size_t lens[NUM_KEYS];
+
+    // mostly real mnemonics with a few misses mixed in, in a fixed pseudo-random order
+    srand(1);
+    for (int i = 0; i < NUM_KEYS; i++) {
+        if (rand() % 16 == 0)
+            keys[i] = misses[rand() % (sizeof(misses) / sizeof(misses[0]))];
+        else
+            keys[i] = INSTRUCTIONS[rand() % NUM_INSTR];
+        lens[i] = strlen(keys[i]);
+    }
+
+    long linear_sum, hash_sum;
+    double linear = run(linear_find_instr, keys, lens, &linear_sum);
+    double hashed = run(find_instr_n, keys, lens, &hash_sum);
+
+    if (linear_sum != hash_sum) {
+        printf("bench_mnemonic: lookup results differ!\n");
+        return 1;
+    }
+
+    printf("mnemonic lookup: linear %.1f M/s, hashed %.1f M/s (%.1fx)\n",
+           linear / 1e6, hashed / 1e6, hashed / linear);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "ir.h"
+#include "instr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// encoding benchmark, pack_instr one instr_t at a time against each batch kernel over the SoA IR
+
+#define INSTRS (1 << 22)
+#define BATCH (1024)
+#define RUNS (5)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a random valid instruction, only the fields its type uses are set
+static void random_instr(instr_t *instr) {
+    memset(instr, 0, sizeof(*instr));
+    instr->id = rand() % NUM_INSTR;
+
+    if (INSTR_TYPES[instr->id] == R_TYPE) {
+        instr->rs = rand() % 32;
+        instr->rt = rand() % 32;
+        instr->rd = rand() % 32;
+        instr->shamt = rand() % 32;
+    } else if (INSTR_TYPES[instr->id] == I_TYPE) {
+        instr->rs = rand() % 32;
+        instr->rt = rand() % 32;
+        instr->imm = rand();
+    } else
+        instr->target = rand() & INSTR_TARGET_MSK;
+}
+
+int main() {
+    const char *names[] = { "scalar", "sse2", "avx2" };
+    instr_t *instrs = malloc(INSTRS * sizeof(instr_t));
+    uint32_t *expected = malloc(INSTRS * sizeof(uint32_t));
+    uint32_t *out = malloc(INSTRS * sizeof(uint32_t));
+    ir_batch_t ir;
+
+    ir_init(&ir, &MASM_DEFAULT_ALLOCATOR);
+    srand(1);
+    for (size_t i = 0; i < INSTRS; i++) {
+        random_instr(&instrs[i]);
+        ir_push(&ir, &instrs[i], 1, 1);
+    }
+
+    double best = 1e9;
+    for (int r = 0; r < RUNS; r++) {
+        double start = now();
+        for (size_t i = 0; i < INSTRS; i++)
+            expected[i] = pack_instr(&instrs[i]);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    printf("pack %-10s: %7.1f M instr/s\n", "pack_instr", INSTRS / best / 1e6);
+
+    printf("pack: runtime pick is %s, %d instructions per call\n", ir_pack_kernel_name(), BATCH);
+    for (int k = 0; k < 3; k++) {
+        ir_pack_kernel_t kernel = ir_find_pack_kernel(names[k]);
+        if (kernel == NULL)
+            continue;
+
+        best = 1e9;
+        for (int r = 0; r < RUNS; r++) {
+            double start = now();
+            for (size_t i = 0; i < INSTRS; i += BATCH)
+                kernel(&ir, i, BATCH, out + i);
+            double elapsed = now() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+
+        if (memcmp(out, expected, INSTRS * sizeof(uint32_t)) != 0) {
+            printf("bench_pack: %s kernel doesn't match pack_instr!\n", names[k]);
+            return 1;
+        }
+        printf("pack %-10s: %7.1f M instr/s\n", names[k], INSTRS / best / 1e6);
+    }
+
+    ir_free(&ir);
+    free(instrs);
+    free(expected);
+    free(out);
+    return 0;
+}
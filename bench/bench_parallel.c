@@ -0,0 +1,102 @@
+#include "assemble.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// parallel assembly scaling benchmark, runs the same big program with 1 to N threads
+
+#define SOURCE_LINES (1 << 20)
+#define RUNS (3)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Straight-line code with a label every 16 lines and branches back and forth between them
+ */
+static char *generate(size_t *len) {
+    size_t cap = (size_t) SOURCE_LINES * 32;
+    char *src = malloc(cap);
+    size_t n = 0;
+
+    srand(1);
+    for (int i = 0; i < SOURCE_LINES && n + 64 < cap; i++) {
+        int block = i / 16;
+        int target = block + rand() % 64 - 32;
+        if (target < 0)
+            target = 0;
+        if (target >= SOURCE_LINES / 16)
+            target = SOURCE_LINES / 16 - 1;
+
+        if (i % 16 == 0)
+            n += sprintf(src + n, "L%d:\n", block);
+
+        switch (rand() % 5) {
+            case 0: n += sprintf(src + n, "    add $t%d, $s%d, $a%d\n", rand() % 8, rand() % 8, rand() % 4); break;
+            case 1: n += sprintf(src + n, "    addi $t%d, $t%d, %d\n", rand() % 8, rand() % 8, rand() % 2000 - 1000); break;
+            case 2: n += sprintf(src + n, "    lw $t%d, %d($sp)\n", rand() % 8, (rand() % 64) * 4); break;
+            case 3: n += sprintf(src + n, "    sll $t%d, $t%d, %d\n", rand() % 8, rand() % 8, rand() % 32); break;
+            case 4: n += sprintf(src + n, "    bne $t%d, $0, L%d\n", rand() % 8, target); break;
+        }
+    }
+
+    *len = n;
+    return src;
+}
+
+int main() {
+    size_t len;
+    char *src = generate(&len);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_jobs = cpus > 4 ? cpus : 4;
+
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+    void *serial = NULL;
+    size_t serial_len = 0;
+    double serial_time = 0;
+
+    printf("parallel: %.1f MB source, %ld cpus\n", len / 1e6, cpus);
+
+    for (int jobs = 1; jobs <= max_jobs; jobs *= 2) {
+        assemble_opts_t opts = { .jobs = jobs };
+        masm_ctx_set_opts(ctx, &opts);
+
+        const void *out;
+        size_t outlen;
+        double best = 1e9;
+
+        for (int r = 0; r < RUNS; r++) {
+            double start = now();
+            if (masm_assemble_buffer(ctx, src, len, &out, &outlen) != 0) {
+                masm_print_errors(ctx, stdout);
+                return 1;
+            }
+            double elapsed = now() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+
+        if (jobs == 1) {
+            serial = malloc(outlen);
+            memcpy(serial, out, outlen);
+            serial_len = outlen;
+            serial_time = best;
+        } else if (outlen != serial_len || memcmp(out, serial, outlen) != 0) {
+            printf("bench_parallel: output with %d jobs differs from the serial output!\n", jobs);
+            return 1;
+        }
+
+        printf("parallel %3d jobs: %7.1f MB/s, %5.2fx\n", jobs, len / best / 1e6, serial_time / best);
+    }
+
+    masm_ctx_destroy(ctx);
+    free(serial);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "scan.h"
+#include "lexer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// structural scanning benchmark, bitmap throughput of each kernel, of walking the bitmap, and of
+// tokenizing every statement with lex_line while comments are skipped through the bitmap
+
+#define SOURCE_BYTES (64 << 20)
+#define RUNS (3)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *generate(size_t len) {
+    static const char *lines[] = {
+        "    add $t0, $t1, $t2\n",
+        "    lw $s1, -4($sp)   # reload\n",
+        "loop:\n",
+        "    addi $t0, $t0, -1\n",
+        "    bne $t0, $0, loop\n",
+        "# just a comment line, nothing else on it\n",
+    };
+    char *src = malloc(len);
+    size_t n = 0;
+
+    srand(1);
+    while (n < len) {
+        const char *line = lines[rand() % 6];
+        size_t l = strlen(line);
+        if (l > len - n)
+            l = len - n;
+        memcpy(src + n, line, l);
+        n += l;
+    }
+    return src;
+}
+
+static double bench_kernel(scan_kernel_t kernel, const char *src, size_t len, uint64_t *count) {
+    double best = 1e9;
+
+    for (int r = 0; r < RUNS; r++) {
+        uint64_t total = 0;
+        double start = now();
+        for (size_t i = 0; i + SCAN_BLOCK <= len; i += SCAN_BLOCK)
+            total += __builtin_popcountll(kernel(src + i));
+        double elapsed = now() - start;
+
+        if (elapsed < best)
+            best = elapsed;
+        *count = total;
+    }
+    return len / best / 1e9;
+}
+
+static double bench_walk(scan_kernel_t kernel, const char *src, size_t len, uint64_t *count) {
+    double best = 1e9;
+
+    for (int r = 0; r < RUNS; r++) {
+        scanner_t scan;
+        uint64_t total = 0;
+
+        scanner_init(&scan, src, src + len);
+        scan.kernel = kernel;
+
+        double start = now();
+        for (const char *p = scanner_next(&scan, src); p < src + len; p = scanner_next(&scan, p + 1))
+            total++;
+        double elapsed = now() - start;
+
+        if (elapsed < best)
+            best = elapsed;
+        *count = total;
+    }
+    return len / best / 1e9;
+}
+
+static double bench_lex(scan_kernel_t kernel, const char *src, size_t len, uint64_t *count) {
+    const char *end = src + len;
+    double best = 1e9;
+
+    for (int r = 0; r < RUNS; r++) {
+        token_t toks[MAX_LINE_TOKENS];
+        scanner_t scan;
+        uint64_t total = 0;
+
+        scanner_init(&scan, src, end);
+        scan.kernel = kernel;
+
+        double start = now();
+        for (const char *p = src; p < end; p++) {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            if (p < end && *p != '\n' && *p != '#') {
+                p = lex_line(&scan, p, toks);
+                for (token_t *tok = toks; tok->kind != TOK_NEWLINE; tok++)
+                    total++;
+            }
+            // the comment, if there is one
+            while (p < end && *p != '\n')
+                p = scanner_next(&scan, p + 1);
+        }
+        double elapsed = now() - start;
+
+        if (elapsed < best)
+            best = elapsed;
+        *count = total;
+    }
+    return len / best / 1e9;
+}
+
+int main() {
+    const char *names[] = { "scalar", "sse2", "avx2" };
+    char *src = generate(SOURCE_BYTES);
+    uint64_t expected = 0, expected_toks = 0;
+
+    printf("scan: %d MB source, runtime pick is %s\n", SOURCE_BYTES >> 20, scan_kernel_name());
+
+    for (int k = 0; k < 3; k++) {
+        scan_kernel_t kernel = scan_find_kernel(names[k]);
+        if (kernel == NULL)
+            continue;
+
+        uint64_t bits, walked, toks;
+        double bitmap = bench_kernel(kernel, src, SOURCE_BYTES, &bits);
+        double walk = bench_walk(kernel, src, SOURCE_BYTES, &walked);
+        double lex = bench_lex(kernel, src, SOURCE_BYTES, &toks);
+
+        if (k == 0) {
+            expected = walked;
+            expected_toks = toks;
+        } else if (walked != expected || toks != expected_toks) {
+            printf("bench_scan: %s kernel found %lu structural chars and %lu tokens, scalar found %lu and %lu!\n",
+                   names[k], (unsigned long) walked, (unsigned long) toks,
+                   (unsigned long) expected, (unsigned long) expected_toks);
+            return 1;
+        }
+
+        printf("scan %-6s: bitmap %5.2f GB/s, walk %5.2f GB/s, lex %5.2f GB/s\n", names[k], bitmap, walk, lex);
+    }
+
+    free(src);
+    return 0;
+}
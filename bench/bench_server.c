@@ -0,0 +1,161 @@
+#include "server.h"
+#include "workload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// assembler server latency, a program at a time the way a test harness submits them
+// over one connection, a connection per program, and a ./masm process per program for comparison
+// the process numbers need ./masm, so run it from the repo root after make
+
+#define REQUESTS (2000)
+#define SPAWNED (200)
+#define LINES (200)
+#define WORKERS (2)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *lat, int count) {
+    qsort(lat, count, sizeof(double), cmp_double);
+    printf("%-20s p50 %8.1f us  p99 %8.1f us  (%d programs)\n",
+           name, lat[count / 2] * 1e6, lat[count * 99 / 100] * 1e6, count);
+}
+
+static void *run_server(void *arg) {
+    server_run(*(int *) arg, WORKERS);
+    return NULL;
+}
+
+/**
+ * Sends one program and checks the reply
+ * Returns -1 if it didn't come back assembled
+ */
+static int request(int fd, const char *src, size_t len) {
+    assemble_opts_t opts = { 0 };
+    server_reply_t reply;
+
+    int ret = server_assemble(fd, &opts, NULL, src, len, &reply);
+    if (ret == 0 && reply.status != REPLY_OK)
+        ret = -1;
+    server_reply_free(&reply);
+    return ret;
+}
+
+static int spawn_one(const char *path) {
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl("./masm", "./masm", path, "-o", "/dev/null", (char *) NULL);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return 0;
+}
+
+int main() {
+    char dir[] = "/tmp/masm-bench-server-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        printf("bench_server: couldn't create a temp dir\n");
+        return 1;
+    }
+
+    char sock[64], path[64];
+    snprintf(sock, sizeof(sock), "%s/sock", dir);
+    snprintf(path, sizeof(path), "%s/prog.asm", dir);
+
+    int listen_fd = server_listen(sock);
+    pthread_t thread;
+    if (listen_fd < 0 || pthread_create(&thread, NULL, run_server, &listen_fd) != 0) {
+        printf("bench_server: couldn't start the server\n");
+        return 1;
+    }
+
+    workload_t w;
+    workload_defaults(&w);
+    w.lines = LINES;
+
+    char *progs[REQUESTS];
+    size_t lens[REQUESTS];
+    for (int i = 0; i < REQUESTS; i++) {
+        w.seed = i + 1;
+        progs[i] = workload_generate(&w, &lens[i]);
+        if (progs[i] == NULL) {
+            printf("bench_server: out of memory\n");
+            return 1;
+        }
+    }
+
+    static double lat[REQUESTS];
+    int fd = server_connect(sock);
+    int ok = fd >= 0;
+
+    printf("server with %d workers, %d line programs\n", WORKERS, LINES);
+    for (int i = 0; i < REQUESTS && ok; i++) {
+        double t0 = now();
+        ok = request(fd, progs[i], lens[i]) == 0;
+        lat[i] = now() - t0;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (ok)
+        report("one connection", lat, REQUESTS);
+
+    for (int i = 0; i < REQUESTS && ok; i++) {
+        double t0 = now();
+        fd = server_connect(sock);
+        ok = fd >= 0 && request(fd, progs[i], lens[i]) == 0;
+        if (fd >= 0)
+            close(fd);
+        lat[i] = now() - t0;
+    }
+    if (ok)
+        report("connect per program", lat, REQUESTS);
+
+    if (!ok) {
+        printf("bench_server: a request failed\n");
+        return 1;
+    }
+
+    // a process also has to find its input on disk, so writing it counts too
+    if (access("./masm", X_OK) == 0) {
+        for (int i = 0; i < SPAWNED && ok; i++) {
+            double t0 = now();
+            FILE *fp = fopen(path, "w");
+            ok = fp != NULL && fwrite(progs[i], 1, lens[i], fp) == lens[i];
+            if (fp != NULL)
+                fclose(fp);
+            ok = ok && spawn_one(path) == 0;
+            lat[i] = now() - t0;
+        }
+        if (ok)
+            report("process per program", lat, SPAWNED);
+    }
+
+    for (int i = 0; i < REQUESTS; i++)
+        free(progs[i]);
+    unlink(path);
+    unlink(sock);
+    rmdir(dir);
+    close(listen_fd);
+    return 0;
+}
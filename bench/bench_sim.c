@@ -0,0 +1,383 @@
+#include "sim.h"
+#include "assemble.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// simulator benchmark, MIPS on a few small kernels written for this assembler (labels only, no
+// pseudo instructions), each checked against the output it should print, interpreted one
+// predecoded instruction at a time and run through the block cache, then the fib kernel run as a
+// batch of separate sims on the pool, to see what many short programs get out of more threads,
+// and traced, every instruction and sampled, for what recording costs and how big traces get
+// the generated workloads assemble fine but aren't programs, so they can't be run
+
+#define RUNS (5)
+#define BATCH_PROGRAMS (16)
+#define BATCH_KERNEL (2)
+#define TRACE_SAMPLE (1000)
+
+typedef struct {
+    const char *name;
+    const char *src;
+    const char *expected;
+} kernel_t;
+
+static const kernel_t KERNELS[] = {
+    {
+        "sum loop",
+        // sum of 0..49999999, wrapping
+        "    lui $t0, 762\n"
+        "    ori $t0, $t0, 61568\n"
+        "    addu $t1, $0, $0\n"
+        "loop:\n"
+        "    addiu $t0, $t0, -1\n"
+        "    addu $t1, $t1, $t0\n"
+        "    bne $t0, $0, loop\n"
+        "    addu $a0, $t1, $0\n"
+        "    addiu $v0, $0, 1\n"
+        "    syscall\n",
+        "1283106752"
+    },
+    {
+        "memory",
+        // fill a 4096 word array with i * 3, then sum it, 1000 times over
+        "    addiu $s0, $0, 1000\n"
+        "    addu $s1, $0, $0\n"
+        "    addiu $a0, $0, 16384\n"
+        "    addiu $v0, $0, 9\n"
+        "    syscall\n"
+        "    addu $s2, $v0, $0\n"
+        "outer:\n"
+        "    addu $t0, $s2, $0\n"
+        "    addu $t1, $0, $0\n"
+        "    addiu $t2, $0, 4096\n"
+        "fill:\n"
+        "    sw $t1, 0($t0)\n"
+        "    addiu $t1, $t1, 3\n"
+        "    addiu $t0, $t0, 4\n"
+        "    addiu $t2, $t2, -1\n"
+        "    bne $t2, $0, fill\n"
+        "    addu $t0, $s2, $0\n"
+        "    addiu $t2, $0, 4096\n"
+        "sum:\n"
+        "    lw $t3, 0($t0)\n"
+        "    addu $s1, $s1, $t3\n"
+        "    addiu $t0, $t0, 4\n"
+        "    addiu $t2, $t2, -1\n"
+        "    bne $t2, $0, sum\n"
+        "    addiu $s0, $s0, -1\n"
+        "    bne $s0, $0, outer\n"
+        "    addu $a0, $s1, $0\n"
+        "    addiu $v0, $0, 1\n"
+        "    syscall\n",
+        "-610123776"
+    },
+    {
+        "fib",
+        // recursive fib(27), a call and return every few instructions
+        "    addiu $a0, $0, 27\n"
+        "    jal fib\n"
+        "    addu $a0, $v0, $0\n"
+        "    addiu $v0, $0, 1\n"
+        "    syscall\n"
+        "    addiu $v0, $0, 10\n"
+        "    syscall\n"
+        "fib:\n"
+        "    slti $t0, $a0, 2\n"
+        "    beq $t0, $0, recurse\n"
+        "    addu $v0, $a0, $0\n"
+        "    jr $ra\n"
+        "recurse:\n"
+        "    addiu $sp, $sp, -12\n"
+        "    sw $ra, 0($sp)\n"
+        "    sw $a0, 4($sp)\n"
+        "    addiu $a0, $a0, -1\n"
+        "    jal fib\n"
+        "    sw $v0, 8($sp)\n"
+        "    lw $a0, 4($sp)\n"
+        "    addiu $a0, $a0, -2\n"
+        "    jal fib\n"
+        "    lw $t0, 8($sp)\n"
+        "    addu $v0, $v0, $t0\n"
+        "    lw $ra, 0($sp)\n"
+        "    addiu $sp, $sp, 12\n"
+        "    jr $ra\n",
+        "196418"
+    },
+    {
+        "sieve",
+        // primes below 2000000, bytes marked with sb and tested with lbu
+        "    lui $s0, 30\n"
+        "    ori $s0, $s0, 33920\n"
+        "    addu $a0, $s0, $0\n"
+        "    addiu $v0, $0, 9\n"
+        "    syscall\n"
+        "    addu $s1, $v0, $0\n"
+        "    addiu $t0, $0, 2\n"
+        "    addu $s2, $0, $0\n"
+        "    addiu $t4, $0, 1\n"
+        "next:\n"
+        "    addu $t1, $s1, $t0\n"
+        "    lbu $t2, 0($t1)\n"
+        "    bne $t2, $0, skip\n"
+        "    addiu $s2, $s2, 1\n"
+        "    multu $t0, $t0\n"
+        "    mflo $t3\n"
+        "    mfhi $t5\n"
+        "    bne $t5, $0, skip\n"
+        "mark:\n"
+        "    sltu $t5, $t3, $s0\n"
+        "    beq $t5, $0, skip\n"
+        "    addu $t1, $s1, $t3\n"
+        "    sb $t4, 0($t1)\n"
+        "    addu $t3, $t3, $t0\n"
+        "    j mark\n"
+        "skip:\n"
+        "    addiu $t0, $t0, 1\n"
+        "    bne $t0, $s0, next\n"
+        "    addu $a0, $s2, $0\n"
+        "    addiu $v0, $0, 1\n"
+        "    syscall\n",
+        "148933"
+    },
+    {
+        "sparse",
+        // a word in each of 64 pages a megabyte apart, each read back and replaced 200000 times
+        "    lui $s0, 4096\n"
+        "    lui $s1, 3\n"
+        "    ori $s1, $s1, 3392\n"
+        "    addu $s2, $0, $0\n"
+        "loop:\n"
+        "    andi $t0, $s1, 63\n"
+        "    sll $t0, $t0, 20\n"
+        "    addu $t0, $t0, $s0\n"
+        "    lw $t1, 0($t0)\n"
+        "    addu $s2, $s2, $t1\n"
+        "    sw $s1, 0($t0)\n"
+        "    addiu $s1, $s1, -1\n"
+        "    bne $s1, $0, loop\n"
+        "    addu $a0, $s2, $0\n"
+        "    addiu $v0, $0, 1\n"
+        "    syscall\n",
+        "-1474738560"
+    },
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    uint64_t steps;
+    double secs;
+} total_t;
+
+// best of RUNS, through the block cache or not, -1 if the kernel went wrong
+static int run_kernel(const kernel_t *kernel, const void *image, size_t image_len, int blocks,
+                      total_t *total, sim_block_stats_t *block_stats) {
+    double best = 1e9;
+    uint64_t steps = 0;
+
+    for (int r = 0; r < RUNS; r++) {
+        char *text = NULL;
+        size_t text_len = 0;
+        sim_t sim;
+
+        if (sim_init(&sim, image, image_len / 4, SIM_DEFAULT_MEMORY) != 0) {
+            printf("bench_sim: out of memory\n");
+            return -1;
+        }
+        sim.out = open_memstream(&text, &text_len);
+
+        double start = now();
+        SimStatus status = blocks ? sim_run_blocks(&sim, 0) : sim_run(&sim, 0);
+        double elapsed = now() - start;
+        fclose(sim.out);
+
+        if (status != SIM_EXIT || strcmp(text, kernel->expected) != 0) {
+            printf("bench_sim: %s printed '%s' (status %d, %s), expected '%s'\n",
+                   kernel->name, text, status, sim.fault, kernel->expected);
+            return -1;
+        }
+        if (elapsed < best)
+            best = elapsed;
+        steps = sim.steps;
+        *block_stats = sim.block_stats;
+        free(text);
+        sim_free(&sim);
+    }
+
+    printf("run %-10s %-6s: %10llu instructions in %7.1f ms, %7.1f MIPS\n", kernel->name,
+           blocks ? "blocks" : "plain", (unsigned long long) steps, best * 1e3, steps / best / 1e6);
+    total->steps += steps;
+    total->secs += best;
+    return 0;
+}
+
+typedef struct {
+    const void *image;
+    size_t image_len;
+    uint64_t steps[BATCH_PROGRAMS];
+    int failed[BATCH_PROGRAMS];
+} batch_t;
+
+static void batch_job(void *arg, int worker, size_t job) {
+    batch_t *batch = arg;
+    sim_t sim;
+    (void) worker;
+
+    batch->failed[job] = 1;
+    if (sim_init(&sim, batch->image, batch->image_len / 4, SIM_DEFAULT_MEMORY) != 0)
+        return;
+    sim.out = fopen("/dev/null", "w");
+    if (sim.out != NULL) {
+        batch->failed[job] = sim_run_blocks(&sim, 0) != SIM_EXIT;
+        batch->steps[job] = sim.steps;
+        fclose(sim.out);
+    }
+    sim_free(&sim);
+}
+
+// BATCH_PROGRAMS copies of a kernel, each on its own sim, best of RUNS, -1 if one went wrong
+static int run_batch(const kernel_t *kernel, const void *image, size_t image_len, int workers) {
+    batch_t *batch = calloc(1, sizeof(batch_t));
+    double best = 1e9;
+    uint64_t steps = 0;
+
+    if (batch == NULL) {
+        printf("bench_sim: out of memory\n");
+        return -1;
+    }
+    batch->image = image;
+    batch->image_len = image_len;
+
+    for (int r = 0; r < RUNS; r++) {
+        double start = now();
+        int ret = pool_run(BATCH_PROGRAMS, workers, batch_job, batch);
+        double elapsed = now() - start;
+
+        steps = 0;
+        for (size_t i = 0; i < BATCH_PROGRAMS; i++) {
+            if (batch->failed[i])
+                ret = -1;
+            steps += batch->steps[i];
+        }
+        if (ret != 0) {
+            printf("bench_sim: batch of %s failed\n", kernel->name);
+            free(batch);
+            return -1;
+        }
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    printf("batch %d x %-6s %d thread%s: %10llu instructions in %7.1f ms, %7.1f MIPS\n", BATCH_PROGRAMS,
+           kernel->name, workers, workers == 1 ? " " : "s", (unsigned long long) steps, best * 1e3,
+           steps / best / 1e6);
+    free(batch);
+    return 0;
+}
+
+// the kernel traced into path every period instructions, best of RUNS, -1 if it went wrong
+static int run_traced(const kernel_t *kernel, const void *image, size_t image_len, const char *path, uint32_t period) {
+    double best = 1e9;
+    uint64_t steps = 0;
+    struct stat st = { 0 };
+
+    for (int r = 0; r < RUNS; r++) {
+        sim_t sim;
+
+        if (sim_init(&sim, image, image_len / 4, SIM_DEFAULT_MEMORY) != 0 || sim_trace_start(&sim, path, period) != 0) {
+            printf("bench_sim: couldn't start a trace in %s\n", path);
+            return -1;
+        }
+        sim.out = fopen("/dev/null", "w");
+
+        double start = now();
+        SimStatus status = sim_run(&sim, 0);
+        int ret = sim_trace_stop(&sim);
+        double elapsed = now() - start;
+
+        fclose(sim.out);
+        steps = sim.steps;
+        sim_free(&sim);
+        if (status != SIM_EXIT || ret != 0 || stat(path, &st) != 0) {
+            printf("bench_sim: traced %s failed\n", kernel->name);
+            return -1;
+        }
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    printf("trace %-8s 1 in %-5u: %10llu instructions in %7.1f ms, %7.1f MIPS, %.2f bytes an instruction\n",
+           kernel->name, period, (unsigned long long) steps, best * 1e3, steps / best / 1e6, (double) st.st_size / steps);
+    return 0;
+}
+
+int main() {
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+    assemble_opts_t opts = { .endian = host_endian() };
+
+    if (ctx == NULL) {
+        printf("bench_sim: out of memory\n");
+        return 1;
+    }
+    masm_ctx_set_opts(ctx, &opts);
+
+    total_t totals[2] = { { 0 } };
+
+    for (size_t k = 0; k < sizeof(KERNELS) / sizeof(KERNELS[0]); k++) {
+        const kernel_t *kernel = &KERNELS[k];
+        const void *image;
+        size_t image_len;
+
+        if (masm_assemble_buffer(ctx, kernel->src, strlen(kernel->src), &image, &image_len) != 0) {
+            printf("bench_sim: %s didn't assemble\n", kernel->name);
+            masm_print_errors(ctx, stdout);
+            return 1;
+        }
+
+        sim_block_stats_t b;
+        for (int blocks = 0; blocks < 2; blocks++) {
+            if (run_kernel(kernel, image, image_len, blocks, &totals[blocks], &b) != 0)
+                return 1;
+        }
+        printf("    %llu blocks, %llu hits, %llu misses, %llu chained\n", (unsigned long long) b.translated,
+               (unsigned long long) b.hits, (unsigned long long) b.misses, (unsigned long long) b.chains);
+    }
+
+    for (int blocks = 0; blocks < 2; blocks++) {
+        printf("run %-10s %-6s: %10llu instructions in %7.1f ms, %7.1f MIPS\n", "all", blocks ? "blocks" : "plain",
+               (unsigned long long) totals[blocks].steps, totals[blocks].secs * 1e3,
+               totals[blocks].steps / totals[blocks].secs / 1e6);
+    }
+
+    const void *image;
+    size_t image_len;
+    if (masm_assemble_buffer(ctx, KERNELS[BATCH_KERNEL].src, strlen(KERNELS[BATCH_KERNEL].src), &image, &image_len) != 0)
+        return 1;
+    for (int workers = 1; workers <= 4; workers *= 2) {
+        if (run_batch(&KERNELS[BATCH_KERNEL], image, image_len, workers) != 0)
+            return 1;
+    }
+
+    char path[] = "/tmp/masm-bench-trace-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+    close(fd);
+    int ret = run_traced(&KERNELS[BATCH_KERNEL], image, image_len, path, 1);
+    if (ret == 0)
+        ret = run_traced(&KERNELS[BATCH_KERNEL], image, image_len, path, TRACE_SAMPLE);
+    unlink(path);
+    if (ret != 0)
+        return 1;
+    masm_ctx_destroy(ctx);
+    return 0;
+}
@@ -0,0 +1,310 @@
+#include "assemble.h"
+#include "source.h"
+#include "workload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// end to end throughput suite
+// every workload is generated to a file and assembled in a child process so peak RSS is per workload
+// results are compared against bench/baseline.txt and a big enough slowdown fails the run
+
+#define RUNS (3)
+#define DEFAULT_BASELINE "bench/baseline.txt"
+#define DEFAULT_TOLERANCE (0.3)
+
+typedef struct {
+    const char *name;
+    workload_t w;
+    assemble_opts_t opts;
+    int stream; // read through masm_assemble_stream instead of mapping the file
+} suite_entry_t;
+
+// what a child sends back after assembling once
+typedef struct {
+    double load;     // mapping the source
+    double assemble; // both passes
+    double write;    // writing the image
+    size_t bytes;
+    size_t instrs;
+    size_t errors;
+} run_result_t;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int build_suite(suite_entry_t *suite) {
+    int n = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    suite[n].name = "mixed";
+    workload_defaults(&suite[n].w);
+    suite[n++].w.lines = 500000;
+
+    suite[n].name = "labels";
+    workload_defaults(&suite[n].w);
+    suite[n].w.lines = 500000;
+    suite[n++].w.label_density = 0.3;
+
+    suite[n].name = "comments";
+    workload_defaults(&suite[n].w);
+    suite[n].w.lines = 500000;
+    suite[n++].w.comment_density = 0.6;
+
+    suite[n].name = "errors";
+    workload_defaults(&suite[n].w);
+    suite[n].w.lines = 500000;
+    suite[n++].w.error_rate = 0.02;
+
+    suite[n].name = "one-pass";
+    workload_defaults(&suite[n].w);
+    suite[n].w.lines = 500000;
+    suite[n++].opts.one_pass = 1;
+
+    suite[n].name = "large";
+    workload_defaults(&suite[n].w);
+    suite[n++].w.lines = 4000000;
+
+    suite[n].name = "large-j";
+    workload_defaults(&suite[n].w);
+    suite[n].w.lines = 4000000;
+    suite[n++].opts.jobs = cpus > 1 ? cpus : 2;
+
+    // same input as large piped in one pass, RSS should stay around the buffer and fixups instead of the input size
+    suite[n].name = "stream";
+    workload_defaults(&suite[n].w);
+    suite[n].w.lines = 4000000;
+    suite[n++].stream = 1;
+
+    return n;
+}
+
+/**
+ * Streams in to out through a pipe from cat, the read and write are part of the assembly time
+ * a regular file on stdin would be mapped, the pipe is what keeps RSS down to the buffer
+ */
+static void run_child_stream(const char *in, const char *out, const assemble_opts_t *opts, int fd) {
+    run_result_t r = { 0 };
+    char cmd[256];
+    struct stat st;
+
+    snprintf(cmd, sizeof(cmd), "cat '%s'", in);
+    FILE *pipe_fp = popen(cmd, "r");
+    int out_fd = open(out, O_WRONLY | O_TRUNC);
+    FILE *errors = fopen("/dev/null", "w");
+
+    if (pipe_fp == NULL || out_fd < 0 || errors == NULL || stat(in, &st) != 0)
+        _exit(1);
+
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+    masm_ctx_set_opts(ctx, opts);
+
+    double t0 = now();
+    masm_assemble_stream(ctx, fileno(pipe_fp), out_fd, errors);
+    r.assemble = now() - t0;
+
+    if (pclose(pipe_fp) != 0)
+        _exit(1);
+    r.bytes = st.st_size;
+    r.instrs = lseek(out_fd, 0, SEEK_CUR) / 4;
+    r.errors = masm_error_count(ctx);
+
+    if (write(fd, &r, sizeof(r)) != sizeof(r))
+        _exit(1);
+    _exit(0);
+}
+
+static void run_child(const char *in, const char *out, const assemble_opts_t *opts, int fd) {
+    run_result_t r = { 0 };
+    source_t src;
+
+    double t0 = now();
+    if (source_open(&src, in) != 0)
+        _exit(1);
+
+    double t1 = now();
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+    masm_ctx_set_opts(ctx, opts);
+
+    const void *image;
+    size_t image_len;
+    masm_assemble_buffer(ctx, src.data, src.len, &image, &image_len);
+
+    double t2 = now();
+    if (write_file(out, image, image_len) != 0)
+        _exit(1);
+    double t3 = now();
+
+    r.load = t1 - t0;
+    r.assemble = t2 - t1;
+    r.write = t3 - t2;
+    r.bytes = src.len;
+    r.instrs = image_len / 4;
+    r.errors = masm_error_count(ctx);
+
+    if (write(fd, &r, sizeof(r)) != sizeof(r))
+        _exit(1);
+    _exit(0);
+}
+
+/**
+ * Assembles in a fresh process, returns the child's timings and its peak RSS in KB
+ */
+static int run_once(const char *in, const char *out, const suite_entry_t *entry, run_result_t *r, long *rss_kb) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        close(fds[0]);
+        if (entry->stream)
+            run_child_stream(in, out, &entry->opts, fds[1]);
+        run_child(in, out, &entry->opts, fds[1]);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], r, sizeof(*r));
+    close(fds[0]);
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || got != sizeof(*r))
+        return -1;
+
+    *rss_kb = ru.ru_maxrss;
+    return 0;
+}
+
+static double read_baseline(const char *path, const char *name) {
+    FILE *fp = fopen(path, "r");
+    char line[256], key[64];
+    double value;
+
+    if (fp == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] != '#' && sscanf(line, "%63s %lf", key, &value) == 2 && strcmp(key, name) == 0) {
+            fclose(fp);
+            return value;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *baseline = DEFAULT_BASELINE;
+    int update = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--update") == 0)
+            update = 1;
+        else
+            baseline = argv[i];
+    }
+
+    double tolerance = DEFAULT_TOLERANCE;
+    if (getenv("MASM_BENCH_TOLERANCE") != NULL)
+        tolerance = atof(getenv("MASM_BENCH_TOLERANCE"));
+
+    char in[] = "/tmp/masm-bench-in-XXXXXX";
+    char out[] = "/tmp/masm-bench-out-XXXXXX";
+    int in_fd = mkstemp(in);
+    int out_fd = mkstemp(out);
+    if (in_fd < 0 || out_fd < 0) {
+        printf("bench_suite: couldn't create temp files\n");
+        return 1;
+    }
+    close(out_fd);
+
+    suite_entry_t suite[16];
+    memset(suite, 0, sizeof(suite));
+    int count = build_suite(suite);
+
+    FILE *update_fp = NULL;
+    if (update) {
+        update_fp = fopen(baseline, "w");
+        if (update_fp == NULL) {
+            printf("bench_suite: couldn't write %s\n", baseline);
+            return 1;
+        }
+        fprintf(update_fp, "# workload MB/s, regenerate with 'make bench-baseline'\n");
+    }
+
+    printf("%-10s %8s %9s %8s %8s %8s %8s %7s\n", "workload", "MB", "MB/s", "Minstr/s", "load ms", "asm ms", "write ms", "RSS MB");
+
+    int regressions = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len;
+        char *src = workload_generate(&suite[i].w, &len);
+
+        if (src == NULL || ftruncate(in_fd, 0) != 0 || pwrite(in_fd, src, len, 0) != (ssize_t) len) {
+            printf("bench_suite: couldn't generate %s\n", suite[i].name);
+            return 1;
+        }
+        free(src);
+
+        run_result_t best = { 0 };
+        long rss = 0;
+        for (int r = 0; r < RUNS; r++) {
+            run_result_t res;
+            long res_rss;
+
+            if (run_once(in, out, &suite[i], &res, &res_rss) != 0) {
+                printf("bench_suite: %s failed to run\n", suite[i].name);
+                return 1;
+            }
+
+            double total = res.load + res.assemble + res.write;
+            if (r == 0 || total < best.load + best.assemble + best.write)
+                best = res;
+            if (res_rss > rss)
+                rss = res_rss;
+        }
+
+        double total = best.load + best.assemble + best.write;
+        double mbps = best.bytes / total / 1e6;
+        printf("%-10s %8.1f %9.1f %8.2f %8.2f %8.2f %8.2f %7.1f",
+               suite[i].name, best.bytes / 1e6, mbps, best.instrs / total / 1e6,
+               best.load * 1e3, best.assemble * 1e3, best.write * 1e3, rss / 1024.0);
+
+        if (update) {
+            fprintf(update_fp, "%s %.1f\n", suite[i].name, mbps);
+        } else {
+            double base = read_baseline(baseline, suite[i].name);
+            if (base > 0 && mbps < base * (1 - tolerance)) {
+                printf("  REGRESSION (baseline %.1f MB/s)", base);
+                regressions++;
+            }
+        }
+        printf("\n");
+    }
+
+    close(in_fd);
+    unlink(in);
+    unlink(out);
+
+    if (update_fp != NULL) {
+        fclose(update_fp);
+        printf("baseline written to %s\n", baseline);
+    }
+
+    if (regressions > 0) {
+        printf("bench_suite: %d workload(s) slower than %s allows\n", regressions, baseline);
+        return 1;
+    }
+    return 0;
+}
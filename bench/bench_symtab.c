@@ -0,0 +1,75 @@
+#include "symtab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// symbol table benchmark, interns and looks up label counts from 1k to 1M
+
+#define LOOKUPS_PER_LABEL (4)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// labels shaped like the ones our generators emit
+static int label_name(char *buf, uint32_t i) {
+    return sprintf(buf, "L_%s_%u", (i & 1) ? "loop" : "blk", i * 2654435761u);
+}
+
+static int run(uint32_t count) {
+    symtab_t tab;
+
+    // names are generated up front so the timings only cover the table
+    char *names = malloc((size_t) count * 32);
+    int *lens = malloc(count * sizeof(int));
+
+    if (names == NULL || lens == NULL || symtab_init(&tab, &MASM_DEFAULT_ALLOCATOR) != 0)
+        return -1;
+
+    for (uint32_t i = 0; i < count; i++)
+        lens[i] = label_name(names + (size_t) i * 32, i);
+
+    double start = now();
+    for (uint32_t i = 0; i < count; i++) {
+        int32_t id = symtab_intern(&tab, names + (size_t) i * 32, lens[i]);
+        if (id < 0)
+            return -1;
+        symtab_get(&tab, id)->pc = i * 4;
+        symtab_get(&tab, id)->defined = 1;
+    }
+    double insert = now() - start;
+
+    // look labels up in a scattered order, like branch operands would
+    uint32_t misses = 0;
+    start = now();
+    for (uint32_t n = 0; n < count * LOOKUPS_PER_LABEL; n++) {
+        uint32_t i = (n * 40503u) % count;
+        int32_t id = symtab_find(&tab, names + (size_t) i * 32, lens[i]);
+        if (id < 0 || symtab_get(&tab, id)->pc != i * 4)
+            misses++;
+    }
+    double lookup = now() - start;
+
+    symtab_free(&tab);
+    free(names);
+    free(lens);
+
+    if (misses != 0) {
+        printf("bench_symtab: %u lookups failed!\n", misses);
+        return -1;
+    }
+
+    printf("symtab %8u labels: insert %6.1f ns/label, lookup %6.1f ns/lookup\n",
+           count, insert * 1e9 / count, lookup * 1e9 / (count * LOOKUPS_PER_LABEL));
+    return 0;
+}
+
+int main() {
+    for (uint32_t count = 1000; count <= 1000000; count *= 10) {
+        if (run(count) != 0)
+            return 1;
+    }
+    return 0;
+}
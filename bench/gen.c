@@ -0,0 +1,66 @@
+#include "workload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+// writes a synthetic assembly program to stdout
+
+static void usage(const char *name) {
+    printf("Usage: %s [options] > out.asm\n", name);
+    printf("  -n, --lines N       instruction lines (default 100000)\n");
+    printf("  -s, --seed N        random seed (default 1)\n");
+    printf("  -l, --labels F      labels per line (default 0.05)\n");
+    printf("  -c, --comments F    chance of a comment per line (default 0.1)\n");
+    printf("  -e, --errors F      chance a line is malformed (default 0)\n");
+    printf("  -m, --mix SPEC      weights per param order, e.g. RD_RS_RT=10,RT_IMM_RS=5\n");
+    printf("                      orders: ");
+    for (int i = 0; i < NUM_PARAM_ORDERS; i++)
+        printf("%s%s", PARAM_ORDER_NAMES[i], i < NUM_PARAM_ORDERS - 1 ? " " : "\n");
+}
+
+int main(int argc, char **argv) {
+    workload_t w;
+    workload_defaults(&w);
+
+    static const struct option long_opts[] = {
+        { "lines",    required_argument, NULL, 'n' },
+        { "seed",     required_argument, NULL, 's' },
+        { "labels",   required_argument, NULL, 'l' },
+        { "comments", required_argument, NULL, 'c' },
+        { "errors",   required_argument, NULL, 'e' },
+        { "mix",      required_argument, NULL, 'm' },
+        { "help",     no_argument,       NULL, 'h' },
+        { 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:s:l:c:e:m:h", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'n': w.lines = strtoull(optarg, NULL, 0); break;
+            case 's': w.seed = strtoull(optarg, NULL, 0); break;
+            case 'l': w.label_density = atof(optarg); break;
+            case 'c': w.comment_density = atof(optarg); break;
+            case 'e': w.error_rate = atof(optarg); break;
+            case 'm':
+                if (workload_parse_mix(&w, optarg) != 0) {
+                    fprintf(stderr, "Bad mix '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h': usage(argv[0]); return 0;
+            default:  usage(argv[0]); return 1;
+        }
+    }
+
+    size_t len;
+    char *src = workload_generate(&w, &len);
+
+    if (src == NULL) {
+        fprintf(stderr, "Couldn't generate workload\n");
+        return 1;
+    }
+
+    fwrite(src, 1, len, stdout);
+    free(src);
+    return 0;
+}
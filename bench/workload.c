@@ -0,0 +1,228 @@
+#include "workload.h"
+#include "register.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *PARAM_ORDER_NAMES[] = {
+    "RS", "RD", "RD_RS", "RS_RT", "RD_RS_RT", "RD_RT_RS", "RD_RT_SA", "LABEL",
+    "RT_RS_IMM", "RS_RT_LABEL", "RS_LABEL", "RT_IMM_RS", "RT_IMM", "NONE"
+};
+
+// how far (in lines) a branch may reach, keeps every branch comfortably inside 16 bits
+#define BRANCH_LINE_REACH (8000)
+#define BRANCH_LABEL_REACH_MAX (64)
+
+void workload_defaults(workload_t *w) {
+    memset(w, 0, sizeof(*w));
+    w->seed = 1;
+    w->lines = 100000;
+    w->label_density = 0.05;
+    w->comment_density = 0.1;
+    w->error_rate = 0;
+
+    // roughly what compiled code looks like: mostly ALU ops and memory accesses
+    unsigned weights[NUM_PARAM_ORDERS] = {
+        [RS] = 2, [RD] = 1, [RD_RS] = 1, [RS_RT] = 1, [RD_RS_RT] = 20, [RD_RT_RS] = 2,
+        [RD_RT_SA] = 5, [LABEL] = 3, [RT_RS_IMM] = 20, [RS_RT_LABEL] = 8, [RS_LABEL] = 3,
+        [RT_IMM_RS] = 25, [RT_IMM] = 4, [NONE] = 1
+    };
+    memcpy(w->mix, weights, sizeof(weights));
+}
+
+/**
+ * Parses a mix like "RD_RS_RT=10,RT_IMM_RS=5", orders that aren't listed get weight 0
+ * Returns -1 on an unknown order name
+ */
+int workload_parse_mix(workload_t *w, const char *spec) {
+    unsigned mix[NUM_PARAM_ORDERS] = { 0 };
+    const char *p = spec;
+
+    while (*p != '\0') {
+        const char *eq = strchr(p, '=');
+        if (eq == NULL)
+            return -1;
+
+        int order;
+        for (order = 0; order < NUM_PARAM_ORDERS; order++) {
+            if (strlen(PARAM_ORDER_NAMES[order]) == (size_t) (eq - p) && strncmp(p, PARAM_ORDER_NAMES[order], eq - p) == 0)
+                break;
+        }
+        if (order == NUM_PARAM_ORDERS)
+            return -1;
+
+        char *end;
+        mix[order] = strtoul(eq + 1, &end, 10);
+        if (*end != ',' && *end != '\0')
+            return -1;
+
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    memcpy(w->mix, mix, sizeof(mix));
+    return 0;
+}
+
+// xorshift64*, so the output doesn't depend on the libc rand()
+static inline uint64_t next_rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static inline unsigned rand_below(uint64_t *state, unsigned n) {
+    return (next_rand(state) >> 32) % n;
+}
+
+static inline double rand_unit(uint64_t *state) {
+    return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// a register, written either by number or by name
+static const char *rand_reg(uint64_t *state, char *buf) {
+    unsigned reg = rand_below(state, NUM_REGS);
+
+    if (rand_below(state, 2))
+        sprintf(buf, "$%u", reg);
+    else
+        sprintf(buf, "$%s", REGISTERS[reg]);
+    return buf;
+}
+
+// a label near the current one for branches, anywhere for jumps
+static unsigned rand_label(uint64_t *state, unsigned current, unsigned total, unsigned reach, int branch) {
+    if (total == 0)
+        return 0;
+    if (!branch)
+        return rand_below(state, total);
+
+    int target = (int) current + (int) rand_below(state, 2 * reach + 1) - (int) reach;
+    if (target < 0)
+        target = 0;
+    if (target >= (int) total)
+        target = total - 1;
+    return target;
+}
+
+/**
+ * Writes one instruction with the given param order
+ */
+static int write_instr(char *out, uint64_t *state, ParamOrder order, unsigned label, unsigned labels, unsigned reach) {
+    // pick a random instruction that takes this param order
+    InstrID ids[NUM_INSTR];
+    int n = 0;
+    for (int i = 0; i < NUM_INSTR; i++)
+        if (PARAM_ORDERS[i] == order)
+            ids[n++] = i;
+
+    const char *name = INSTRUCTIONS[ids[rand_below(state, n)]];
+    char a[8], b[8], c[8];
+
+    switch (order) {
+        case RS:
+        case RD:
+            return sprintf(out, "    %s %s", name, rand_reg(state, a));
+        case RD_RS:
+        case RS_RT:
+            return sprintf(out, "    %s %s, %s", name, rand_reg(state, a), rand_reg(state, b));
+        case RD_RS_RT:
+        case RD_RT_RS:
+            return sprintf(out, "    %s %s, %s, %s", name, rand_reg(state, a), rand_reg(state, b), rand_reg(state, c));
+        case RD_RT_SA:
+            return sprintf(out, "    %s %s, %s, %u", name, rand_reg(state, a), rand_reg(state, b), rand_below(state, 32));
+        case LABEL:
+            return sprintf(out, "    %s L%u", name, rand_label(state, label, labels, reach, 0));
+        case RT_RS_IMM:
+            return sprintf(out, "    %s %s, %s, %d", name, rand_reg(state, a), rand_reg(state, b), (int) rand_below(state, 2001) - 1000);
+        case RS_RT_LABEL:
+            return sprintf(out, "    %s %s, %s, L%u", name, rand_reg(state, a), rand_reg(state, b), rand_label(state, label, labels, reach, 1));
+        case RS_LABEL:
+            return sprintf(out, "    %s %s, L%u", name, rand_reg(state, a), rand_label(state, label, labels, reach, 1));
+        case RT_IMM_RS:
+            return sprintf(out, "    %s %s, %d(%s)", name, rand_reg(state, a), (int) rand_below(state, 512) * 4 - 1024, rand_reg(state, b));
+        case RT_IMM:
+            return sprintf(out, "    %s %s, 0x%x", name, rand_reg(state, a), rand_below(state, 0xfffe));
+        case NONE:
+            return sprintf(out, "    %s", name);
+    }
+    return 0;
+}
+
+// the kinds of mistakes people make
+static int write_error(char *out, uint64_t *state) {
+    switch (rand_below(state, 4)) {
+        case 0:  return sprintf(out, "    frob $t0, $t1");
+        case 1:  return sprintf(out, "    add $t0, $q9, $t1");
+        case 2:  return sprintf(out, "    addi $t0, $t1");
+        default: return sprintf(out, "    lw $t0, 8[$sp]");
+    }
+}
+
+/**
+ * Generates the program described by w, returns a malloc'd buffer and its length in len
+ * Returns NULL if out of memory or the mix is all zeros
+ */
+char *workload_generate(const workload_t *w, size_t *len) {
+    unsigned total_weight = 0;
+    for (int i = 0; i < NUM_PARAM_ORDERS; i++)
+        total_weight += w->mix[i];
+    if (total_weight == 0)
+        return NULL;
+
+    unsigned labels = w->lines * w->label_density;
+
+    // branches reach a fixed number of lines whatever the label density
+    unsigned reach = BRANCH_LINE_REACH * w->label_density;
+    if (reach < 1)
+        reach = 1;
+    if (reach > BRANCH_LABEL_REACH_MAX)
+        reach = BRANCH_LABEL_REACH_MAX;
+
+    // every instruction line is well under 128 bytes with its comments, labels are under 16
+    size_t cap = (w->lines + 1) * 128 + (size_t) labels * 16;
+    char *src = malloc(cap);
+    if (src == NULL)
+        return NULL;
+
+    uint64_t state = w->seed * 0x9e3779b97f4a7c15ull + 1;
+    unsigned label = 0;
+    double label_acc = 0;
+    size_t n = 0;
+
+    for (size_t line = 0; line < w->lines; line++) {
+        // labels are spread evenly so branches always have one nearby
+        label_acc += w->label_density;
+        while (label_acc >= 1 && label < labels) {
+            n += sprintf(src + n, "L%u:\n", label++);
+            label_acc -= 1;
+        }
+
+        int comment = rand_unit(&state) < w->comment_density;
+        if (comment && rand_below(&state, 2)) {
+            n += sprintf(src + n, "# line %zu\n", line);
+            comment = 0;
+        }
+
+        if (w->error_rate > 0 && rand_unit(&state) < w->error_rate)
+            n += write_error(src + n, &state);
+        else {
+            unsigned pick = rand_below(&state, total_weight);
+            int order = 0;
+            while (pick >= w->mix[order])
+                pick -= w->mix[order++];
+            n += write_instr(src + n, &state, order, label, labels, reach);
+        }
+
+        if (comment)
+            n += sprintf(src + n, "    # trailing comment");
+        src[n++] = '\n';
+    }
+
+    // labels that didn't get placed yet still need to exist
+    while (label < labels)
+        n += sprintf(src + n, "L%u:\n", label++);
+
+    *len = n;
+    return src;
+}
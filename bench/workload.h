@@ -0,0 +1,21 @@
+#pragma once
+
+#include "instr.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// knobs for a synthetic assembly program, the same settings always give the same source
+typedef struct {
+    uint64_t seed;
+    size_t lines;                       // instruction lines, not counting labels or comment lines
+    double label_density;               // labels per instruction line
+    double comment_density;             // chance of a comment per instruction line
+    double error_rate;                  // chance an instruction line is malformed
+    unsigned mix[NUM_PARAM_ORDERS];     // relative weight of each ParamOrder
+} workload_t;
+
+extern const char *PARAM_ORDER_NAMES[];
+
+void workload_defaults(workload_t *w);
+int workload_parse_mix(workload_t *w, const char *spec);
+char *workload_generate(const workload_t *w, size_t *len);
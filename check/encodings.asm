@@ -0,0 +1,58 @@
+# every instruction once, with a different register in every field
+start:
+    add $t0, $t1, $t2
+    addu $s0, $s1, $s2
+    and $v0, $v1, $a0
+    break
+    div $a1, $a2
+    divu $a3, $t3
+    jalr $ra, $t4
+    jr $ra
+    mfhi $t5
+    mflo $t6
+    mthi $t7
+    mtlo $t8
+    mult $t9, $k0
+    multu $k1, $gp
+    nor $sp, $fp, $at
+    or $1, $2, $3
+    sll $4, $5, 31
+    sllv $6, $7, $8
+    slt $9, $10, $11
+    sltu $12, $13, $14
+    sra $15, $16, 1
+    srav $17, $18, $19
+    srl $20, $21, 16
+    srlv $22, $23, $24
+    sub $25, $26, $27
+    subu $28, $29, $30
+    syscall
+    xor $31, $0, $31
+    j start
+    jal end
+    addi $t0, $t1, -1
+    addiu $t0, $t1, 32767
+    andi $t0, $t1, 0xffff
+    beq $t0, $t1, start
+    bgez $t0, end
+    bgtz $t0, start
+    blez $t0, end
+    bltz $t0, start
+    bne $t0, $t1, end
+    lb $t0, -4($sp)
+    lbu $t0, 0($sp)
+    lh $t0, 2($gp)
+    lhu $t0, ($gp)
+    lui $t0, 0x1234
+    lw $t0, 4 ( $sp )
+    lwcl $t0, 8($a0)
+    ori $t0, $t1, 10
+    sb $t0, 1($a0)
+    slti $t0, $t1, -32768
+    sltiu $t0, $t1, 65535
+    sh $t0, 6($a0)
+    sw $t0, -8($sp)
+    swcl $t0, 12($a0)
+    xori $t0, $t1, 0x8000
+end:
+    jr $ra
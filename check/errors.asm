@@ -0,0 +1,19 @@
+# every line is wrong in its own way, the errors have to come out in this order
+    frob $t0, $t1
+    add $t0, $t1
+    add $t0, $t1, $t2, $t3
+    add $t0, $t1 $t2
+    add $t0, $tx, $t2
+    add $t0, , $t2
+    addi $t0, $t1, fred
+    lw $t0, 4($sp
+    lw $t0, 4
+    syscall $t0
+    j nowhere
+    beq $0, $0, also_nowhere
+dup:
+dup:
+    add $t0, $t1, $t2
+    jr
+    : add $t0, $t1, $t2
+    sub$t0: $t1
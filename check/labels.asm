@@ -0,0 +1,16 @@
+# forward and backward references, labels sharing an address, labels on their own line
+top: back:
+    beq $0, $0, fwd   # forward branch
+    bne $t0, $t1, top
+here:
+    j fwd
+    jal here
+fwd:
+lonely:
+    bgez $0, back
+    blez $0, fwd
+    j lonely
+inline: add $t0, $t1, $t2
+tight:# a comment right after the colon
+    beq $0, $0, inline
+    bne $0, $0, tight
@@ -0,0 +1,16 @@
+# 16 bit immediates take -32768 to 65535, shift amounts 0 to 31
+    addi $t0, $t0, -32768
+    addi $t0, $t0, 65535
+    addi $t0, $t0, -32769
+    addi $t0, $t0, 65536
+    ori $t0, $t0, 0x10000
+    lw $t0, -32768($sp)
+    lw $t0, 65535($sp)
+    lw $t0, 70000($sp)
+    lui $t0, -1
+    lui $t0, 0xfffff
+    sll $t0, $t0, 0
+    sll $t0, $t0, 31
+    sll $t0, $t0, 32
+    srl $t0, $t0, -1
+    sra $t0, $t0, 0x20
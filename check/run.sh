@@ -0,0 +1,120 @@
+#!/bin/sh
+# regression check, run by 'make check'
+# every check/NAME.asm is assembled two-pass, --one-pass, with -j, and streamed from stdin both as
+# a file (mapped, two passes) and through a pipe (one pass), and has to match the golden files:
+#   NAME.hex  the image as big endian words, one per line, empty if it didn't assemble
+#   NAME.err  everything the two-pass run printed, then its exit status
+# the one pass modes report errors as they find them, so labels that are never defined come last
+# and duplicates where they're seen rather than from pass 1: their messages have to match the
+# golden ones in position order, and each other exactly
+# programs from masm-gen, a long branch and comments longer than the pipe buffer are generated
+# too, big enough for -j to split them, and every mode has to agree with the two-pass output on those the same way
+# with --update the golden files are rewritten from the two-pass output instead, check the diff
+
+MASM=${MASM:-./masm}
+GEN=${GEN:-build/masm-gen}
+DIR=$(dirname "$0")
+UPDATE=0
+[ "$1" = "--update" ] && UPDATE=1
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+failed=0
+checked=0
+
+# assembles $2 in mode $1, leaving the image in $3.hex and the messages in $3.err
+assemble() {
+    rm -f "$TMP/out.bin"
+    case $1 in
+        two-pass) "$MASM" --endian=big -o "$TMP/out.bin" "$2" > "$3.err" 2>&1 ;;
+        one-pass) "$MASM" --endian=big --one-pass -o "$TMP/out.bin" "$2" > "$3.err" 2>&1 ;;
+        jobs)     "$MASM" --endian=big -j 4 -o "$TMP/out.bin" "$2" > "$3.err" 2>&1 ;;
+        mapped)   "$MASM" --endian=big -o - - < "$2" > "$TMP/out.bin" 2> "$3.err" ;;
+        pipe)     cat "$2" | "$MASM" --endian=big -o - - > "$TMP/out.bin" 2> "$3.err" ;;
+    esac
+    status=$?
+    echo "exit $status" >> "$3.err"
+
+    # a failed stream may have written part of the image already, the file modes write nothing
+    if [ $status -eq 0 ] && [ -f "$TMP/out.bin" ]; then
+        od -An -v -tx1 "$TMP/out.bin" | tr -s ' \n' '\n\n' | grep . | paste -d '\0' - - - - > "$3.hex"
+    else
+        : > "$3.hex"
+    fi
+}
+
+# messages by the line and column they're at, the rest after them
+by_position() {
+    awk '{ at = match($0, / at [0-9]+:[0-9]+$/) ? substr($0, RSTART + 4) : "999999999:0"
+           split(at, p, ":"); printf "%09d %06d %s\n", p[1], p[2], $0 }' "$1" | sort | cut -d' ' -f3-
+}
+
+# diffs $1 against the expected $2, naming the case $3
+compare() {
+    checked=$((checked + 1))
+    if ! cmp -s "$1" "$2"; then
+        echo "FAIL $3"
+        diff -u "$2" "$1" | head -20
+        failed=$((failed + 1))
+    fi
+}
+
+# assembles $1 in every mode and checks it against $2.hex and $2.err, naming the cases after $3
+check_modes() {
+    by_position "$2.err" > "$TMP/expected.sorted"
+    for mode in two-pass jobs mapped one-pass pipe; do
+        assemble $mode "$1" "$TMP/$mode"
+        compare "$TMP/$mode.hex" "$2.hex" "$3 $mode image"
+        case $mode in
+            one-pass|pipe)
+                by_position "$TMP/$mode.err" > "$TMP/$mode.sorted"
+                compare "$TMP/$mode.sorted" "$TMP/expected.sorted" "$3 $mode messages" ;;
+            *)
+                compare "$TMP/$mode.err" "$2.err" "$3 $mode messages" ;;
+        esac
+    done
+    compare "$TMP/pipe.err" "$TMP/one-pass.err" "$3 pipe messages against one-pass"
+}
+
+for asm in "$DIR"/*.asm; do
+    name=$(basename "$asm" .asm)
+
+    if [ $UPDATE -eq 1 ]; then
+        assemble two-pass "$asm" "$TMP/golden"
+        cp "$TMP/golden.hex" "$DIR/$name.hex"
+        cp "$TMP/golden.err" "$DIR/$name.err"
+    fi
+
+    check_modes "$asm" "$DIR/$name" "$name"
+done
+
+# generated programs, the two-pass output is the reference
+"$GEN" -n 40000 -s 5 > "$TMP/clean.asm" || exit 1
+"$GEN" -n 40000 -s 6 -e 0.01 > "$TMP/broken.asm" || exit 1
+{
+    echo "beq \$0, \$0, far"
+    echo "j nowhere"
+    awk 'BEGIN { for (i = 0; i < 40000; i++) print "sll $0, $0, 0" }'
+    echo "far:"
+    echo "bne \$0, \$0, far"
+} > "$TMP/far.asm"
+# comments longer than the 256 KB pipe buffer, one starting a window and one after an instruction
+{
+    echo "add \$t0, \$t1, \$t2"
+    awk 'BEGIN { printf "#"; for (i = 0; i < 300000; i++) printf "x"; print "" }'
+    echo "sub \$t0, \$t1, \$t2"
+    awk 'BEGIN { printf "and $t0, $t1, $t2 #"; for (i = 0; i < 600000; i++) printf "y"; print "" }'
+    echo "sub \$t0, \$t1, \$t2"
+} > "$TMP/comments.asm"
+
+for asm in "$TMP/clean.asm" "$TMP/broken.asm" "$TMP/far.asm" "$TMP/comments.asm"; do
+    name=$(basename "$asm" .asm)
+    assemble two-pass "$asm" "$TMP/ref"
+    check_modes "$asm" "$TMP/ref" "generated $name"
+done
+
+if [ $failed -gt 0 ]; then
+    echo "check: $failed of $checked comparisons failed"
+    exit 1
+fi
+echo "check: $checked comparisons passed"
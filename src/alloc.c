@@ -0,0 +1,26 @@
+#include "alloc.h"
+#include <stdlib.h>
+
+static void *default_alloc(void *user, size_t size) {
+    (void) user;
+    return malloc(size);
+}
+
+static void *default_realloc(void *user, void *ptr, size_t old_size, size_t new_size) {
+    (void) user;
+    (void) old_size;
+    return realloc(ptr, new_size);
+}
+
+static void default_free(void *user, void *ptr, size_t size) {
+    (void) user;
+    (void) size;
+    free(ptr);
+}
+
+const masm_allocator_t MASM_DEFAULT_ALLOCATOR = {
+    default_alloc,
+    default_realloc,
+    default_free,
+    NULL
+};
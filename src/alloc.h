@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+// memory hooks every part of the assembler allocates through
+// sizes are passed to realloc and free so pool or arena backed allocators don't need headers
+typedef struct {
+    void *(*alloc)(void *user, size_t size);
+    void *(*realloc)(void *user, void *ptr, size_t old_size, size_t new_size);
+    void (*free)(void *user, void *ptr, size_t size);
+    void *user; // passed through to every hook
+} masm_allocator_t;
+
+// plain malloc/realloc/free
+extern const masm_allocator_t MASM_DEFAULT_ALLOCATOR;
+
+static inline void *mem_alloc(const masm_allocator_t *a, size_t size) {
+    return a->alloc(a->user, size);
+}
+
+static inline void *mem_realloc(const masm_allocator_t *a, void *ptr, size_t old_size, size_t new_size) {
+    return a->realloc(a->user, ptr, old_size, new_size);
+}
+
+static inline void mem_free(const masm_allocator_t *a, void *ptr, size_t size) {
+    if (ptr != NULL)
+        a->free(a->user, ptr, size);
+}
@@ -0,0 +1,279 @@
+#include "arena.h"
+#include <string.h>
+
+#define ARENA_ALIGN (sizeof(void *))
+
+static inline size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static inline void count_used(arena_t *arena, size_t added) {
+    arena->stats.used += added;
+    if (arena->stats.used > arena->stats.peak)
+        arena->stats.peak = arena->stats.used;
+    if (arena->stats.peak > arena->stats.max_peak)
+        arena->stats.max_peak = arena->stats.peak;
+}
+
+static arena_block_t *new_block(arena_t *arena, size_t cap) {
+    arena_block_t *block = mem_alloc(arena->alloc, sizeof(arena_block_t) + cap);
+
+    if (block == NULL)
+        return NULL;
+
+    block->next = NULL;
+    block->prev = NULL;
+    block->used = 0;
+    block->cap = cap;
+
+    arena->stats.reserved += sizeof(arena_block_t) + cap;
+    if (arena->stats.reserved > arena->stats.peak_reserved)
+        arena->stats.peak_reserved = arena->stats.reserved;
+    return block;
+}
+
+static void free_block(arena_t *arena, arena_block_t *block) {
+    arena->stats.reserved -= sizeof(arena_block_t) + block->cap;
+    mem_free(arena->alloc, block, sizeof(arena_block_t) + block->cap);
+}
+
+void arena_init(arena_t *arena, const masm_allocator_t *alloc) {
+    memset(arena, 0, sizeof(*arena));
+    arena->alloc = alloc;
+}
+
+static void free_large(arena_t *arena) {
+    arena_block_t *block = arena->large;
+
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free_block(arena, block);
+        block = next;
+    }
+    arena->large = NULL;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *block = arena->first;
+
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free_block(arena, block);
+        block = next;
+    }
+    free_large(arena);
+
+    const masm_allocator_t *alloc = arena->alloc;
+    size_t max_peak = arena->stats.max_peak;
+    arena_init(arena, alloc);
+    arena->stats.max_peak = max_peak;
+}
+
+/**
+ * Frees everything allocated from the arena in one go
+ * Small blocks are kept and reused, large ones go back to the backing allocator
+ */
+void arena_reset(arena_t *arena) {
+    for (arena_block_t *block = arena->first; block != NULL; block = block->next)
+        block->used = 0;
+    free_large(arena);
+
+    arena->current = arena->first;
+    arena->stats.used = 0;
+    arena->stats.peak = 0;
+    arena->stats.allocs = 0;
+}
+
+/**
+ * Makes sure at least bytes of small allocations fit without asking the backing allocator again
+ * Meant to be sized from a previous run's peak
+ * Returns -1 if out of memory
+ */
+int arena_reserve(arena_t *arena, size_t bytes) {
+    size_t have = 0;
+    arena_block_t *last = NULL;
+
+    for (arena_block_t *block = arena->first; block != NULL; block = block->next) {
+        have += block->cap;
+        last = block;
+    }
+
+    while (have < bytes) {
+        arena_block_t *block = new_block(arena, ARENA_BLOCK_SIZE);
+        if (block == NULL)
+            return -1;
+
+        if (last == NULL)
+            arena->first = arena->current = block;
+        else
+            last->next = block;
+        last = block;
+        have += block->cap;
+    }
+    return 0;
+}
+
+static void *alloc_large(arena_t *arena, size_t size) {
+    arena_block_t *block = new_block(arena, size);
+
+    if (block == NULL)
+        return NULL;
+
+    block->used = size;
+    block->next = arena->large;
+    if (arena->large != NULL)
+        arena->large->prev = block;
+    arena->large = block;
+    return block->data;
+}
+
+static void unlink_large(arena_t *arena, arena_block_t *block) {
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        arena->large = block->next;
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+}
+
+/**
+ * Returns size bytes of pointer aligned memory that lives until arena_reset or arena_free
+ * Returns NULL if out of memory
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = align_up(size);
+    arena->stats.allocs++;
+
+    if (size >= ARENA_LARGE) {
+        void *ptr = alloc_large(arena, size);
+        if (ptr != NULL)
+            count_used(arena, size);
+        return ptr;
+    }
+
+    arena_block_t *block = arena->current;
+
+    // move on to the next kept block, or make one
+    while (block == NULL || block->cap - block->used < size) {
+        if (block != NULL && block->next != NULL) {
+            block = block->next;
+            continue;
+        }
+
+        arena_block_t *fresh = new_block(arena, ARENA_BLOCK_SIZE);
+        if (fresh == NULL)
+            return NULL;
+
+        if (block == NULL)
+            arena->first = fresh;
+        else
+            block->next = fresh;
+        block = fresh;
+    }
+    arena->current = block;
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    count_used(arena, size);
+    return ptr;
+}
+
+/**
+ * Copies len chars of str into the arena and null terminates them
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+
+    if (copy == NULL)
+        return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// true if ptr is the last thing handed out from the current block
+static inline int is_last(const arena_t *arena, const void *ptr, size_t size) {
+    const arena_block_t *block = arena->current;
+    return block != NULL && (const char *) ptr + align_up(size) == block->data + block->used;
+}
+
+static void *hook_alloc(void *user, size_t size) {
+    return arena_alloc(user, size);
+}
+
+static void hook_free(void *user, void *ptr, size_t size) {
+    arena_t *arena = user;
+    size = align_up(size);
+
+    if (size >= ARENA_LARGE) {
+        arena_block_t *block = (arena_block_t *) ((char *) ptr - offsetof(arena_block_t, data));
+        unlink_large(arena, block);
+        free_block(arena, block);
+        arena->stats.used -= size;
+    } else if (is_last(arena, ptr, size)) {
+        arena->current->used -= size;
+        arena->stats.used -= size;
+    }
+    // anything else stays dead until the next reset
+}
+
+static void *hook_realloc(void *user, void *ptr, size_t old_size, size_t new_size) {
+    arena_t *arena = user;
+
+    if (ptr == NULL)
+        return arena_alloc(arena, new_size);
+
+    size_t old_aligned = align_up(old_size);
+    size_t new_aligned = align_up(new_size);
+
+    // large to large goes through the backing realloc, which can often grow in place
+    if (old_aligned >= ARENA_LARGE && new_aligned >= ARENA_LARGE) {
+        arena_block_t *block = (arena_block_t *) ((char *) ptr - offsetof(arena_block_t, data));
+        arena_block_t *prev = block->prev;
+        arena_block_t *next = block->next;
+
+        arena_block_t *grown = mem_realloc(arena->alloc, block, sizeof(arena_block_t) + block->cap,
+                                           sizeof(arena_block_t) + new_aligned);
+        if (grown == NULL)
+            return NULL;
+
+        if (prev != NULL)
+            prev->next = grown;
+        else
+            arena->large = grown;
+        if (next != NULL)
+            next->prev = grown;
+
+        arena->stats.reserved += new_aligned - grown->cap;
+        if (arena->stats.reserved > arena->stats.peak_reserved)
+            arena->stats.peak_reserved = arena->stats.reserved;
+        arena->stats.used -= old_aligned;
+        count_used(arena, new_aligned);
+
+        grown->cap = new_aligned;
+        grown->used = new_aligned;
+        return grown->data;
+    }
+
+    // the newest small allocation can grow or shrink where it is
+    if (old_aligned < ARENA_LARGE && new_aligned < ARENA_LARGE && is_last(arena, ptr, old_aligned) &&
+        arena->current->used - old_aligned + new_aligned <= arena->current->cap) {
+        arena->current->used = arena->current->used - old_aligned + new_aligned;
+        arena->stats.used -= old_aligned;
+        count_used(arena, new_aligned);
+        return ptr;
+    }
+
+    void *moved = arena_alloc(arena, new_size);
+    if (moved == NULL)
+        return NULL;
+
+    memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    hook_free(arena, ptr, old_size);
+    return moved;
+}
+
+masm_allocator_t arena_allocator(arena_t *arena) {
+    return (masm_allocator_t) { hook_alloc, hook_realloc, hook_free, arena };
+}
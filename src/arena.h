@@ -0,0 +1,47 @@
+#pragma once
+
+#include "alloc.h"
+#include <stddef.h>
+
+// bump allocator, memory is handed out from big blocks and only freed all at once
+// blocks are kept by arena_reset, so an arena reused across runs stops calling the backing allocator
+// anything of ARENA_LARGE bytes or more gets a block of its own, which realloc and free hand
+// straight back to the backing allocator instead of leaving a dead copy behind
+typedef struct arena_block {
+    struct arena_block *next;
+    struct arena_block *prev; // only kept up for large blocks, so they can be unlinked
+    size_t used;
+    size_t cap;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    size_t used;          // bytes handed out and not given back, since the last reset
+    size_t peak;          // high-water mark of used since the last reset
+    size_t max_peak;      // high-water mark of used over the arena's whole life
+    size_t reserved;      // bytes held from the backing allocator, block headers included
+    size_t peak_reserved; // high-water mark of reserved
+    size_t allocs;        // allocations since the last reset
+} arena_stats_t;
+
+typedef struct {
+    arena_block_t *first;   // small blocks in the order they were made
+    arena_block_t *current; // small block being allocated from
+    arena_block_t *large;   // one allocation each, freed by arena_reset
+    const masm_allocator_t *alloc;
+    arena_stats_t stats;
+} arena_t;
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_LARGE      (ARENA_BLOCK_SIZE / 4)
+
+void arena_init(arena_t *arena, const masm_allocator_t *alloc);
+void arena_free(arena_t *arena);
+void arena_reset(arena_t *arena);
+int arena_reserve(arena_t *arena, size_t bytes);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+// allocator hooks backed by the arena, so containers that take a masm_allocator_t can live in it
+// free and realloc only give memory back for large blocks or the most recent allocation
+masm_allocator_t arena_allocator(arena_t *arena);
@@ -1,534 +1,1605 @@
 #include "assemble.h"
 #include "instr.h"
 #include "register.h"
+#include "source.h"
+#include "diag.h"
+#include "symtab.h"
+#include "image.h"
+#include "scan.h"
+#include "lexer.h"
+#include "ir.h"
+#include "stats.h"
+#include "disasm.h"
+#include <assert.h>
 #include <string.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-// Three static char buffers to put the params in while assembling
-static char param1[MAX_PARAM_LENGTH + 1] = { [MAX_PARAM_LENGTH] = '\0' };
-static char param2[MAX_PARAM_LENGTH + 1] = { [MAX_PARAM_LENGTH] = '\0' };
-static char param3[MAX_PARAM_LENGTH + 1] = { [MAX_PARAM_LENGTH] = '\0' };
+// a token is just a slice of the source buffer, nothing gets copied out of it
+typedef struct {
+    const char *str;
+    int len;
+} slice_t;
+
+#define NO_SLICE ((slice_t) { "", 0 })
+
+typedef enum {
+    FIXUP_JUMP,   // 26 bit word address of a j/jal
+    FIXUP_BRANCH  // 16 bit word offset of a branch
+} FixupKind;
+
+// why stream mode stopped holding a word back for its label, which is only reported once the
+// label turns up, a label that never does is an unknown label like in every other mode
+typedef enum {
+    DROP_NONE,
+    DROP_OUT_OF_RANGE, // a branch already further back than it can reach
+    DROP_TOO_FAR       // more than MASM_STREAM_MAX_PENDING words back
+} DropReason;
+
+// a label operand that was used before it was defined, patched once the whole file is read
+typedef struct {
+    uint32_t offset; // index of the word to patch in the image
+    uint32_t sym;    // symbol id of the label
+    uint32_t line;   // where the reference was, for errors, saturated like the IR's
+    uint16_t col;
+    uint8_t kind;    // FixupKind
+    uint8_t dropped; // DropReason, stream mode only, the word went out without it
+} fixup_t;
+
+typedef struct {
+    fixup_t *items;
+    size_t count;
+    size_t cap;
+    const masm_allocator_t *alloc;
+} fixup_list_t;
+
+// a label definition found by a parallel pass 1, merged into the symbol table afterwards
+typedef struct {
+    const char *name; // points into the source
+    uint32_t len;
+    uint32_t pc;      // relative to the start of the chunk
+    size_t line;      // relative to the start of the chunk
+    int col;
+} label_def_t;
 
-static inline void clear_params() {
-    param1[MAX_PARAM_LENGTH] = '\0';
-    param2[MAX_PARAM_LENGTH] = '\0';
-    param3[MAX_PARAM_LENGTH] = '\0';
+typedef struct {
+    label_def_t *items;
+    size_t count;
+    size_t cap;
+    const masm_allocator_t *alloc;
+} label_list_t;
+
+// everything one assembly needs
+// all of it is allocated from the arena, which is reset at the start of each run and keeps its blocks
+struct masm_ctx {
+    masm_allocator_t alloc;   // a copy, so callers don't have to keep theirs alive
+    arena_t arena;            // per-assembly memory, backed by alloc
+    masm_allocator_t scratch; // hooks into the arena, handed to the containers below
+    assemble_opts_t opts;
+    diag_list_t diags;
+    symtab_t symbols;
+    image_t image;
+    fixup_list_t fixups;
+    ir_batch_t ir;
+    masm_stats_t stats;
+    size_t reported; // errors a streaming run already printed and dropped
+};
+
+// cursor over the whole source buffer, plus what the current pass knows about the program
+// the line number is tracked as the cursor moves so errors never have to rescan the input
+typedef struct {
+    const char *cur;        // next char to be read
+    const char *end;        // one past the last char
+    const char *line_start; // first char of the current line
+    size_t line;            // current line number, starting at 1
+    diag_list_t *diags;     // where errors get collected
+    symtab_t *symbols;      // labels, filled in by pass 1 (or as they're found in one-pass mode)
+    uint32_t pc;            // address of the instruction being assembled
+    image_t *image;         // where encoded words go
+    fixup_list_t *fixups;   // forward references, only used in one-pass mode
+    label_list_t *labels;   // if set, pass 1 collects labels here instead of defining them
+    scanner_t scan;         // structural char bitmap, so line ends and separators are found a block at a time
+    masm_stats_t *stats;    // counters, the context's or the chunk's with -j
+    ir_batch_t *ir;         // decoded instructions waiting to be packed, pass 2 only
+    uint32_t ir_pc;         // address of the first instruction in ir
+    int append;             // encoded words go on the end of the image instead of into slots sized by pass 1
+} cursor_t;
+
+static void cursor_init(cursor_t *cur, const char *start, const char *end, size_t line, uint32_t pc) {
+    memset(cur, 0, sizeof(*cur));
+    cur->cur = start;
+    cur->end = end;
+    cur->line_start = start;
+    cur->line = line;
+    cur->pc = pc;
+    cur->ir_pc = pc;
+    scanner_init(&cur->scan, start, end);
 }
 
-static inline int iswhitespace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == -1; }
+static inline int iswhitespace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r'; }
 
-static inline int buffer_past_whitespace(FILE *fp) {
-    char c;
-    while ((c = fgetc(fp)) != EOF && iswhitespace(c)); // read one byte, if it's whitespace, continue, else break
+// chars that end a token
+static inline int isterminator(char c) { return iswhitespace(c) || c == '#' || c == ':'; }
 
-    if (c == EOF)
-        return EOF;
+/**
+ * If the cursor is on a comment, moves it to the newline that ends it
+ * Comments can be long, so only the structural chars in the bitmap are visited
+ */
+static inline void skip_comment(cursor_t *cur) {
+    if (cur->cur >= cur->end || *cur->cur != '#')
+        return;
+
+    const char *p = scanner_next(&cur->scan, cur->cur + 1);
+    while (p < cur->end && *p != '\n')
+        p = scanner_next(&cur->scan, p + 1);
+    cur->cur = p;
+}
 
-    fseek(fp, -1, SEEK_CUR); // move the file pointer back one byte
-    return 0;
+/**
+ * Skips whitespace, blank lines and comments
+ * Returns EOF if there's nothing left in the buffer, 0 otherwise
+ */
+static inline int buffer_past_whitespace(cursor_t *cur) {
+    while (cur->cur < cur->end) {
+        if (*cur->cur == '#')
+            skip_comment(cur);
+        else if (*cur->cur == '\n') {
+            cur->cur++;
+            cur->line++;
+            cur->line_start = cur->cur;
+        } else if (iswhitespace(*cur->cur))
+            cur->cur++;
+        else
+            return 0;
+    }
+    return EOF;
 }
 
 /**
- * next_str function
- * @param fp File pointer
- * @param buffer string buffer pointer
- * @param len Max length of buffer
- * @param terminator char that ends the search for the string
- * @return 0 if successfully found string, -1 if EOF, and -2 if a different char was found
+ * Reads the token under the cursor, stops at whitespace, '#' or ':'
+ * Doesn't advance the cursor
  */
-#define STR_NOT_FOUND (-2)
-// just use the null terminator to denote whitespace as a terminator
-#define WHITESPACE ('\0')
-static int next_str(FILE *fp, char *buffer, int len, char terminator) {
-    if (len <= 0) return -1;
-    
-    int start = ftell(fp); // get starting position of pointer
+static inline slice_t peek_token(const cursor_t *cur) {
+    const char *p = cur->cur;
 
-    int i = 0;
-    char c;
-    while ((c = fgetc(fp)) != terminator && c != EOF && i < len) {
-        if (terminator == WHITESPACE && iswhitespace(c))
-            break;
-        // if char is whitespace, just skip it (advance fp but don't add to buffer)
-        if (!iswhitespace(c)) {
-            *buffer++ = c;
-            i++;
-        }
-    }
+    while (p < cur->end && !isterminator(*p))
+        p++;
 
-    *buffer = '\0'; // set last character to zero (overwrite terminator)
+    return (slice_t) { cur->cur, p - cur->cur };
+}
 
-    if (i + 1 == len) {
-        fseek(fp, start, SEEK_CUR);
-        return STR_NOT_FOUND;
-    }
+/**
+ * Moves the cursor past the rest of the line and any comment on it, leaving it on the newline
+ * Only structural chars are visited
+ */
+static inline void rest_of_line(cursor_t *cur) {
+    const char *p = scanner_next(&cur->scan, cur->cur);
 
-    if (c == EOF) {
-        fseek(fp, start, SEEK_SET);
-        return EOF;
-    }
+    while (p < cur->end && *p != '\n')
+        p = scanner_next(&cur->scan, p + 1);
 
-    // fseek(fp, -1, SEEK_CUR); // skip back to before the terminator
-    return 0;
+    cur->cur = p;
 }
 
-typedef struct {
-    int line;
-    int col;
-} fp_pos_t;
+// 1 based column of at, which has to be on the current line, lines of 2GB or more just get a big number
+static inline int column(const cursor_t *cur, const char *at) {
+    size_t col = at - cur->line_start + 1;
+    return col > INT_MAX ? INT_MAX : col;
+}
 
-static inline fp_pos_t get_fp_pos(FILE *fp) {
-    int pos = ftell(fp);
+// the IR and fixups keep 32 bit line numbers, anything past that is reported as the last one
+static inline uint32_t line32(size_t line) {
+    return line > UINT32_MAX ? UINT32_MAX : line;
+}
 
-    fseek(fp, 0, SEEK_SET); // go to the beginning of the file
-    
-    char c;
-    int line_count = 1;
-    int col_count = 1;
+/**
+ * Records an error at the position of at, which has to be on the cursor's current line
+ */
+static void print_error(const cursor_t *cur, const char *at, const char *error_str, slice_t other) {
+    diag_add(cur->diags, cur->line, column(cur, at), error_str, other.str, other.len);
+}
 
-    for (int i = 0; i < pos; i++) {
-        col_count++;
-        c = fgetc(fp);
+/**
+ * The lexer only splits words at separators, so "$t1 $t2" is one param
+ * Called once a lookup has failed, so operands that are fine never get looked at twice
+ * Returns 1 after reporting the missing separator in front of the second word, 0 if there's one word
+ */
+static int missing_separator(const cursor_t *cur, slice_t param) {
+    const char *p = param.str;
+    const char *end = param.str + param.len;
 
-        if (c == '\n') {
-            line_count++;
-            col_count = 1; // reset column counter
-        }
-    }
+    while (p < end && !iswhitespace(*p))
+        p++;
+    if (p == end)
+        return 0;
 
-    // we've calculated line/col count and fp is now in the same position as before
-    return (fp_pos_t) { line_count, col_count };
+    // params are trimmed, so there's another word after the blanks
+    while (iswhitespace(*p))
+        p++;
+    print_error(cur, p, "Missing param separator", NO_SLICE);
+    return 1;
 }
 
-static void print_error(FILE *fp, const char *error_str, const char *other) {
-    fp_pos_t pos = get_fp_pos(fp);
-    printf("Error: '%s%s' at %d:%d\n", error_str, other, pos.line, pos.col);
-}
+static int try_find_register(const cursor_t *cur, slice_t param) {
+    STAT_INC(cur->stats, register_lookups);
+    int reg = find_register_n(param.str, param.len);
 
-static int try_find_register(FILE *fp, const char *buffer) {
-    int reg = find_register(buffer);
+    if (reg < 0 && missing_separator(cur, param))
+        return reg;
 
     if (reg == -1)
-        print_error(fp, "Malformatted register ", buffer);
+        print_error(cur, param.str, "Malformatted register ", param);
     else if (reg == -2)
-        print_error(fp, "Unknown register ", buffer);
+        print_error(cur, param.str, "Unknown register ", param);
     
     return reg;
 }
 
-#define FIND_IMM_ERR (UINT32_MAX)
-static uint32_t try_find_immediate(FILE *fp, const char *buffer) {
-    char* end;
-    long number = strtol(buffer, &end, 0);
-    
-    if (*end == '\0') {
-        if (number < ((1 << 16) - 1))
+/**
+ * Parses an integer the way strtol with base 0 would (decimal, 0x hex or 0 octal)
+ * but requires the whole slice to be the number
+ * Returns 0 on success, -1 if the slice isn't a number
+ */
+static int parse_number(slice_t param, long *number) {
+    const char *p = param.str;
+    const char *end = param.str + param.len;
+    int negative = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    int base = 10;
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (end - p > 1 && p[0] == '0') {
+        base = 8;
+        p++;
+    }
+
+    if (p == end)
+        return -1;
+
+    long value = 0;
+    for (; p < end; p++) {
+        int digit;
+        if (*p >= '0' && *p <= '9')
+            digit = *p - '0';
+        else if (*p >= 'a' && *p <= 'f')
+            digit = *p - 'a' + 10;
+        else if (*p >= 'A' && *p <= 'F')
+            digit = *p - 'A' + 10;
+        else
+            return -1;
+
+        if (digit >= base)
+            return -1;
+
+        // saturate instead of overflowing, anything this big gets rejected by the caller anyway
+        if (value < (1L << 40))
+            value = value * base + digit;
+    }
+
+    *number = negative ? -value : value;
+    return 0;
+}
+
+/**
+ * Parses a 16 bit immediate, written either signed or unsigned, so -32768 to 65535
+ * Returns FIND_IMM_ERR after reporting anything else
+ */
+#define FIND_IMM_ERR (INT64_MIN)
+#define IMM_MIN (INT16_MIN)
+#define IMM_MAX (UINT16_MAX)
+static int64_t try_find_immediate(const cursor_t *cur, slice_t param) {
+    long number;
+
+    STAT_INC(cur->stats, immediate_parses);
+    if (parse_number(param, &number) == 0) {
+        if (number >= IMM_MIN && number <= IMM_MAX)
             return number;
         else
-            print_error(fp, "Immediate value too large!", buffer);
-    } else
-        print_error(fp, "Value is not a valid number", buffer);
+            print_error(cur, param.str, "Immediate value out of range ", param);
+    } else if (!missing_separator(cur, param))
+        print_error(cur, param.str, "Value is not a valid number", param);
     
     return FIND_IMM_ERR;
 }
 
-// fills the param1 char buffer
-static int get_one_param(FILE *fp) {
-    clear_params();
-    
-    if (buffer_past_whitespace(fp) == EOF)
+/**
+ * Records a reference to a label that hasn't been defined yet
+ */
+static int add_fixup(cursor_t *cur, slice_t param, FixupKind kind) {
+    fixup_list_t *list = cur->fixups;
+    int32_t id = symtab_intern(cur->symbols, param.str, param.len);
+
+    if (id < 0)
         return -1;
 
-    // get next string into param1
-    if (next_str(fp, param1, MAX_PARAM_LENGTH, ' ') == 0)
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        fixup_t *items = mem_realloc(list->alloc, list->items, list->cap * sizeof(fixup_t), cap * sizeof(fixup_t));
+        if (items == NULL)
+            return -1;
+        list->items = items;
+        list->cap = cap;
+    }
+
+    int col = column(cur, param.str);
+    list->items[list->count++] = (fixup_t) {
+        .offset = cur->pc / 4,
+        .sym = id,
+        .line = line32(cur->line),
+        .col = col > UINT16_MAX ? UINT16_MAX : col,
+        .kind = kind
+    };
+    return 0;
+}
+
+/**
+ * Looks up the address of a label operand
+ * In two-pass mode every label has been defined by pass 1, so a miss is an unknown label
+ * In one-pass mode a miss becomes a fixup and 1 is returned, the field is patched at the end
+ */
+#define LABEL_DEFERRED (1)
+static int try_find_label(cursor_t *cur, slice_t param, uint32_t *pc, FixupKind kind) {
+    STAT_INC(cur->stats, label_lookups);
+    int32_t id = symtab_find(cur->symbols, param.str, param.len);
+
+    if (id >= 0 && symtab_get(cur->symbols, id)->defined) {
+        *pc = symtab_get(cur->symbols, id)->pc;
         return 0;
-    else {
-        print_error(fp, "Param not found", "");
+    }
+
+    // before it becomes a fixup for a label nobody could define
+    if (missing_separator(cur, param))
+        return -1;
+
+    if (cur->fixups != NULL) {
+        if (add_fixup(cur, param, kind) == 0)
+            return LABEL_DEFERRED;
+        print_error(cur, param.str, "Out of memory referencing label ", param);
         return -1;
     }
+
+    print_error(cur, param.str, "Unknown label ", param);
+    return -1;
 }
 
-static int get_two_params(FILE *fp) {
-    clear_params();
-    // skip any whitespace after instruction
-    if (buffer_past_whitespace(fp) == EOF)
+/**
+ * Works out the offset field of a branch at pc, counted in words from the instruction after it
+ * Returns -1 if it doesn't fit in 16 bits
+ */
+static inline int branch_offset(uint32_t pc, uint32_t target, uint16_t *offs) {
+    int64_t words = ((int64_t) target - (int64_t) (pc + 4)) / 4;
+
+    if (words < INT16_MIN || words > INT16_MAX)
         return -1;
 
-    // look for a comma
-    int ret = next_str(fp, param1, MAX_PARAM_LENGTH, ',');
-    
-    if (ret == EOF) {
-        if (feof(fp))
-            print_error(fp, "Missing param separator", "");
-        else
-            print_error(fp, "Param is too long!", "");
+    *offs = words;
+    return 0;
+}
+
+/**
+ * Turns a label into a branch offset
+ */
+static int try_find_branch_offset(cursor_t *cur, slice_t param, uint16_t *offs) {
+    uint32_t target;
+    int ret = try_find_label(cur, param, &target, FIXUP_BRANCH);
+
+    if (ret == LABEL_DEFERRED) {
+        *offs = 0;
+        return 0;
+    } else if (ret != 0)
         return -1;
-    } else if (ret == STR_NOT_FOUND) {
-        // if string not found, we found another character
-        char c[2] = { fgetc(fp), '\0' };
-        print_error(fp, "Random character", c);
+
+    if (branch_offset(cur->pc, target, offs) != 0) {
+        print_error(cur, param.str, "Branch target out of range ", param);
         return -1;
-    } else {
-        // else we found the comma, find the next param
-        buffer_past_whitespace(fp);
+    }
+    return 0;
+}
 
-        // find whitespace
-        ret = next_str(fp, param2, MAX_PARAM_LENGTH, WHITESPACE);
+// one step of an operand template, what the next token has to be and which field its value goes in
+typedef enum {
+    OP_END,
+    OP_REG,          // register
+    OP_INT,          // immediate
+    OP_OPT_INT,      // immediate that can be left out, as in ($t0)
+    OP_JUMP_LABEL,   // label, stored as a word address
+    OP_BRANCH_LABEL, // label, stored as an offset from the next instruction
+    OP_COMMA,
+    OP_LPAREN,
+    OP_RPAREN
+} OperandKind;
+
+typedef enum {
+    FIELD_NONE,
+    FIELD_RS,
+    FIELD_RT,
+    FIELD_RD,
+    FIELD_SHAMT,
+    FIELD_IMM,
+    FIELD_TARGET
+} OperandField;
 
-        if (ret == EOF) {
-            if (feof(fp))
-                print_error(fp, "Missing param separator", "");
-            else
-                print_error(fp, "Param is too long!", "");
+typedef struct {
+    uint8_t kind;
+    uint8_t field;
+} operand_t;
+
+#define MAX_OPERANDS (8)
+#define REG(f)  { OP_REG, FIELD_##f }
+#define INT(f)  { OP_INT, FIELD_##f }
+#define SEP     { OP_COMMA, FIELD_NONE }
+
+// the tokens every ParamOrder expects after the mnemonic, the line has to end right after
+static const operand_t OPERAND_TEMPLATES[NUM_PARAM_ORDERS][MAX_OPERANDS] = {
+    [RS]          = { REG(RS) },
+    [RD]          = { REG(RD) },
+    [RD_RS]       = { REG(RD), SEP, REG(RS) },
+    [RS_RT]       = { REG(RS), SEP, REG(RT) },
+    [RD_RS_RT]    = { REG(RD), SEP, REG(RS), SEP, REG(RT) },
+    [RD_RT_RS]    = { REG(RD), SEP, REG(RT), SEP, REG(RS) },
+    [RD_RT_SA]    = { REG(RD), SEP, REG(RT), SEP, INT(SHAMT) },
+    [LABEL]       = { { OP_JUMP_LABEL, FIELD_TARGET } },
+    [RT_RS_IMM]   = { REG(RT), SEP, REG(RS), SEP, INT(IMM) },
+    [RS_RT_LABEL] = { REG(RS), SEP, REG(RT), SEP, { OP_BRANCH_LABEL, FIELD_IMM } },
+    [RS_LABEL]    = { REG(RS), SEP, { OP_BRANCH_LABEL, FIELD_IMM } },
+    [RT_IMM_RS]   = { REG(RT), SEP, { OP_OPT_INT, FIELD_IMM }, { OP_LPAREN }, REG(RS), { OP_RPAREN } },
+    [RT_IMM]      = { REG(RT), SEP, INT(IMM) },
+    [NONE]        = { { OP_END } },
+};
+
+#undef REG
+#undef INT
+#undef SEP
+
+static inline slice_t token_slice(const token_t *tok) {
+    return (slice_t) { tok->str, tok->len };
+}
+
+// from the start of tok to the end of the last token on the line
+static slice_t tokens_slice(const token_t *tok) {
+    const token_t *last = tok;
+    while (last->kind != TOK_NEWLINE && last[1].kind != TOK_NEWLINE)
+        last++;
+    return (slice_t) { tok->str, last->str + last->len - tok->str };
+}
+
+static inline int isword(const token_t *tok) {
+    return tok->kind == TOK_REGISTER || tok->kind == TOK_INTEGER || tok->kind == TOK_LABEL || tok->kind == TOK_ERROR;
+}
+
+static void set_field(instr_t *instr, OperandField field, uint32_t value) {
+    switch (field) {
+        case FIELD_NONE:   break;
+        case FIELD_RS:     instr->rs = value; break;
+        case FIELD_RT:     instr->rt = value; break;
+        case FIELD_RD:     instr->rd = value; break;
+        case FIELD_SHAMT:  instr->shamt = value; break;
+        case FIELD_IMM:    instr->imm = value; break;
+        case FIELD_TARGET: instr->target = value; break;
+    }
+}
+
+// the token each punctuation step of a template wants
+static const TokenKind PUNCT_TOKENS[] = {
+    [OP_COMMA] = TOK_COMMA,
+    [OP_LPAREN] = TOK_LPAREN,
+    [OP_RPAREN] = TOK_RPAREN,
+};
+
+/**
+ * Reads one word operand into *value, the cursor must still be on the operand's line
+ * Words go to the register/immediate/label lookups whatever kind the lexer gave them,
+ * so "t0" still gets reported as a malformatted register rather than a misplaced label
+ */
+static int read_operand(cursor_t *cur, const operand_t *op, const token_t *tok, uint32_t *value) {
+    OperandKind kind = op->kind;
+    slice_t param = token_slice(tok);
+
+    if (kind == OP_REG) {
+        int reg = try_find_register(cur, param);
+        if (reg < 0)
+            return -1;
+        *value = reg;
+    } else if (kind == OP_JUMP_LABEL) {
+        uint32_t pc = 0;
+        if (try_find_label(cur, param, &pc, FIXUP_JUMP) == -1)
+            return -1;
+        // jumps hold the word address, the top 4 bits come from the pc
+        *value = pc >> 2;
+    } else if (kind == OP_BRANCH_LABEL) {
+        uint16_t offs;
+        if (try_find_branch_offset(cur, param, &offs) != 0)
+            return -1;
+        *value = offs;
+    } else {
+        int64_t imm = try_find_immediate(cur, param);
+        if (imm == FIND_IMM_ERR)
             return -1;
-        } else if (ret == STR_NOT_FOUND) {
-            // if string not found, we found another character
-            char c[2] = { fgetc(fp), '\0' };
-            print_error(fp, "Random character", c);
+        // checked here rather than when packing, so it's reported in line order at the operand
+        if (op->field == FIELD_SHAMT && (imm < 0 || imm > IR_SHAMT_MAX)) {
+            print_error(cur, param.str, "Shift amount out of range ", param);
             return -1;
         }
+        *value = (uint16_t) imm;
     }
     return 0;
 }
 
-static int get_three_params(FILE *fp) {
-    clear_params();
-    // skip any whitespace after instruction
-    if (buffer_past_whitespace(fp) == EOF)
-        return -1;
-
-    // look for a comma
-    int ret = next_str(fp, param1, MAX_PARAM_LENGTH, ',');
-    
-    if (ret == EOF) {
-        if (feof(fp))
-            print_error(fp, "Missing param separator", "");
-        else
-            print_error(fp, "Param is too long!", "");
-        return -1;
-    } else if (ret == STR_NOT_FOUND) {
-        // if string not found, we found another character
-        char c[2] = { fgetc(fp), '\0' };
-        print_error(fp, "Random character", c);
-        return -1;
-    } else {
-        // else we found the comma, find the next param
-        buffer_past_whitespace(fp);
-
-        // look for comma
-        ret = next_str(fp, param2, MAX_PARAM_LENGTH, ',');
+/**
+ * Matches the tokens after the mnemonic against the template for order, filling in instr
+ * Template and tokens are walked side by side, so no token is looked at twice
+ */
+static int match_operands(cursor_t *cur, ParamOrder order, const token_t *tok, instr_t *instr) {
+    const operand_t *op = OPERAND_TEMPLATES[order];
+    const token_t *param = tok; // first token of the current comma separated param
+
+    for (; op->kind != OP_END; op++) {
+        uint32_t value = 0;
+
+        if (op->kind == OP_COMMA || op->kind == OP_LPAREN || op->kind == OP_RPAREN) {
+            if (tok->kind == PUNCT_TOKENS[op->kind]) {
+                if (op->kind == OP_COMMA)
+                    param = tok + 1;
+                tok++;
+                continue;
+            }
 
-        if (ret == EOF) {
-            if (feof(fp))
-                print_error(fp, "Missing param separator", "");
+            if (op->kind == OP_COMMA)
+                print_error(cur, tok->str, "Missing param separator", NO_SLICE);
             else
-                print_error(fp, "Param is too long!", "");
+                print_error(cur, param->str, op->kind == OP_LPAREN ? "Malformatted offset " : "Malformatted source register ",
+                            tokens_slice(param));
             return -1;
-        } else if (ret == STR_NOT_FOUND) {
-            // if string not found, we found another character
-            char c[2] = { fgetc(fp), '\0' };
-            print_error(fp, "Random character", c);
+        }
+
+        // an offset can be left out entirely, ($t0) means 0($t0)
+        if (op->kind == OP_OPT_INT && tok->kind == TOK_LPAREN) {
+            set_field(instr, op->field, 0);
+            continue;
+        }
+
+        if (!isword(tok)) {
+            print_error(cur, tok->str, "Param not found", NO_SLICE);
             return -1;
-        } else {
-            // else we found the comma, find the next param
-            buffer_past_whitespace(fp);
-
-            // find whitespace
-            ret = next_str(fp, param3, MAX_PARAM_LENGTH, WHITESPACE);
-
-            if (ret == EOF) {
-                if (feof(fp))
-                    print_error(fp, "Missing param separator", "");
-                else
-                    print_error(fp, "Param is too long!", "");
-                return -1;
-            } else if (ret == STR_NOT_FOUND) {
-                // if string not found, we found another character
-                char c[2] = { fgetc(fp), '\0' };
-                print_error(fp, "Random character", c);
-                return -1;
-            }
         }
+
+        if (read_operand(cur, op, tok, &value) != 0)
+            return -1;
+
+        set_field(instr, op->field, value);
+        tok++;
+    }
+
+    if (tok->kind != TOK_NEWLINE) {
+        // report everything that's left, not just the first extra token
+        if (tok->kind == TOK_COMMA && tok[1].kind != TOK_NEWLINE)
+            tok++;
+        print_error(cur, tok->str, order == NONE ? "Unexpected param " : "Too many params ", tokens_slice(tok));
+        return -1;
     }
     return 0;
 }
 
-static int get_one_reg(FILE *fp, uint8_t *reg) {
-    // try to get one param into param1
-    if (get_one_param(fp) != 0)
-        return -1;
-    
-    int res = try_find_register(fp, param1);
+/**
+ * Decodes the instruction lex_line left in toks into instr
+ * The whole line was tokenized up front, so the cursor is already at the end of the line even when there's an error
+ * Returns 0 on success, -1 if there was an error
+ */
+static int construct_instruction(cursor_t *cur, const token_t *toks, instr_t *out) {
+    instr_t instr;
+
+    skip_comment(cur);
 
-    if (res > -1)
-        *reg = res;
-    else
+    slice_t instr_str = token_slice(&toks[0]);
+
+    STAT_INC(cur->stats, mnemonic_lookups);
+    InstrID id = find_instr_n(instr_str.str, instr_str.len);
+
+    if (id == INVALID) {
+        print_error(cur, instr_str.str, "Unknown instruction ", instr_str);
         return -1;
+    }
+
+    // opcode and funct come with the id, only the operands are left
+    instr.id     = id;
+    instr.rs     = 0;
+    instr.rt     = 0;
+    instr.rd     = 0;
+    instr.shamt  = 0;
+    instr.imm    = 0;
+    instr.target = 0;
+
+    STAT_DETAIL_TIMER(t0);
+    if (match_operands(cur, PARAM_ORDERS[id], &toks[1], &instr) == -1)
+        return -1; // error occurred
+    STAT_DETAIL_PHASE(cur->stats, PHASE_OPERANDS, t0);
 
+    STAT_INC(cur->stats, instrs[INSTR_TYPES[id]]);
+    *out = instr;
     return 0;
 }
 
-static int get_two_regs(FILE *fp, uint8_t *reg1, uint8_t *reg2) {
-    // try to get two params
-    if (get_two_params(fp) != 0)
-        return -1;    
+// instructions decoded before they get packed, enough to keep the kernel busy while the batch stays in L1
+#define IR_BATCH_LEN (1024)
 
-    int res = try_find_register(fp, param1);
+/**
+ * Encodes everything decoded so far into the image, one batch at a time through the vector kernel
+ * Returns -1 if out of memory
+ */
+static int flush_ir(cursor_t *cur) {
+    ir_batch_t *ir = cur->ir;
+    image_t *image = cur->image;
+    uint32_t *out;
 
-    if (res > -1)
-        *reg1 = res;
-    else
-        return -1;
-    
-    res = try_find_register(fp, param2);
+    if (ir->count == 0)
+        return 0;
+
+    if (!cur->append) {
+        // two-pass mode, the image was sized by pass 1 so every instruction already has its slot
+        out = &image->words[cur->ir_pc / 4];
+    } else {
+        if (image_grow(image, image->count + ir->count) != 0)
+            return -1;
+        out = &image->words[image->count];
+        image->count += ir->count;
+    }
+
+    STAT_DETAIL_TIMER(t0);
+    size_t bad = ir_pack(ir, 0, ir->count, out);
+    STAT_DETAIL_PHASE(cur->stats, PHASE_ENCODE, t0);
 
-    if (res > -1)
-        *reg2 = res;
-    else
+    // shift amounts were range checked as they were read, so nothing can fail here
+    assert(bad == 0);
+    (void) bad;
+
+    cur->ir_pc += ir->count * 4;
+    ir->count = 0;
+    return 0;
+}
+
+/**
+ * Checks for a label definition ("name:") under the cursor
+ * If there is one, the cursor is moved past the colon and the name is returned in label
+ */
+static int next_label(cursor_t *cur, slice_t *label) {
+    slice_t str = peek_token(cur);
+
+    if (str.len == 0 || cur->cur + str.len >= cur->end || str.str[str.len] != ':')
         return -1;
 
+    cur->cur += str.len + 1;
+    *label = str;
     return 0;
 }
 
-static int get_three_regs(FILE *fp, uint8_t *reg1, uint8_t *reg2, uint8_t *reg3) {
-    // try to get two params
-    if (get_three_params(fp) != 0)
-        return -1;    
+static void define_symbol(symtab_t *symbols, diag_list_t *diags, const char *name, int len, uint32_t pc, size_t line, int col) {
+    int32_t id = symtab_intern(symbols, name, len);
 
-    int res = try_find_register(fp, param1);
+    if (id < 0) {
+        diag_add(diags, line, col, "Out of memory defining label ", name, len);
+        return;
+    }
 
-    if (res > -1)
-        *reg1 = res;
-    else
-        return -1;
-    
-    res = try_find_register(fp, param2);
+    symbol_t *sym = symtab_get(symbols, id);
 
-    if (res > -1)
-        *reg2 = res;
-    else
-        return -1;
+    if (sym->defined) {
+        diag_add(diags, line, col, "Duplicate label ", name, len);
+        return;
+    }
 
-    res = try_find_register(fp, param3);
+    sym->defined = 1;
+    sym->pc = pc;
+    sym->line = line;
+    sym->col = col;
+}
 
-    if (res > -1)
-        *reg3 = res;
-    else
-        return -1;
+static void define_label(cursor_t *cur, slice_t label) {
+    int col = column(cur, label.str);
+
+    if (cur->labels == NULL) {
+        define_symbol(cur->symbols, cur->diags, label.str, label.len, cur->pc, cur->line, col);
+        return;
+    }
+
+    // parallel pass 1, the chunk's base address and line aren't known yet
+    label_list_t *list = cur->labels;
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        label_def_t *items = mem_realloc(list->alloc, list->items, list->cap * sizeof(label_def_t), cap * sizeof(label_def_t));
+        if (items == NULL) {
+            print_error(cur, label.str, "Out of memory defining label ", label);
+            return;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->count++] = (label_def_t) { label.str, label.len, cur->pc, cur->line, col };
+}
+
+#define TOO_BIG_MSG "Program doesn't fit in the 32 bit address space"
+
+/**
+ * Pass 1: record the address of every label
+ * Every statement that isn't a label is one instruction, so it only has to be counted
+ * Returns -1 if the program is too big to address, which only a source of 4GB or more can be
+ */
+static int pass_one(cursor_t *cur) {
+    while (buffer_past_whitespace(cur) != EOF) {
+        slice_t label;
+        if (next_label(cur, &label) == 0) {
+            define_label(cur, label);
+            continue;
+        }
 
+        rest_of_line(cur);
+        cur->pc += 4;
+        if (cur->pc == 0) {
+            print_error(cur, cur->cur, TOO_BIG_MSG, NO_SLICE);
+            return -1;
+        }
+    }
     return 0;
 }
 
-static int get_two_regs_and_imm(FILE *fp, uint8_t *reg1, uint8_t *reg2, int16_t *imm) {
-    // try to get three params
-    if (get_three_params(fp) != 0)
-        return -1;    
+/**
+ * Pass 2: encode every instruction, labels all have addresses now
+ * In one-pass mode this is the only pass, labels are defined as they're found
+ * and anything referenced early is left for patch_fixups
+ */
+static void pass_two(cursor_t *cur) {
+    token_t toks[MAX_LINE_TOKENS];
+
+    while (buffer_past_whitespace(cur) != EOF) {
+        uint32_t line = line32(cur->line);
+        int col = column(cur, cur->cur);
+        instr_t instr;
+
+        // each statement is lexed once, a label definition comes back on its own
+        cur->cur = lex_line(&cur->scan, cur->cur, toks);
+        if (toks[0].kind == TOK_LABEL_DEF) {
+            // labels were handled by pass 1
+            if (cur->fixups != NULL)
+                define_label(cur, token_slice(&toks[0]));
+            continue;
+        }
 
-    int res = try_find_register(fp, param1);
+        // the bad line has been skipped already, keep going so every error gets reported
+        // bad instructions still take up a slot so addresses match pass 1 and fixup offsets
+        // an all zero sll packs to a 0 word
+        if (construct_instruction(cur, toks, &instr) != 0)
+            instr = (instr_t) { .id = SLL };
 
-    if (res > -1)
-        *reg1 = res;
-    else
-        return -1;
-    
-    res = try_find_register(fp, param2);
+        if (ir_push(cur->ir, &instr, line, col > UINT16_MAX ? UINT16_MAX : col) != 0 ||
+            (cur->ir->count == IR_BATCH_LEN && flush_ir(cur) != 0)) {
+            print_error(cur, cur->cur, "Out of memory", NO_SLICE);
+            return;
+        }
 
-    if (res > -1)
-        *reg2 = res;
-    else
-        return -1;
-    
-    res = try_find_immediate(fp, param3);
+        cur->pc += 4;
+        if (cur->pc == 0) {
+            print_error(cur, cur->cur, TOO_BIG_MSG, NO_SLICE);
+            break;
+        }
+    }
 
-    if (res != FIND_IMM_ERR)
-        *imm = res;
-    else
-        return -1;
-    
-    return 0;
+    if (flush_ir(cur) != 0)
+        print_error(cur, cur->cur, "Out of memory", NO_SLICE);
 }
 
-static int get_regs_and_offset(FILE *fp, uint8_t *reg1, uint8_t *reg2, int16_t *offs) {
-    // try to get two params
-    if (get_two_params(fp) != 0)
-        return -1;    
+/**
+ * Fills in the label field of one forward reference, word is the instruction it was made from
+ * Labels that never got defined are reported at the place they were used
+ */
+static void patch_fixup(cursor_t *cur, const fixup_t *fix, uint32_t *word) {
+    const symbol_t *sym = symtab_get(cur->symbols, fix->sym);
 
-    // first param is the first reg
-    int res = try_find_register(fp, param1);
+    if (!sym->defined) {
+        diag_add(cur->diags, fix->line, fix->col, "Unknown label ", sym->name, sym->len);
+        return;
+    }
 
-    if (res > -1)
-        *reg1 = res;
-    else
-        return -1;
-    
-    // second param looks like this: offs(reg), so we just find the opening parenthesis and have fun
-    // read from param2 start to index of (
-    
-    char *open_paren = strchr(param2, '(');
+    if (fix->kind == FIXUP_JUMP) {
+        *word |= ((sym->pc >> 2) & INSTR_TARGET_MSK) << INSTR_TARGET_POS;
+    } else {
+        uint16_t offs;
+        if (branch_offset(fix->offset * 4, sym->pc, &offs) != 0) {
+            diag_add(cur->diags, fix->line, fix->col, "Branch target out of range ", sym->name, sym->len);
+            return;
+        }
+        *word |= ((uint32_t) offs & INSTR_IMM_MSK) << INSTR_IMM_POS;
+    }
+}
 
-    if (open_paren == NULL) {
-        print_error(fp, "Malformatted offset", param2);
-        return -1;
+/**
+ * Patches every forward reference in one sweep over the fixup list
+ */
+static void patch_fixups(cursor_t *cur) {
+    for (size_t i = 0; i < cur->fixups->count; i++)
+        patch_fixup(cur, &cur->fixups->items[i], &cur->image->words[cur->fixups->items[i].offset]);
+}
+
+// inputs smaller than this per thread aren't worth splitting up
+#define MIN_CHUNK_BYTES (64 * 1024)
+#define MAX_JOBS (256)
+
+// one slice of the source for the parallel assembler, always starts at the beginning of a line
+typedef struct {
+    masm_ctx_t *ctx;
+    const char *start;
+    const char *end;
+    uint32_t pc;         // base address, from the prefix sum over words
+    size_t line;         // first line number, from the prefix sum over lines
+    uint32_t words;      // instructions in the chunk, found by pass 1
+    size_t lines;        // newlines in the chunk, found by pass 1
+    label_list_t labels; // label definitions, found by pass 1
+    diag_list_t diags;   // pass 2 errors, merged in chunk order at the end
+    masm_stats_t stats;  // merged into the context's at the end
+    ir_batch_t ir;       // pass 2 decode buffer
+    arena_t arena;       // the context's arena isn't thread safe, so each chunk gets its own
+    masm_allocator_t scratch;
+} chunk_t;
+
+static void *chunk_pass_one(void *arg) {
+    chunk_t *chunk = arg;
+    cursor_t cur;
+
+    cursor_init(&cur, chunk->start, chunk->end, 1, 0);
+    cur.diags = &chunk->diags;
+    cur.symbols = &chunk->ctx->symbols;
+    cur.stats = &chunk->stats;
+    cur.labels = &chunk->labels;
+
+    pass_one(&cur);
+    chunk->words = cur.pc / 4;
+    chunk->lines = cur.line - 1;
+    return NULL;
+}
+
+static void *chunk_pass_two(void *arg) {
+    chunk_t *chunk = arg;
+    cursor_t cur;
+
+    cursor_init(&cur, chunk->start, chunk->end, chunk->line, chunk->pc);
+    cur.diags = &chunk->diags;
+    cur.symbols = &chunk->ctx->symbols;
+    cur.stats = &chunk->stats;
+    cur.image = &chunk->ctx->image;
+    cur.ir = &chunk->ir;
+
+    pass_two(&cur);
+    return NULL;
+}
+
+/**
+ * Runs fn on every chunk, one thread per chunk with the calling thread taking the first one
+ */
+static void run_chunks(chunk_t *chunks, int count, void *(*fn)(void *)) {
+    pthread_t threads[count];
+    int started[count];
+
+    for (int i = 1; i < count; i++)
+        started[i] = pthread_create(&threads[i], NULL, fn, &chunks[i]) == 0;
+
+    fn(&chunks[0]);
+
+    for (int i = 1; i < count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            fn(&chunks[i]); // couldn't get a thread, do it here
     }
+}
 
-    *open_paren = '\0'; // turn the ( into a null terminator so we can read an immediate from it
+/**
+ * Two-pass assembly split across jobs threads
+ * Pass 1 counts instructions and collects labels per chunk, a prefix sum gives each chunk its
+ * base address and line, then pass 2 encodes every chunk straight into its slice of the image
+ * The output and errors are exactly what the serial passes would produce
+ * The lines stat is left at the line the last chunk ended on
+ */
+static void assemble_parallel(masm_ctx_t *ctx, const char *src, size_t len, int jobs) {
+    chunk_t chunks[jobs];
+    const char *end = src + len;
+    const char *p = src;
+
+    // split at line boundaries into roughly equal chunks
+    for (int i = 0; i < jobs; i++) {
+        chunk_t *chunk = &chunks[i];
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->ctx = ctx;
+        chunk->start = p;
+        arena_init(&chunk->arena, &ctx->alloc);
+        chunk->scratch = arena_allocator(&chunk->arena);
+        chunk->labels.alloc = &chunk->scratch;
+        ir_init(&chunk->ir, &chunk->scratch);
+        diag_init(&chunk->diags, &chunk->scratch);
+
+        if (i == jobs - 1)
+            p = end;
+        else {
+            const char *split = src + len / jobs * (i + 1);
+            if (split < p)
+                split = p;
+            const char *nl = memchr(split, '\n', end - split);
+            p = nl == NULL ? end : nl + 1;
+        }
+        chunk->end = p;
+    }
 
-    res = try_find_immediate(fp, param2);
+    STAT_TIMER(t0);
+    run_chunks(chunks, jobs, chunk_pass_one);
+    STAT_PHASE(&ctx->stats, PHASE_PASS_ONE, t0);
+
+    // prefix sums, then define the labels in source order so duplicates are reported like the serial pass would
+    uint64_t pc = 0;
+    size_t line = 1;
+    for (int i = 0; i < jobs; i++) {
+        chunk_t *chunk = &chunks[i];
+        chunk->pc = pc;
+        chunk->line = line;
+
+        for (size_t l = 0; l < chunk->labels.count; l++) {
+            const label_def_t *def = &chunk->labels.items[l];
+            define_symbol(&ctx->symbols, &ctx->diags, def->name, def->len, pc + def->pc, line + def->line - 1, def->col);
+        }
 
-    if (res != FIND_IMM_ERR)
-        *offs = res;
-    else
-        return -1;
-    
-    // read the register
-    // first we find the closing parenthesis by starting at the opening one
-    char *close_paren = strchr(open_paren + 1, ')');
+        pc += chunk->words * 4;
+        line += chunk->lines;
+    }
 
-    if (open_paren == NULL) {
-        print_error(fp, "Malformatted source register", param2);
-        return -1;
+    if (pc > UINT32_MAX)
+        diag_add(&ctx->diags, line, 1, TOO_BIG_MSG, "", 0);
+    else if (image_grow(&ctx->image, pc / 4) != 0)
+        diag_add(&ctx->diags, 1, 1, "Out of memory", "", 0);
+    else {
+        ctx->image.count = pc / 4;
+        STAT_TIMER(t1);
+        run_chunks(chunks, jobs, chunk_pass_two);
+        STAT_PHASE(&ctx->stats, PHASE_PASS_TWO, t1);
     }
 
-    *close_paren = '\0'; // turn the ( into a null terminator so we can read an immediate from it
+    for (int i = 0; i < jobs; i++) {
+        // chunk arenas are live at the same time, so their peaks add up
+        STAT_SET(&chunks[i].stats, arena_peak, chunks[i].arena.stats.peak);
+        STAT_SET(&chunks[i].stats, arena_reserved, chunks[i].arena.stats.peak_reserved);
+        stats_merge(&ctx->stats, &chunks[i].stats);
+        diag_append(&ctx->diags, &chunks[i].diags);
+        arena_free(&chunks[i].arena);
+    }
+    STAT_SET(&ctx->stats, lines, line);
+}
 
-    // second register is between the open and close parenthesis
-    res = try_find_register(fp, open_paren + 1);
+/**
+ * Creates an assembler context, alloc can be NULL to use malloc
+ * Returns NULL if out of memory
+ */
+masm_ctx_t *masm_ctx_create(const masm_allocator_t *alloc) {
+    if (alloc == NULL)
+        alloc = &MASM_DEFAULT_ALLOCATOR;
+
+    masm_ctx_t *ctx = mem_alloc(alloc, sizeof(masm_ctx_t));
+    if (ctx == NULL)
+        return NULL;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->alloc = *alloc;
+    arena_init(&ctx->arena, &ctx->alloc);
+    ctx->scratch = arena_allocator(&ctx->arena);
+
+    // the containers are set up by each run, these just make an unused context safe to print
+    diag_init(&ctx->diags, &ctx->scratch);
+    image_init(&ctx->image, &ctx->scratch);
+    return ctx;
+}
 
-    if (res > -1)
-        *reg2 = res;
-    else
-        return -1;
+void masm_ctx_destroy(masm_ctx_t *ctx) {
+    if (ctx == NULL)
+        return;
 
-    return 0;
+    // every container lives in the arena
+    arena_free(&ctx->arena);
+
+    masm_allocator_t alloc = ctx->alloc;
+    mem_free(&alloc, ctx, sizeof(masm_ctx_t));
 }
 
-static int get_one_reg_and_imm(FILE *fp, uint8_t *reg1, int16_t *imm) {
-    // try to get three params
-    if (get_two_params(fp) != 0)
-        return -1;
+void masm_ctx_set_opts(masm_ctx_t *ctx, const assemble_opts_t *opts) {
+    ctx->opts = *opts;
+}
 
-    int res = try_find_register(fp, param1);
+/**
+ * Preallocates enough arena for bytes of small allocations, e.g. the peak_reserved of an earlier run
+ * Returns 0 on success, -1 if out of memory
+ */
+int masm_ctx_reserve(masm_ctx_t *ctx, size_t bytes) {
+    return arena_reserve(&ctx->arena, bytes);
+}
 
-    if (res > -1)
-        *reg1 = res;
-    else
-        return -1;
-    
-    res = try_find_immediate(fp, param2);
+/**
+ * Arena usage of the last assembly, plus the high-water marks since the context was created
+ * Chunk arenas used with jobs > 1 aren't included, see the arena_ fields of masm_get_stats for those
+ */
+void masm_get_memory(const masm_ctx_t *ctx, arena_stats_t *out) {
+    *out = ctx->arena.stats;
+}
+
+/**
+ * Throws away everything from the last run and sets the containers up again
+ * Returns -1 if out of memory
+ */
+static int start_run(masm_ctx_t *ctx) {
+    // the last run's image, errors and symbols all go at once
+    arena_reset(&ctx->arena);
+    diag_init(&ctx->diags, &ctx->scratch);
+    image_init(&ctx->image, &ctx->scratch);
+    ir_init(&ctx->ir, &ctx->scratch);
+    ctx->fixups = (fixup_list_t) { .alloc = &ctx->scratch };
+    ctx->reported = 0;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+
+    return symtab_init(&ctx->symbols, &ctx->scratch);
+}
+
+/**
+ * Decodes and repacks count words of the image in host order, the first one being word index base, for --verify
+ * Returns -1 and adds an error if a word doesn't come back bit for bit
+ */
+static int verify_words(masm_ctx_t *ctx, const masm_allocator_t *alloc, const uint32_t *words, size_t count, uint32_t base) {
+    size_t at;
+    uint32_t got;
+
+    STAT_TIMER(t0);
+    int ret = disasm_verify(words, count, alloc, &at, &got);
+    STAT_PHASE(&ctx->stats, PHASE_VERIFY, t0);
+
+    if (ret == 0)
+        return 0;
+
+    if (at == count)
+        diag_add(&ctx->diags, 1, 1, "Out of memory verifying the image", "", 0);
+    else {
+        char what[64];
+        int len = snprintf(what, sizeof(what), "0x%08x, %08x came back as %08x",
+                           (uint32_t) (base + at) * 4, words[at], got);
+        diag_add(&ctx->diags, 1, 1, "Round trip mismatch at ", what, len);
+    }
+    return -1;
+}
 
-    if (res != FIND_IMM_ERR)
-        *imm = res;
-    else
+/**
+ * Assembles len bytes of source text
+ * On return *out points at the encoded image (in the requested byte order) and *outlen is its size in bytes
+ * The image belongs to the context and stays valid until the next call or masm_ctx_destroy
+ * Returns 0 on success, -1 if there were errors (see masm_print_errors)
+ */
+int masm_assemble_buffer(masm_ctx_t *ctx, const char *src, size_t len, const void **out, size_t *outlen) {
+    if (start_run(ctx) != 0) {
+        *out = NULL;
+        *outlen = 0;
         return -1;
+    }
 
-    return 0;
+    cursor_t start;
+    cursor_init(&start, src, src + len, 1, 0);
+    start.diags = &ctx->diags;
+    start.symbols = &ctx->symbols;
+    start.image = &ctx->image;
+    start.stats = &ctx->stats;
+    start.ir = &ctx->ir;
+
+    cursor_t cur = start;
+
+    // don't bother with threads unless every one of them gets a decent amount of work
+    int jobs = ctx->opts.jobs;
+    if ((size_t) jobs > len / MIN_CHUNK_BYTES)
+        jobs = len / MIN_CHUNK_BYTES;
+    if (jobs > MAX_JOBS)
+        jobs = MAX_JOBS;
+
+    if (jobs > 1) {
+        assemble_parallel(ctx, src, len, jobs);
+    } else if (ctx->opts.one_pass) {
+        // patch forward references at the end instead of reading the source twice
+        cur.fixups = &ctx->fixups;
+        cur.append = 1;
+        STAT_TIMER(t0);
+        pass_two(&cur);
+        STAT_PHASE(&ctx->stats, PHASE_PASS_TWO, t0);
+
+        STAT_TIMER(t1);
+        patch_fixups(&cur);
+        STAT_PHASE(&ctx->stats, PHASE_FIXUPS, t1);
+        STAT_SET(&ctx->stats, lines, cur.line);
+    } else {
+        STAT_TIMER(t0);
+        int fits = pass_one(&cur) == 0;
+        STAT_PHASE(&ctx->stats, PHASE_PASS_ONE, t0);
+
+        // every instruction takes a slot, so pass 1 tells us exactly how big the image will be
+        if (fits && image_grow(&ctx->image, cur.pc / 4) != 0)
+            diag_add(&ctx->diags, 1, 1, "Out of memory", "", 0);
+        else if (fits) {
+            ctx->image.count = cur.pc / 4;
+            cur = start;
+            STAT_TIMER(t1);
+            pass_two(&cur);
+            STAT_PHASE(&ctx->stats, PHASE_PASS_TWO, t1);
+        }
+        STAT_SET(&ctx->stats, lines, cur.line);
+    }
+
+    if (ctx->opts.verify && ctx->diags.count == 0)
+        verify_words(ctx, &ctx->scratch, ctx->image.words, ctx->image.count, 0);
+
+    if (ctx->opts.endian != host_endian()) {
+        STAT_TIMER(t2);
+        image_bswap(ctx->image.words, ctx->image.count);
+        STAT_PHASE(&ctx->stats, PHASE_SWAP, t2);
+    }
+
+    // a last line without a newline still counts
+    STAT_SET(&ctx->stats, lines, ctx->stats.lines - 1 + (len > 0 && src[len - 1] != '\n'));
+    STAT_SET(&ctx->stats, errors, ctx->diags.count);
+    STAT_SET(&ctx->stats, bytes_read, len);
+    STAT_ADD(&ctx->stats, arena_peak, ctx->arena.stats.peak);
+    STAT_ADD(&ctx->stats, arena_reserved, ctx->arena.stats.peak_reserved);
+
+    *out = ctx->image.words;
+    *outlen = ctx->image.count * sizeof(uint32_t);
+    return ctx->diags.count > 0 ? -1 : 0;
 }
 
-static int set_params(InstrID id, FILE *fp, instr_t *instr) {
-    ParamOrder order = PARAM_ORDERS[id];
-    
-    // if no params, just return, don't set any params
-    if (order == NONE)
-        return 0;
 
-    int ret = 0;
+// what a streaming run needs besides the cursor
+typedef struct {
+    int out_fd;
+    FILE *errors;          // where diagnostics are printed as they're found
+    uint32_t base;         // word index of image->words[0], everything before it has been written
+    Endian endian;
+    char tail;             // last char of the input seen so far
+} stream_t;
+
+static const char *const DROP_ERRORS[] = {
+    [DROP_OUT_OF_RANGE] = "Branch target out of range ",
+    [DROP_TOO_FAR] = "Forward reference too far ahead to stream ",
+};
+
+/**
+ * Patches the forward references that can be and drops them from the list
+ * When last is set every reference is settled, undefined labels are reported like patch_fixups does
+ * Returns the word index of the oldest reference still waiting, or the end of the image if none are
+ */
+static uint32_t settle_fixups(cursor_t *cur, uint32_t base, int last) {
+    fixup_list_t *list = cur->fixups;
+    image_t *image = cur->image;
+    uint32_t end = base + image->count; // labels defined from now on are at least here
+    uint32_t hold = end;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < list->count; i++) {
+        fixup_t fix = list->items[i];
+        const symbol_t *sym = symtab_get(cur->symbols, fix.sym);
+
+        // the word is gone, all that's left is which error it gets
+        if (fix.dropped != DROP_NONE) {
+            if (sym->defined)
+                diag_add(cur->diags, fix.line, fix.col, DROP_ERRORS[fix.dropped], sym->name, sym->len);
+            else if (last)
+                diag_add(cur->diags, fix.line, fix.col, "Unknown label ", sym->name, sym->len);
+            else
+                list->items[kept++] = fix;
+            continue;
+        }
+
+        if (sym->defined || last) {
+            patch_fixup(cur, &fix, &image->words[fix.offset - base]);
+            continue;
+        }
 
-    // Get param order based on id, parse params
-    switch (order) {
-        case RS:        ret = get_one_reg(fp, &instr->rs); break;
-        case RD:        ret = get_one_reg(fp, &instr->rd); break;
-        case RD_RS:     ret = get_two_regs(fp, &instr->rd, &instr->rs); break;
-        case RS_RT:     ret = get_two_regs(fp, &instr->rs, &instr->rt); break;
-        case RD_RS_RT:  ret = get_three_regs(fp, &instr->rd, &instr->rs, &instr->rt); break;
-        case RD_RT_RS:  ret = get_three_regs(fp, &instr->rd, &instr->rt, &instr->rd); break;
-        case RD_RT_SA:  ret = get_two_regs_and_imm(fp, &instr->rd, &instr->rt, &instr->shamt); break;
-        case LABEL: break;
-        case RT_RS_IMM: ret = get_two_regs_and_imm(fp, &instr->rt, &instr->rs, &instr->imm); break;
-        case RS_RT_LABEL: break;
-        case RS_LABEL: break;
-        case RT_IMM_RS: ret = get_regs_and_offset(fp, &instr->rt, &instr->rs, &instr->imm); break;
-        case RT_IMM:    ret = get_one_reg_and_imm(fp, &instr->rt, &instr->imm); break;
+        // wherever the label turns up it can't be reached, so the word goes out unpatched and
+        // the reference is only kept to report it
+        if (fix.kind == FIXUP_BRANCH && end - fix.offset > 1 + INT16_MAX)
+            fix.dropped = DROP_OUT_OF_RANGE;
+        else if (end - fix.offset > MASM_STREAM_MAX_PENDING)
+            fix.dropped = DROP_TOO_FAR;
+
+        list->items[kept++] = fix;
+        if (fix.dropped != DROP_NONE)
+            continue;
+        if (fix.offset < hold)
+            hold = fix.offset;
+    }
+    list->count = kept;
+    return hold;
+}
+
+/**
+ * Writes out every word in front of the oldest forward reference still waiting, and prints
+ * the errors found so far
+ * Returns -1 if the output couldn't be written or a word failed --verify
+ */
+static int stream_settle(cursor_t *cur, stream_t *st, masm_ctx_t *ctx, int last) {
+    image_t *image = cur->image;
+    uint32_t hold = st->base + image->count;
+
+    // a two-pass stream has no fixups, every word is final as soon as it's encoded
+    if (cur->fixups != NULL) {
+        STAT_TIMER(t0);
+        hold = settle_fixups(cur, st->base, last);
+        STAT_PHASE(cur->stats, PHASE_FIXUPS, t0);
+    }
+
+    // a word that fails --verify is never written, so the output stops short of it
+    size_t ready = hold - st->base;
+    int ret = ready > 0 && ctx->opts.verify ? verify_words(ctx, &ctx->alloc, image->words, ready, st->base) : 0;
+
+    // the errors are dropped once printed so a broken input can't grow them without bound
+    diag_print(cur->diags, NULL, st->errors);
+    ctx->reported += cur->diags->count;
+    diag_clear(cur->diags);
+
+    if (ready == 0 || ret != 0)
+        return ret;
+
+    STAT_TIMER(t1);
+    if (st->endian != host_endian())
+        image_bswap(image->words, ready);
+
+    ret = write_all(st->out_fd, image->words, ready * sizeof(uint32_t));
+    if (ret != 0) {
+        fprintf(st->errors, "Error: couldn't write the output\n");
+        ctx->reported++;
     }
+    STAT_ADD(cur->stats, bytes_written, ready * sizeof(uint32_t));
 
+    memmove(image->words, image->words + ready, (image->count - ready) * sizeof(uint32_t));
+    image->count -= ready;
+    st->base = hold;
+    STAT_PHASE(cur->stats, PHASE_WRITE, t1);
     return ret;
 }
 
+static const char *last_newline(const char *buf, size_t len) {
+    while (len > 0) {
+        if (buf[--len] == '\n')
+            return buf + len;
+    }
+    return NULL;
+}
+
 /**
- * Takes a file pointer to the assembly file, advances the pointer, and returns a packed instruction
- * Assume we've read the instruction from the file already, so we have the id
+ * Runs one pass over the whole input a window at a time, each time over as many whole lines as the window holds
+ * With st set it's an encoding pass and words are written out after every window
+ * Returns -1 if the pass had to stop, errors have been reported
  */
-static int64_t construct_instruction(FILE *fp) {
-    instr_t instr;
-    char c;
+static int stream_pass(masm_ctx_t *ctx, cursor_t *cur, source_window_t *win, stream_t *st) {
+    int skip = 0; // dropping input until the end of an overlong line
 
-    char instr_str[10];
-    // from current position to the next space
-    next_str(fp, instr_str, 10, WHITESPACE);
+    while (1) {
+        const char *data = win->data;
+        const char *start = data;
+        const char *end = NULL;
+
+        if (st != NULL && win->len > 0)
+            st->tail = data[win->len - 1];
+
+        if (skip) {
+            // keep the newline so the line still gets counted
+            const char *nl = memchr(data, '\n', win->len);
+            start = nl == NULL ? data + win->len : nl;
+            skip = nl == NULL;
+        }
 
-    InstrID id = find_instr(instr_str);
+        if (!skip) {
+            const char *nl = last_newline(start, data + win->len - start);
+            if (win->last)
+                end = data + win->len;
+            else if (nl != NULL)
+                end = nl + 1;
+            else if (start == data && win->full) {
+                // a long comment can just be dropped along with the rest of the window, anything else is an error
+                end = memchr(data, '#', win->len);
+                if (end == NULL) {
+                    if (st != NULL)
+                        diag_add(cur->diags, cur->line, 1, "Line too long to stream", "", 0);
+                    start = end = data + win->len;
+                }
+                skip = 1;
+            }
+        }
 
-    if (id == INVALID) {
-        print_error(fp, "Unknown instruction ", instr_str);
+        if (end != NULL) {
+            cur->cur = cur->line_start = start;
+            cur->end = end;
+            scanner_init(&cur->scan, start, end);
+
+            if (st == NULL) {
+                STAT_TIMER(t0);
+                int ret = pass_one(cur);
+                STAT_PHASE(cur->stats, PHASE_PASS_ONE, t0);
+                if (ret != 0)
+                    return -1;
+            } else {
+                STAT_TIMER(t0);
+                pass_two(cur);
+                STAT_PHASE(cur->stats, PHASE_PASS_TWO, t0);
+
+                if (stream_settle(cur, st, ctx, win->last) != 0)
+                    return -1;
+            }
+            // past a long comment there's no newline left in the window, none of it is needed
+            start = skip ? data + win->len : end;
+        }
+
+        if (win->last)
+            return 0;
+
+        STAT_TIMER(t1);
+        int ret = source_window_next(win, start - data);
+        STAT_PHASE(cur->stats, PHASE_READ, t1);
+        if (ret != 0) {
+            diag_add(cur->diags, cur->line, 1, "Couldn't read the input", "", 0);
+            return -1;
+        }
+    }
+}
+
+/**
+ * Assembles everything read from in_fd, writing words to out_fd as soon as they're final
+ * Nothing is ever seeked and memory stays bounded whatever the input size, the source goes through
+ * a fixed size window (see source_window_t) and only the words behind an unresolved forward
+ * reference are held back
+ * Regular files get both passes, pipes can only be read once so they're assembled in one pass
+ * Errors are printed to errors as they're found, masm_error_count still counts them
+ * Output written before an error was found stays written
+ * Returns 0 on success, -1 if there were errors
+ */
+int masm_assemble_stream(masm_ctx_t *ctx, int in_fd, int out_fd, FILE *errors) {
+    if (start_run(ctx) != 0)
+        return -1;
+
+    source_window_t win;
+    if (source_window_open(&win, in_fd) != 0) {
+        fprintf(errors, "Error: couldn't read the input\n");
+        ctx->reported++;
         return -1;
     }
 
-    // populate fields that we can after instruction 
-    instr.opcode = get_opcode(id);
-    instr.funct  = get_funct(id);
-    instr.type   = get_type(id);
+    stream_t st = {
+        .out_fd = out_fd,
+        .errors = errors,
+        .endian = ctx->opts.endian,
+        .tail = '\n'
+    };
+
+    cursor_t cur;
+    cursor_init(&cur, win.data, win.data, 1, 0);
+    cur.diags = &ctx->diags;
+    cur.symbols = &ctx->symbols;
+    cur.image = &ctx->image;
+    cur.stats = &ctx->stats;
+    cur.ir = &ctx->ir;
+    cur.append = 1;
 
-    instr.rs     = 0;
-    instr.rt     = 0;
-    instr.rd     = 0;
-    instr.shamt  = 0;
-    instr.imm    = 0;
+    int ret = 0;
+    if (win.mapped && !ctx->opts.one_pass) {
+        // every label is known after pass 1, so pass 2 never holds a word back
+        ret = stream_pass(ctx, &cur, &win, NULL);
+        if (ret == 0)
+            ret = source_window_rewind(&win);
+
+        cursor_init(&cur, win.data, win.data, 1, 0);
+        cur.diags = &ctx->diags;
+        cur.symbols = &ctx->symbols;
+        cur.image = &ctx->image;
+        cur.stats = &ctx->stats;
+        cur.ir = &ctx->ir;
+        cur.append = 1;
+    } else
+        cur.fixups = &ctx->fixups;
 
-    if (set_params(id, fp, &instr) == -1)
-        return -1; // error occurred
+    if (ret == 0)
+        ret = stream_pass(ctx, &cur, &win, &st);
+
+    // anything a failed pass left behind
+    diag_print(&ctx->diags, NULL, errors);
+    ctx->reported += ctx->diags.count;
+    diag_clear(&ctx->diags);
+
+    // a last line without a newline still counts
+    STAT_SET(&ctx->stats, lines, cur.line - 1 + (st.tail != '\n'));
+    STAT_SET(&ctx->stats, errors, ctx->reported);
+    STAT_SET(&ctx->stats, bytes_read, win.offset + win.len);
+    STAT_ADD(&ctx->stats, arena_peak, ctx->arena.stats.peak);
+    STAT_ADD(&ctx->stats, arena_reserved, ctx->arena.stats.peak_reserved);
+
+    source_window_close(&win);
+    return ret != 0 || ctx->reported > 0 ? -1 : 0;
+}
+
+size_t masm_error_count(const masm_ctx_t *ctx) {
+    return ctx->reported + ctx->diags.count;
+}
+
+void masm_print_errors(const masm_ctx_t *ctx, FILE *fp) {
+    diag_print(&ctx->diags, NULL, fp);
+}
 
-    return pack_instr(&instr);
+/**
+ * Like masm_print_errors, with every line starting with file
+ */
+void masm_print_file_errors(const masm_ctx_t *ctx, const char *file, FILE *fp) {
+    diag_print(&ctx->diags, file, fp);
+}
+
+void masm_print_symbols(const masm_ctx_t *ctx, FILE *fp) {
+    symtab_dump(&ctx->symbols, fp);
+}
+
+/**
+ * Labels of the last assembly, by id in the order they were first seen
+ */
+size_t masm_symbol_count(const masm_ctx_t *ctx) {
+    return ctx->symbols.count;
+}
+
+/**
+ * Name and address of label id
+ * Returns -1 if it was only ever referenced, never defined
+ */
+int masm_get_symbol(const masm_ctx_t *ctx, size_t id, const char **name, uint32_t *pc) {
+    const symbol_t *sym = symtab_get(&ctx->symbols, id);
+
+    if (!sym->defined)
+        return -1;
+    *name = sym->name;
+    *pc = sym->pc;
+    return 0;
+}
+
+/**
+ * Timers and counters of the last assembly, all zero unless built with MASM_STATS
+ */
+const masm_stats_t *masm_get_stats(const masm_ctx_t *ctx) {
+    return &ctx->stats;
+}
+
+void masm_print_stats(const masm_ctx_t *ctx, StatsFormat format, FILE *fp) {
+    stats_print(&ctx->stats, format, fp);
 }
 
 /**
  * Takes the paths of input and output files
  */
 int assemble(const char *infile, const char *outfile) {
-    FILE *fin = fopen(infile, "r");
-    FILE *fout = fopen(outfile, "w");
+    return assemble_file(infile, outfile, NULL);
+}
 
-    if (fin == NULL || fout == NULL)
+/**
+ * Creates a file to stream the output of path into, in the same directory so it can be renamed over it
+ * Returns the fd with its name in tmp, or -1
+ */
+static int open_temp_output(const char *path, char *tmp, size_t size) {
+    if (snprintf(tmp, size, "%s.XXXXXX", path) >= (int) size)
         return -1;
-    
-    uint32_t pc = 0;
-    while (1) {
-        // assume we're looking for an instruction or label
-        if (buffer_past_whitespace(fin) == EOF) {
-            printf("Reached end of file.\n");
-            break;
+
+    int fd = mkstemp(tmp);
+    if (fd >= 0 && fchmod(fd, 0644) != 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Assembles infile into outfile, either can be "-" for stdin or stdout
+ * Input from stdin or bigger than SOURCE_STREAM_MIN_BYTES is streamed, so RSS doesn't follow its size
+ * Either way outfile is left as it was if there's an error
+ * Messages go to stdout, or to stderr when stdout is taken by the binary
+ */
+int assemble_file(const char *infile, const char *outfile, const assemble_opts_t *opts) {
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+
+    if (ctx == NULL)
+        return -1;
+
+    if (opts != NULL)
+        masm_ctx_set_opts(ctx, opts);
+
+    FILE *msgs = strcmp(outfile, "-") == 0 ? stderr : stdout;
+    int ret;
+
+    // -j needs the whole file mapped, anything else that's too big goes through a window
+    struct stat st;
+    int from_stdin = strcmp(infile, "-") == 0;
+    int stream = from_stdin || (stat(infile, &st) == 0 && S_ISREG(st.st_mode) &&
+                                (uint64_t) st.st_size >= SOURCE_STREAM_MIN_BYTES && ctx->opts.jobs <= 1);
+
+    if (stream) {
+        // words are written as they're final, so they go to a temporary file that only
+        // replaces outfile once the whole input has assembled, like the buffered path leaves
+        // outfile alone on an error
+        char tmp[PATH_MAX];
+        int to_stdout = msgs == stderr;
+        int in_fd = from_stdin ? STDIN_FILENO : open(infile, O_RDONLY);
+
+        if (in_fd < 0) {
+            fprintf(msgs, "Couldn't read %s\n", infile);
+            masm_ctx_destroy(ctx);
+            return -1;
         }
 
-        // we've found something, read the string
-        char str[100];
-        // look for a label
-        if (next_str(fin, str, sizeof(str), ':') > 0) {
-            // we found a label
-            // do something with the label, then continue
-            continue;
+        int out_fd = to_stdout ? STDOUT_FILENO : open_temp_output(outfile, tmp, sizeof(tmp));
+        if (out_fd < 0) {
+            fprintf(msgs, "Couldn't write %s\n", outfile);
+            if (in_fd != STDIN_FILENO)
+                close(in_fd);
+            masm_ctx_destroy(ctx);
+            return -1;
         }
 
-        // label was not found, try to decode as instruction
-        int64_t instr_code = construct_instruction(fin);
+        ret = masm_assemble_stream(ctx, in_fd, out_fd, msgs);
+        if (!to_stdout) {
+            if (close(out_fd) != 0)
+                ret = -1;
+            if (ret == 0 && rename(tmp, outfile) != 0) {
+                fprintf(msgs, "Couldn't write %s\n", outfile);
+                ret = -1;
+            }
+            if (ret != 0)
+                unlink(tmp);
+        }
+        if (in_fd != STDIN_FILENO)
+            close(in_fd);
+    } else {
+        source_t src;
 
-        if (instr_code == -1) {
-            printf("Reached end of file but something bad happened :(\n");
-            break;
-        } else {
-            uint32_t instr_code_packed = instr_code;
-            fwrite(&instr_code_packed, sizeof(uint32_t), 1, fout);
+        STAT_TIMER(t0);
+        if (source_open(&src, infile) != 0) {
+            fprintf(msgs, "Couldn't read %s\n", infile);
+            masm_ctx_destroy(ctx);
+            return -1;
         }
+        STAT_TIMER(t1);
+
+        const void *out;
+        size_t outlen;
+        ret = masm_assemble_buffer(ctx, src.data, src.len, &out, &outlen);
+        // the buffer call starts the stats over, so the read gets added afterwards
+        STAT_ADD(&ctx->stats, ns[PHASE_READ], t1 - t0);
+
+        // report everything we found in one go
+        masm_print_errors(ctx, msgs);
+
+        if (ret == 0) {
+            STAT_TIMER(t2);
+            if (write_file(outfile, out, outlen) != 0) {
+                fprintf(msgs, "Couldn't write %s\n", outfile);
+                ret = -1;
+            } else
+                STAT_SET(&ctx->stats, bytes_written, outlen);
+            STAT_PHASE(&ctx->stats, PHASE_WRITE, t2);
+        }
+        source_close(&src);
     }
 
-    fclose(fin);
-    fclose(fout);
-    return 0;
-}
\ No newline at end of file
+    if (ctx->opts.dump_symbols)
+        masm_print_symbols(ctx, msgs);
+
+    // stats go to stderr so the JSON can be pulled apart from errors and symbols
+    if (ctx->opts.stats != STATS_OFF)
+        masm_print_stats(ctx, ctx->opts.stats, stderr);
+
+    masm_ctx_destroy(ctx);
+    return ret;
+}
@@ -1,5 +1,45 @@
 #pragma once
 
-#define MAX_PARAM_LENGTH 1024
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "alloc.h"
+#include "arena.h"
+#include "image.h"
+#include "stats.h"
 
-int assemble(const char *infile, const char *outfile);
\ No newline at end of file
+typedef struct {
+    int dump_symbols;  // print the symbol table after assembling
+    int one_pass;      // read the source once, backpatching forward references
+    Endian endian;     // byte order of the output file
+    int jobs;          // threads to split a big input across, 0 or 1 to stay serial
+    StatsFormat stats; // print timers and counters to stderr when done
+    int verify;        // decode the image again and check every word re-encodes bit for bit
+} assemble_opts_t;
+
+// most words a one-pass stream holds back waiting on forward references, a label used further
+// ahead of its definition than this can't be streamed
+#define MASM_STREAM_MAX_PENDING (1 << 20)
+
+// all the state of one assembler, contexts share nothing so each thread can have its own
+// with jobs > 1 the allocator hooks get called from the worker threads too
+typedef struct masm_ctx masm_ctx_t;
+
+masm_ctx_t *masm_ctx_create(const masm_allocator_t *alloc);
+void masm_ctx_destroy(masm_ctx_t *ctx);
+void masm_ctx_set_opts(masm_ctx_t *ctx, const assemble_opts_t *opts);
+int masm_ctx_reserve(masm_ctx_t *ctx, size_t bytes);
+int masm_assemble_buffer(masm_ctx_t *ctx, const char *src, size_t len, const void **out, size_t *outlen);
+int masm_assemble_stream(masm_ctx_t *ctx, int in_fd, int out_fd, FILE *errors);
+size_t masm_error_count(const masm_ctx_t *ctx);
+void masm_print_errors(const masm_ctx_t *ctx, FILE *fp);
+void masm_print_file_errors(const masm_ctx_t *ctx, const char *file, FILE *fp);
+void masm_print_symbols(const masm_ctx_t *ctx, FILE *fp);
+size_t masm_symbol_count(const masm_ctx_t *ctx);
+int masm_get_symbol(const masm_ctx_t *ctx, size_t id, const char **name, uint32_t *pc);
+const masm_stats_t *masm_get_stats(const masm_ctx_t *ctx);
+void masm_print_stats(const masm_ctx_t *ctx, StatsFormat format, FILE *fp);
+void masm_get_memory(const masm_ctx_t *ctx, arena_stats_t *out);
+
+int assemble(const char *infile, const char *outfile);
+int assemble_file(const char *infile, const char *outfile, const assemble_opts_t *opts);
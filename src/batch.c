@@ -0,0 +1,239 @@
+#include "batch.h"
+#include "pool.h"
+#include "source.h"
+#include "image.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+// what one file produced, kept until every file is done so the report comes out in input order
+typedef struct {
+    char *text;      // errors and symbols, already formatted
+    size_t text_len;
+    int failed;
+    size_t errors;
+    size_t bytes;    // source size
+} batch_result_t;
+
+typedef struct {
+    const file_list_t *files;
+    const assemble_opts_t *opts;
+    masm_ctx_t *ctxs[POOL_MAX_WORKERS];   // one per worker, reused for every file it takes
+    masm_stats_t stats[POOL_MAX_WORKERS]; // summed per worker, so no thread waits on another
+    batch_result_t *results;
+} batch_t;
+
+void file_list_init(file_list_t *list) {
+    memset(list, 0, sizeof(*list));
+}
+
+void file_list_free(file_list_t *list) {
+    for (size_t i = 0; i < list->count; i++)
+        free(list->paths[i]);
+    free(list->paths);
+    file_list_init(list);
+}
+
+static int add_path(file_list_t *list, const char *path, size_t len) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        char **paths = realloc(list->paths, cap * sizeof(char *));
+        if (paths == NULL)
+            return -1;
+        list->paths = paths;
+        list->cap = cap;
+    }
+
+    char *copy = strndup(path, len);
+    if (copy == NULL)
+        return -1;
+
+    list->paths[list->count++] = copy;
+    return 0;
+}
+
+/**
+ * Adds a path, or every path in a file list if arg is @file
+ * A file list has one path per line, blank lines and lines starting with # are skipped
+ * Returns -1 if the list couldn't be read or out of memory
+ */
+int file_list_add(file_list_t *list, const char *arg) {
+    if (arg[0] != '@')
+        return add_path(list, arg, strlen(arg));
+
+    source_t src;
+    if (source_open(&src, arg + 1) != 0)
+        return -1;
+
+    const char *p = src.data;
+    const char *end = src.data + src.len;
+    int ret = 0;
+
+    while (p < end && ret == 0) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl == NULL ? end : nl;
+        const char *last = line_end;
+
+        while (last > p && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t'))
+            last--;
+        if (last > p && *p != '#')
+            ret = add_path(list, p, last - p);
+
+        p = line_end + 1;
+    }
+
+    source_close(&src);
+    return ret;
+}
+
+/**
+ * The output of a batch input is next to it, with .asm or .s swapped for ext (or ext added)
+ * A .bin image is swapped too unless ext is .bin, so a run of a.bin writes a.out
+ * Returns -1 if the path is too long
+ */
+int batch_output_path(const char *in, const char *ext, char *out, size_t size) {
+    size_t len = strlen(in);
+    const char *dot = strrchr(in, '.');
+    const char *slash = strrchr(in, '/');
+
+    if (dot != NULL && (slash == NULL || dot > slash) && (strcmp(dot, ".asm") == 0 || strcmp(dot, ".s") == 0
+        || (strcmp(dot, ".bin") == 0 && strcmp(ext, ".bin") != 0)))
+        len = dot - in;
+
+    return snprintf(out, size, "%.*s%s", (int) len, in, ext) < (int) size ? 0 : -1;
+}
+
+static void batch_job(void *arg, int worker, size_t job) {
+    batch_t *batch = arg;
+    masm_ctx_t *ctx = batch->ctxs[worker];
+    const char *in = batch->files->paths[job];
+    batch_result_t *res = &batch->results[job];
+    char out[PATH_MAX];
+    source_t src;
+
+    FILE *fp = open_memstream(&res->text, &res->text_len);
+    if (fp == NULL) {
+        res->failed = 1;
+        return;
+    }
+
+    if (batch_output_path(in, ".bin", out, sizeof(out)) != 0) {
+        fprintf(fp, "%s: path too long\n", in);
+        res->failed = 1;
+    } else if (source_open(&src, in) != 0) {
+        fprintf(fp, "%s: couldn't read the file\n", in);
+        res->failed = 1;
+    } else {
+        const void *image;
+        size_t image_len;
+
+        res->failed = masm_assemble_buffer(ctx, src.data, src.len, &image, &image_len) != 0;
+        res->errors = masm_error_count(ctx);
+        res->bytes = src.len;
+        masm_print_file_errors(ctx, in, fp);
+
+        if (!res->failed && write_file(out, image, image_len) != 0) {
+            fprintf(fp, "%s: couldn't write %s\n", in, out);
+            res->failed = 1;
+        }
+
+        if (batch->opts->dump_symbols) {
+            fprintf(fp, "%s:\n", in);
+            masm_print_symbols(ctx, fp);
+        }
+
+        stats_merge(&batch->stats[worker], masm_get_stats(ctx));
+        source_close(&src);
+    }
+
+    fclose(fp);
+}
+
+/**
+ * Runs every job and prints the report, the contexts have to be set up
+ * Returns 0 if every file assembled, -1 otherwise
+ */
+static int run_batch(batch_t *batch, int workers) {
+    const file_list_t *files = batch->files;
+
+    uint64_t t0 = stats_now();
+    if (pool_run(files->count, workers, batch_job, batch) != 0)
+        return -1;
+    double secs = (stats_now() - t0) / 1e9;
+
+    size_t failed = 0, errors = 0, bytes = 0;
+    for (size_t i = 0; i < files->count; i++) {
+        const batch_result_t *res = &batch->results[i];
+        if (res->text != NULL)
+            fwrite(res->text, 1, res->text_len, stdout);
+        failed += res->failed;
+        errors += res->errors;
+        bytes += res->bytes;
+    }
+
+    printf("%zu files, %zu failed, %zu errors in %.1f ms (%.0f files/s, %.1f MB/s, %d thread%s)\n",
+           files->count, failed, errors, secs * 1e3, files->count / secs, bytes / secs / 1e6,
+           workers, workers == 1 ? "" : "s");
+
+    if (batch->opts->stats != STATS_OFF) {
+        masm_stats_t total = { 0 };
+        for (int i = 0; i < workers; i++)
+            stats_merge(&total, &batch->stats[i]);
+        stats_print(&total, batch->opts->stats, stderr);
+    }
+    return failed > 0 ? -1 : 0;
+}
+
+/**
+ * Assembles every file in the list independently, opts->jobs workers at a time
+ * Each input gets its own output next to it, see batch_output_path
+ * Errors and symbols are printed grouped by file in input order, followed by a summary line,
+ * so the report doesn't depend on which worker finished first
+ * Returns 0 if every file assembled, -1 otherwise
+ */
+int assemble_batch(const file_list_t *files, const assemble_opts_t *opts) {
+    // as many workers as pool_run will start, that's the count the summary reports
+    int workers = opts->jobs > 1 ? opts->jobs : 1;
+    if (workers > POOL_MAX_WORKERS)
+        workers = POOL_MAX_WORKERS;
+    if ((size_t) workers > files->count)
+        workers = files->count > 0 ? files->count : 1;
+
+    batch_t *batch = calloc(1, sizeof(batch_t));
+    batch_result_t *results = calloc(files->count ? files->count : 1, sizeof(batch_result_t));
+    int ret = -1;
+
+    // files are small and many, so each one is assembled serially and the workers are the parallelism
+    assemble_opts_t file_opts = *opts;
+    file_opts.jobs = 0;
+
+    if (batch != NULL && results != NULL) {
+        batch->files = files;
+        batch->opts = opts;
+        batch->results = results;
+
+        int ready = 1;
+        for (int i = 0; i < workers && ready; i++) {
+            batch->ctxs[i] = masm_ctx_create(NULL);
+            if (batch->ctxs[i] == NULL)
+                ready = 0;
+            else
+                masm_ctx_set_opts(batch->ctxs[i], &file_opts);
+        }
+
+        if (ready)
+            ret = run_batch(batch, workers);
+
+        for (int i = 0; i < workers; i++)
+            masm_ctx_destroy(batch->ctxs[i]);
+    }
+
+    for (size_t i = 0; results != NULL && i < files->count; i++)
+        free(results[i].text);
+    free(results);
+    free(batch);
+    return ret;
+}
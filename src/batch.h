@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include "assemble.h"
+
+// input paths for a batch, in the order their results get reported
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t cap;
+} file_list_t;
+
+void file_list_init(file_list_t *list);
+void file_list_free(file_list_t *list);
+int file_list_add(file_list_t *list, const char *arg);
+
+int batch_output_path(const char *in, const char *ext, char *out, size_t size);
+int assemble_batch(const file_list_t *files, const assemble_opts_t *opts);
@@ -0,0 +1,97 @@
+#include "diag.h"
+#include <string.h>
+
+void diag_init(diag_list_t *list, const masm_allocator_t *alloc) {
+    memset(list, 0, sizeof(*list));
+    list->alloc = alloc;
+}
+
+void diag_free(diag_list_t *list) {
+    mem_free(list->alloc, list->items, list->cap * sizeof(diag_t));
+    mem_free(list->alloc, list->text, list->text_cap);
+    diag_init(list, list->alloc);
+}
+
+/**
+ * Forgets every diagnostic but keeps the memory around for the next run
+ */
+void diag_clear(diag_list_t *list) {
+    list->count = 0;
+    list->text_len = 0;
+}
+
+/**
+ * Makes room for extra more bytes of message text
+ */
+static int reserve_text(diag_list_t *list, size_t extra) {
+    if (list->text_len + extra <= list->text_cap)
+        return 0;
+
+    size_t cap = list->text_cap ? list->text_cap : 256;
+    while (cap < list->text_len + extra)
+        cap *= 2;
+
+    char *text = mem_realloc(list->alloc, list->text, list->text_cap, cap);
+    if (text == NULL)
+        return -1;
+
+    list->text = text;
+    list->text_cap = cap;
+    return 0;
+}
+
+/**
+ * Records an error at line:col, the message is msg followed by other_len chars of other
+ * other doesn't need to be null terminated (it's usually a slice of the source)
+ * Returns 0 on success, -1 if out of memory
+ */
+int diag_add(diag_list_t *list, size_t line, int col, const char *msg, const char *other, int other_len) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 16;
+        diag_t *items = mem_realloc(list->alloc, list->items, list->cap * sizeof(diag_t), cap * sizeof(diag_t));
+        if (items == NULL)
+            return -1;
+        list->items = items;
+        list->cap = cap;
+    }
+
+    size_t msg_len = strlen(msg);
+    if (reserve_text(list, msg_len + other_len) != 0)
+        return -1;
+
+    diag_t *diag = &list->items[list->count++];
+    diag->line = line;
+    diag->col = col;
+    diag->msg = list->text_len;
+    diag->msg_len = msg_len + other_len;
+
+    memcpy(list->text + list->text_len, msg, msg_len);
+    memcpy(list->text + list->text_len + msg_len, other, other_len);
+    list->text_len += msg_len + other_len;
+    return 0;
+}
+
+/**
+ * Adds every diagnostic in src to the end of dst
+ */
+int diag_append(diag_list_t *dst, const diag_list_t *src) {
+    for (size_t i = 0; i < src->count; i++) {
+        const diag_t *diag = &src->items[i];
+        if (diag_add(dst, diag->line, diag->col, "", src->text + diag->msg, diag->msg_len) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Prints every diagnostic in the order they were added
+ * file can be NULL, otherwise every line starts with it so errors from a batch can be told apart
+ */
+void diag_print(const diag_list_t *list, const char *file, FILE *fp) {
+    for (size_t i = 0; i < list->count; i++) {
+        const diag_t *diag = &list->items[i];
+        if (file != NULL)
+            fprintf(fp, "%s: ", file);
+        fprintf(fp, "Error: '%.*s' at %zu:%d\n", (int) diag->msg_len, list->text + diag->msg, diag->line, diag->col);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include "alloc.h"
+
+// one diagnostic, the message lives in the list's text pool
+typedef struct {
+    size_t line;
+    int col;
+    size_t msg;     // offset of the message in the text pool
+    size_t msg_len;
+} diag_t;
+
+// diagnostics collected during a run, printed all at once at the end
+// both arrays grow geometrically so adding a diagnostic is amortized O(1)
+typedef struct {
+    diag_t *items;
+    size_t count;
+    size_t cap;
+    char *text;      // text pool for all messages
+    size_t text_len;
+    size_t text_cap;
+    const masm_allocator_t *alloc;
+} diag_list_t;
+
+void diag_init(diag_list_t *list, const masm_allocator_t *alloc);
+void diag_clear(diag_list_t *list);
+void diag_free(diag_list_t *list);
+int diag_add(diag_list_t *list, size_t line, int col, const char *msg, const char *other, int other_len);
+int diag_append(diag_list_t *dst, const diag_list_t *src);
+void diag_print(const diag_list_t *list, const char *file, FILE *fp);
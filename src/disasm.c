@@ -0,0 +1,302 @@
+#include "disasm.h"
+#include "register.h"
+#include "source.h"
+#include <string.h>
+#include <pthread.h>
+
+#define FIELD(name) ((uint32_t) INSTR_##name##_MSK << INSTR_##name##_POS)
+
+// the bits each ParamOrder's operands can set, everything else comes from INSTR_BASE
+static const uint32_t OPERAND_FIELDS[NUM_PARAM_ORDERS] = {
+    [RS]          = FIELD(RS),
+    [RD]          = FIELD(RD),
+    [RD_RS]       = FIELD(RD) | FIELD(RS),
+    [RS_RT]       = FIELD(RS) | FIELD(RT),
+    [RD_RS_RT]    = FIELD(RD) | FIELD(RS) | FIELD(RT),
+    [RD_RT_RS]    = FIELD(RD) | FIELD(RT) | FIELD(RS),
+    [RD_RT_SA]    = FIELD(RD) | FIELD(RT) | FIELD(SHAMT),
+    [LABEL]       = FIELD(TARGET),
+    [RT_RS_IMM]   = FIELD(RT) | FIELD(RS) | FIELD(IMM),
+    [RS_RT_LABEL] = FIELD(RS) | FIELD(RT) | FIELD(IMM),
+    [RS_LABEL]    = FIELD(RS) | FIELD(IMM),
+    [RT_IMM_RS]   = FIELD(RT) | FIELD(IMM) | FIELD(RS),
+    [RT_IMM]      = FIELD(RT) | FIELD(IMM),
+    [NONE]        = 0,
+};
+
+// how a word's opcode picks its slot in DECODE_SLOTS, the slot holds id + 1, or 0 for no instruction
+// opcode 0 is followed by 64 slots picked by funct and opcode 1 by 32 picked by rt, every other
+// opcode has a single slot (a mask of 0), so every word takes the same two loads and no branches
+typedef struct {
+    uint8_t shift;
+    uint8_t mask;
+    uint8_t first;
+} decode_step_t;
+
+#define SLOTS_BY_FUNCT (0)
+#define SLOTS_BY_RT    (SLOTS_BY_FUNCT + INSTR_FUNCT_MSK + 1)
+#define SLOTS_BY_OP    (SLOTS_BY_RT + INSTR_RT_MSK + 1)
+#define NUM_SLOTS      (SLOTS_BY_OP + INSTR_OPCODE_MSK + 1)
+_Static_assert(NUM_SLOTS <= UINT8_MAX + 1 && NUM_INSTR < UINT8_MAX, "decode slots have to fit a byte");
+
+// what decoding needs to know about one instruction, every operand field is masked out of the word
+// by where it goes in the IR, with a 0 mask for the fields the type doesn't have
+typedef struct {
+    uint32_t base;   // constant bits, everything outside the operand fields has to equal them
+    uint32_t check;  // everything outside the operand fields
+    uint32_t target; // J types
+    uint32_t regs;   // rs and rt, R and I types
+    uint32_t imm;    // I types
+    uint32_t low;    // rd and shamt, R types
+} decode_info_t;
+
+// built from INSTR_TABLE the first time anything is decoded
+// DECODE_INFO is indexed by slot value, 0 being a fake instruction that no word matches
+static decode_step_t DECODE_OPCODE[INSTR_OPCODE_MSK + 1];
+static uint8_t DECODE_SLOTS[NUM_SLOTS];
+static decode_info_t DECODE_INFO[NUM_INSTR + 1];
+static pthread_once_t decode_once = PTHREAD_ONCE_INIT;
+
+static void build_decode_tables() {
+    for (int op = 0; op <= INSTR_OPCODE_MSK; op++)
+        DECODE_OPCODE[op] = (decode_step_t) { 0, 0, SLOTS_BY_OP + op };
+    DECODE_OPCODE[0] = (decode_step_t) { INSTR_FUNCT_POS, INSTR_FUNCT_MSK, SLOTS_BY_FUNCT };
+    DECODE_OPCODE[1] = (decode_step_t) { INSTR_RT_POS, INSTR_RT_MSK, SLOTS_BY_RT };
+
+    // no bits checked against a base that isn't 0 never matches
+    DECODE_INFO[0] = (decode_info_t) { .base = 1 };
+
+    for (int i = 0; i < NUM_INSTR; i++) {
+        if (OPCODES[i] == 0)
+            DECODE_SLOTS[SLOTS_BY_FUNCT + FUNCTS[i]] = i + 1;
+        else if (OPCODES[i] == 1)
+            DECODE_SLOTS[SLOTS_BY_RT + ((INSTR_BASE[i] >> INSTR_RT_POS) & INSTR_RT_MSK)] = i + 1;
+        else
+            DECODE_SLOTS[SLOTS_BY_OP + OPCODES[i]] = i + 1;
+
+        uint32_t fields = OPERAND_FIELDS[PARAM_ORDERS[i]];
+        InstrType type = INSTR_TYPES[i];
+        DECODE_INFO[i + 1] = (decode_info_t) {
+            .base = INSTR_BASE[i],
+            .check = ~fields,
+            .target = type == J_TYPE ? fields : 0,
+            .regs = type != J_TYPE ? fields & (FIELD(RS) | FIELD(RT)) : 0,
+            .imm = type == I_TYPE ? fields & FIELD(IMM) : 0,
+            .low = type == R_TYPE ? fields & (FIELD(RD) | FIELD(SHAMT)) : 0,
+        };
+    }
+}
+
+/**
+ * Finds the slot of the instruction word would be, the tables have to be built
+ * The word still has to pass decodes() to actually be that instruction
+ */
+static inline int lookup(uint32_t word) {
+    decode_step_t step = DECODE_OPCODE[word >> INSTR_OPCODE_POS];
+    return DECODE_SLOTS[step.first + ((word >> step.shift) & step.mask)];
+}
+
+static inline int decodes(uint32_t word, const decode_info_t *info) {
+    return (word & info->check) == info->base;
+}
+
+/**
+ * Decodes one word into out, whose id is INVALID if no instruction encodes to it
+ * Returns the id
+ */
+InstrID disasm_decode(uint32_t word, instr_t *out) {
+    pthread_once(&decode_once, build_decode_tables);
+
+    int slot = lookup(word);
+    const decode_info_t *info = &DECODE_INFO[slot];
+
+    memset(out, 0, sizeof(*out));
+    if (!decodes(word, info)) {
+        out->id = INVALID;
+        return INVALID;
+    }
+
+    uint32_t regs = word & info->regs;
+    uint32_t low = word & info->low;
+    out->id = slot - 1;
+    out->target = word & info->target;
+    out->rs = regs >> INSTR_RS_POS;
+    out->rt = (regs >> INSTR_RT_POS) & INSTR_RT_MSK;
+    out->imm = word & info->imm;
+    out->rd = low >> INSTR_RD_POS;
+    out->shamt = (low >> INSTR_SHAMT_POS) & INSTR_SHAMT_MSK;
+    return out->id;
+}
+
+/**
+ * Decodes count words into the first count entries of ir, which has to have room for them
+ * Words that don't decode get id INVALID, a base of 0 and a shamt ir_pack rejects, so packing
+ * them gives 0 back, which no invalid word can be since 0 is sll $0, $0, 0, the other fields
+ * are whatever the closest instruction would have had
+ * line and col aren't filled in, there's no source behind an image
+ * Returns how many words didn't decode
+ */
+size_t disasm_decode_batch(const uint32_t *words, size_t count, ir_batch_t *ir) {
+    pthread_once(&decode_once, build_decode_tables);
+
+    size_t bad = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t word = words[i];
+        int slot = lookup(word);
+        const decode_info_t *info = &DECODE_INFO[slot];
+        int valid = decodes(word, info);
+
+        // the same masks and shifts for every type, so nothing here branches on the word
+        uint32_t regs = word & info->regs;
+        uint32_t low = word & info->low;
+        ir->base[i] = info->base & -(uint32_t) valid;
+        ir->id[i] = valid ? slot - 1 : (uint8_t) INVALID;
+        ir->target[i] = word & info->target;
+        ir->rs[i] = regs >> INSTR_RS_POS;
+        ir->rt[i] = (regs >> INSTR_RT_POS) & INSTR_RT_MSK;
+        ir->imm[i] = word & info->imm;
+        ir->rd[i] = low >> INSTR_RD_POS;
+        ir->shamt[i] = valid ? (low >> INSTR_SHAMT_POS) & INSTR_SHAMT_MSK : IR_SHAMT_MAX + 1;
+        bad += !valid;
+    }
+
+    ir->count = count;
+    return bad;
+}
+
+/**
+ * Decodes count words (in host byte order) a batch at a time and packs them again with ir_pack
+ * On a mismatch *at is the index of the first word that didn't come back and *got what it came back as
+ * Returns 0 if every word round trips bit for bit, -1 if one doesn't or out of memory (*at is count then)
+ */
+int disasm_verify(const uint32_t *words, size_t count, const masm_allocator_t *alloc, size_t *at, uint32_t *got) {
+    ir_batch_t ir;
+    uint32_t packed[DISASM_BATCH];
+
+    ir_init(&ir, alloc);
+    if (ir_grow(&ir, DISASM_BATCH) != 0) {
+        *at = count;
+        *got = 0;
+        return -1;
+    }
+
+    int ret = 0;
+    for (size_t start = 0; start < count && ret == 0; start += DISASM_BATCH) {
+        size_t n = count - start < DISASM_BATCH ? count - start : DISASM_BATCH;
+
+        disasm_decode_batch(words + start, n, &ir);
+        ir_pack(&ir, 0, n, packed);
+
+        // compare the whole batch at once, and only look for the word when something differs
+        if (memcmp(packed, words + start, n * sizeof(uint32_t)) != 0) {
+            size_t i = 0;
+            while (packed[i] == words[start + i])
+                i++;
+            *at = start + i;
+            *got = packed[i];
+            ret = -1;
+        }
+    }
+
+    ir_free(&ir);
+    return ret;
+}
+
+static const char *reg(uint8_t r) {
+    return REGISTERS[r & (NUM_REGS - 1)];
+}
+
+/**
+ * Prints the operands of a decoded instruction at pc the way they'd be written
+ * Branch and jump targets are printed as addresses since there are no labels to go back to
+ */
+static void print_operands(const instr_t *in, uint32_t pc, FILE *fp) {
+    uint32_t branch = pc + 4 + (uint32_t) ((int16_t) in->imm * 4);
+    int logical = in->id == ANDI || in->id == ORI || in->id == XORI;
+
+    switch (PARAM_ORDERS[in->id]) {
+        case RS:          fprintf(fp, "$%s", reg(in->rs)); break;
+        case RD:          fprintf(fp, "$%s", reg(in->rd)); break;
+        case RD_RS:       fprintf(fp, "$%s, $%s", reg(in->rd), reg(in->rs)); break;
+        case RS_RT:       fprintf(fp, "$%s, $%s", reg(in->rs), reg(in->rt)); break;
+        case RD_RS_RT:    fprintf(fp, "$%s, $%s, $%s", reg(in->rd), reg(in->rs), reg(in->rt)); break;
+        case RD_RT_RS:    fprintf(fp, "$%s, $%s, $%s", reg(in->rd), reg(in->rt), reg(in->rs)); break;
+        case RD_RT_SA:    fprintf(fp, "$%s, $%s, %d", reg(in->rd), reg(in->rt), in->shamt); break;
+        case LABEL:       fprintf(fp, "0x%08x", ((pc + 4) & 0xf0000000) | in->target << 2); break;
+        case RS_RT_LABEL: fprintf(fp, "$%s, $%s, 0x%08x", reg(in->rs), reg(in->rt), branch); break;
+        case RS_LABEL:    fprintf(fp, "$%s, 0x%08x", reg(in->rs), branch); break;
+        case RT_IMM_RS:   fprintf(fp, "$%s, %d($%s)", reg(in->rt), (int16_t) in->imm, reg(in->rs)); break;
+        case RT_IMM:      fprintf(fp, "$%s, 0x%x", reg(in->rt), in->imm); break;
+        case RT_RS_IMM:
+            // the logical immediates are zero extended, the rest sign extended
+            if (logical)
+                fprintf(fp, "$%s, $%s, 0x%x", reg(in->rt), reg(in->rs), in->imm);
+            else
+                fprintf(fp, "$%s, $%s, %d", reg(in->rt), reg(in->rs), (int16_t) in->imm);
+            break;
+        case NONE: break;
+    }
+}
+
+/**
+ * Prints a listing of count words (in host byte order) loaded at pc, one instruction per line
+ * Words that aren't an instruction are printed as .word
+ */
+void disasm_print(const uint32_t *words, size_t count, uint32_t pc, FILE *fp) {
+    for (size_t i = 0; i < count; i++, pc += 4) {
+        instr_t in;
+
+        fprintf(fp, "%08x:  %08x  ", pc, words[i]);
+        if (disasm_decode(words[i], &in) == INVALID)
+            fprintf(fp, ".word 0x%08x", words[i]);
+        else {
+            fprintf(fp, PARAM_ORDERS[in.id] == NONE ? "%s" : "%-8s", INSTRUCTIONS[in.id]);
+            print_operands(&in, pc, fp);
+        }
+        fputc('\n', fp);
+    }
+}
+
+/**
+ * Prints a listing of the binary at infile, whose words are in endian order, to outfile (- for stdout)
+ * Returns -1 if it couldn't be read, isn't whole words, or the listing couldn't be written
+ */
+int disassemble_file(const char *infile, const char *outfile, Endian endian) {
+    source_t src;
+    if (source_open(&src, infile) != 0) {
+        printf("Couldn't read %s\n", infile);
+        return -1;
+    }
+
+    if (src.len % sizeof(uint32_t) != 0) {
+        printf("%s isn't a whole number of words\n", infile);
+        source_close(&src);
+        return -1;
+    }
+
+    FILE *fp = strcmp(outfile, "-") == 0 ? stdout : fopen(outfile, "w");
+    if (fp == NULL) {
+        printf("Couldn't write %s\n", outfile);
+        source_close(&src);
+        return -1;
+    }
+
+    // the mapping is read only and may not be aligned for words, so they go through a buffer
+    uint32_t words[DISASM_BATCH];
+    size_t count = src.len / sizeof(uint32_t);
+
+    for (size_t start = 0; start < count; start += DISASM_BATCH) {
+        size_t n = count - start < DISASM_BATCH ? count - start : DISASM_BATCH;
+
+        memcpy(words, src.data + start * sizeof(uint32_t), n * sizeof(uint32_t));
+        if (endian != host_endian())
+            image_bswap(words, n);
+        disasm_print(words, n, start * sizeof(uint32_t), fp);
+    }
+
+    int ret = ferror(fp) ? -1 : 0;
+    if (fp != stdout && fclose(fp) != 0)
+        ret = -1;
+    source_close(&src);
+    return ret;
+}
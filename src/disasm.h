@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "alloc.h"
+#include "image.h"
+#include "instr.h"
+#include "ir.h"
+
+// the decode direction, built from the same INSTR_TABLE as the encoders
+// a word is looked up by opcode in a 64 entry table, opcode 0 goes on to a 64 entry table by funct
+// and opcode 1 (the REGIMM branches) to a 32 entry table by rt, so decoding is at most two loads
+// a word only decodes if its instruction's encoder gives the same word back, so fields the
+// instruction doesn't take have to be 0
+
+// words decoded and repacked at a time by disasm_verify
+#define DISASM_BATCH (4096)
+
+InstrID disasm_decode(uint32_t word, instr_t *out);
+size_t disasm_decode_batch(const uint32_t *words, size_t count, ir_batch_t *ir);
+int disasm_verify(const uint32_t *words, size_t count, const masm_allocator_t *alloc, size_t *at, uint32_t *got);
+void disasm_print(const uint32_t *words, size_t count, uint32_t pc, FILE *fp);
+int disassemble_file(const char *infile, const char *outfile, Endian endian);
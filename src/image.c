@@ -0,0 +1,148 @@
+#include "image.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_X86 1
+#endif
+
+#define IMAGE_INITIAL_WORDS (1024)
+
+// images at least this big are written through a shared mapping instead of write()
+#define IMAGE_MMAP_MIN_BYTES (16 << 20)
+
+void image_init(image_t *image, const masm_allocator_t *alloc) {
+    image->words = NULL;
+    image->count = 0;
+    image->cap = 0;
+    image->alloc = alloc;
+}
+
+void image_free(image_t *image) {
+    mem_free(image->alloc, image->words, image->cap * sizeof(uint32_t));
+    image_init(image, image->alloc);
+}
+
+/**
+ * Makes room for at least min_cap words, growing geometrically
+ */
+int image_grow(image_t *image, size_t min_cap) {
+    if (min_cap <= image->cap)
+        return 0;
+
+    size_t cap = image->cap ? image->cap : IMAGE_INITIAL_WORDS;
+    while (cap < min_cap)
+        cap *= 2;
+
+    uint32_t *words = mem_realloc(image->alloc, image->words, image->cap * sizeof(uint32_t), cap * sizeof(uint32_t));
+    if (words == NULL)
+        return -1;
+
+    image->words = words;
+    image->cap = cap;
+    return 0;
+}
+
+static void bswap_scalar(uint32_t *words, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        words[i] = __builtin_bswap32(words[i]);
+}
+
+#ifdef IMAGE_X86
+__attribute__((target("ssse3")))
+static void bswap_ssse3(uint32_t *words, size_t count) {
+    const __m128i shuf = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (words + i));
+        _mm_storeu_si128((__m128i *) (words + i), _mm_shuffle_epi8(v, shuf));
+    }
+    bswap_scalar(words + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void bswap_avx2(uint32_t *words, size_t count) {
+    const __m256i shuf = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (words + i));
+        _mm256_storeu_si256((__m256i *) (words + i), _mm256_shuffle_epi8(v, shuf));
+    }
+    bswap_scalar(words + i, count - i);
+}
+#endif
+
+/**
+ * Byte swaps count words in place, using the widest vector unit the cpu has
+ */
+void image_bswap(uint32_t *words, size_t count) {
+#ifdef IMAGE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        bswap_avx2(words, count);
+        return;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        bswap_ssse3(words, count);
+        return;
+    }
+#endif
+    bswap_scalar(words, count);
+}
+
+/**
+ * Writes all len bytes, carrying on after short writes
+ * Returns 0 on success, -1 on failure
+ */
+int write_all(int fd, const void *data, size_t len) {
+    const char *buf = data;
+
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Writes len bytes of data to path, "-" is stdout
+ * Small files go out in a single write, big ones through an ftruncate'd shared mapping
+ * Returns 0 on success, -1 on failure
+ */
+int write_file(const char *path, const void *data, size_t bytes) {
+    if (strcmp(path, "-") == 0)
+        return write_all(STDOUT_FILENO, data, bytes);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    int ret = -1;
+    if (bytes >= IMAGE_MMAP_MIN_BYTES && ftruncate(fd, bytes) == 0) {
+        void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (map != MAP_FAILED) {
+            memcpy(map, data, bytes);
+            ret = munmap(map, bytes);
+        }
+    }
+
+    // small image, or the mapping didn't work out
+    if (ret != 0)
+        ret = write_all(fd, data, bytes);
+
+    if (close(fd) != 0)
+        ret = -1;
+    return ret;
+}
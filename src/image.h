@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "alloc.h"
+
+// the assembled text segment, one host order word per instruction
+typedef struct {
+    uint32_t *words;
+    size_t count;
+    size_t cap;
+    const masm_allocator_t *alloc;
+} image_t;
+
+void image_init(image_t *image, const masm_allocator_t *alloc);
+void image_free(image_t *image);
+int image_grow(image_t *image, size_t min_cap);
+
+/**
+ * Appends a word, returns -1 if out of memory
+ */
+static inline int image_push(image_t *image, uint32_t word) {
+    if (image->count == image->cap && image_grow(image, image->count + 1) != 0)
+        return -1;
+
+    image->words[image->count++] = word;
+    return 0;
+}
+
+typedef enum {
+    ENDIAN_LITTLE,
+    ENDIAN_BIG
+} Endian;
+
+static inline Endian host_endian() {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return ENDIAN_BIG;
+#else
+    return ENDIAN_LITTLE;
+#endif
+}
+
+void image_bswap(uint32_t *words, size_t count);
+int write_all(int fd, const void *data, size_t len);
+int write_file(const char *path, const void *data, size_t len);
@@ -1,261 +1,145 @@
 #include "instr.h"
+#include "mnemonic_hash.h"
 #include <string.h>
 #include <stdlib.h>
 
-const char* INSTRUCTIONS[] = {
-    /* R-type */
-    "add",
-    "addu",
-    "and",
-    "break",
-    "div",
-    "divu", 
-    "jalr", 
-    "jr",
-    "mfhi",
-    "mflo",
-    "mthi",
-    "mtlo",
-    "mult",
-    "multu", 
-    "nor",
-    "or",
-    "sll",
-    "sllv",
-    "slt",
-    "sltu",
-    "sra",
-    "srav",
-    "srl",
-    "srlv",
-    "sub",
-    "subu", 
-    "syscall",
-    "xor",
-    /* J-type */
-    "j",
-    "jal",
-    /* I-type */
-    "addi",
-    "addiu",
-    "andi",
-    "beq",
-    "bgez",
-    "bgtz",
-    "blez",
-    "bltz",
-    "bne",
-    "lb",
-    "lbu",
-    "lh",
-    "lhu",
-    "lui",
-    "lw",
-    "lwcl",
-    "ori",
-    "sb",
-    "slti",
-    "sltiu",
-    "sh",
-    "sw",
-    "swcl",
-    "xori"
-};
+// longest mnemonic in INSTRUCTIONS[], anything longer can't be an instruction
+#define MAX_MNEMONIC_LEN (7)
 
-const uint8_t OPCODES[] = {
-    0b000010, /* J */
-    0b000011, /* JAL */
-    0b001000, /* ADDI */
-    0b001001, /* ADDIU */
-    0b001100, /* ANDI */
-    0b000100, /* BEQ */
-    0b000001, /* BGEZ */
-    0b000111, /* BGTZ */
-    0b000110, /* BLEZ */
-    0b000001, /* BLTZ */
-    0b000101, /* BNE */
-    0b100000, /* LB */
-    0b100100, /* LBU */
-    0b100001, /* LH */
-    0b100101, /* LHU */
-    0b001111, /* LUI */
-    0b100011, /* LW */
-    0b110001, /* LWCL */
-    0b001101, /* ORI */
-    0b101000, /* SB */
-    0b001010, /* SLTI */
-    0b001011, /* SLTIU */
-    0b101001, /* SH */
-    0b101011, /* SW */
-    0b111001, /* SWCL */
-    0b001110, /* XORI */
-};
+#define X(id, mnemonic, type, opcode, funct, rt, params) mnemonic,
+const char *INSTRUCTIONS[] = { INSTR_TABLE(X) };
+#undef X
 
-const uint8_t FUNCTS[] = {
-    0b100000, /* ADD */
-    0b100001, /* ADDU */
-    0b100100, /* AND */
-    0b001101, /* BREAK */
-    0b011010, /* DIV */
-    0b011011, /* DIVU */ 
-    0b001001, /* JALR */ 
-    0b001000, /* JR */
-    0b010000, /* MFHI */
-    0b010010, /* MFLO */
-    0b010001, /* MTHI */
-    0b010011, /* MTLO */
-    0b011000, /* MULT */
-    0b011001, /* MULTU */ 
-    0b100111, /* NOR */
-    0b100101, /* OR */
-    0b000000, /* SLL */
-    0b000100, /* SLLV */
-    0b101010, /* SLT */
-    0b101011, /* SLTU */
-    0b000011, /* SRA */
-    0b000111, /* SRAV */
-    0b000010, /* SRL */
-    0b000110, /* SRLV */
-    0b100010, /* SUB */
-    0b100011, /* SUBU */ 
-    0b001100, /* SYSCALL */
-    0b100110, /* XOR */
-};
+#define X(id, mnemonic, type, opcode, funct, rt, params) params,
+const ParamOrder PARAM_ORDERS[] = { INSTR_TABLE(X) };
+#undef X
 
-const ParamOrder PARAM_ORDERS[] = {
-    RD_RS_RT, /* ADD */
-    RD_RS_RT, /* ADDU */
-    RD_RS_RT, /* AND */
-    NONE, /* BREAK */
-    RS_RT, /* DIV */
-    RS_RT, /* DIVU */ 
-    RD_RS, /* JALR */ 
-    RS, /* JR */
-    RD, /* MFHI */
-    RD, /* MFLO */
-    RS, /* MTHI */
-    RS, /* MTLO */
-    RS_RT, /* MULT */
-    RS_RT, /* MULTU */ 
-    RD_RS_RT, /* NOR */
-    RD_RS_RT, /* OR */
-    RD_RT_SA, /* SLL */
-    RD_RT_RS, /* SLLV */
-    RD_RS_RT, /* SLT */
-    RD_RS_RT, /* SLTU */
-    RD_RT_SA, /* SRA */
-    RD_RT_RS, /* SRAV */
-    RD_RT_SA, /* SRL */
-    RD_RT_RS, /* SRLV */
-    RD_RS_RT, /* SUB */
-    RD_RS_RT, /* SUBU */ 
-    NONE, /* SYSCALL */
-    RD_RS_RT, /* XOR */
-    LABEL, /* J */
-    LABEL, /* JAL */
-    RT_RS_IMM, /* ADDI */
-    RT_RS_IMM, /* ADDIU */
-    RT_RS_IMM, /* ANDI */
-    RS_RT_LABEL, /* BEQ */
-    RS_LABEL, /* BGEZ */
-    RS_LABEL, /* BGTZ */
-    RS_LABEL, /* BLEZ */
-    RS_LABEL, /* BLTZ */
-    RS_RT_LABEL, /* BNE */
-    RT_IMM_RS, /* LB */
-    RT_IMM_RS, /* LBU */
-    RT_IMM_RS, /* LH */
-    RT_IMM_RS, /* LHU */
-    RT_IMM, /* LUI */
-    RT_IMM_RS, /* LW */
-    RT_IMM_RS, /* LWCL */
-    RT_RS_IMM, /* ORI */
-    RT_IMM_RS, /* SB */
-    RT_RS_IMM, /* SLTI */
-    RT_RS_IMM, /* SLTIU */
-    RT_IMM_RS, /* SH */
-    RT_IMM_RS, /* SW */
-    RT_IMM_RS, /* SWCL */
-    RT_RS_IMM, /* XORI */
-};
+#define X(id, mnemonic, type, opcode, funct, rt, params) type,
+const uint8_t INSTR_TYPES[] = { INSTR_TABLE(X) };
+#undef X
 
+#define X(id, mnemonic, type, opcode, funct, rt, params) opcode,
+const uint8_t OPCODES[] = { INSTR_TABLE(X) };
+#undef X
+
+#define X(id, mnemonic, type, opcode, funct, rt, params) funct,
+const uint8_t FUNCTS[] = { INSTR_TABLE(X) };
+#undef X
+
+// the bits of a word that only depend on which instruction it is
+#define BASE_WORD(opcode, funct, rt) \
+    (((uint32_t) (opcode) << INSTR_OPCODE_POS) | ((uint32_t) (rt) << INSTR_RT_POS) | ((uint32_t) (funct) << INSTR_FUNCT_POS))
+
+#define X(id, mnemonic, type, opcode, funct, rt, params) BASE_WORD(opcode, funct, rt),
+const uint32_t INSTR_BASE[] = { INSTR_TABLE(X) };
+#undef X
+
+// the operand fields each type fills in
+#define ENCODE_R_TYPE(in) \
+    (((uint32_t) ((in)->rs & INSTR_RS_MSK) << INSTR_RS_POS) | \
+     ((uint32_t) ((in)->rt & INSTR_RT_MSK) << INSTR_RT_POS) | \
+     ((uint32_t) ((in)->rd & INSTR_RD_MSK) << INSTR_RD_POS) | \
+     ((uint32_t) ((in)->shamt & INSTR_SHAMT_MSK) << INSTR_SHAMT_POS))
+#define ENCODE_I_TYPE(in) \
+    (((uint32_t) ((in)->rs & INSTR_RS_MSK) << INSTR_RS_POS) | \
+     ((uint32_t) ((in)->rt & INSTR_RT_MSK) << INSTR_RT_POS) | \
+     ((uint32_t) ((in)->imm & INSTR_IMM_MSK) << INSTR_IMM_POS))
+#define ENCODE_J_TYPE(in) \
+    (((in)->target & INSTR_TARGET_MSK) << INSTR_TARGET_POS)
+
+#define X(id, mnemonic, type, opcode, funct, rt, params) \
+    static uint32_t encode_##id(const instr_t *in) { return BASE_WORD(opcode, funct, rt) | ENCODE_##type(in); }
+INSTR_TABLE(X)
+#undef X
+
+#define X(id, mnemonic, type, opcode, funct, rt, params) encode_##id,
+const instr_encoder_t INSTR_ENCODERS[] = { INSTR_TABLE(X) };
+#undef X
+
+// the table has to line up with the enum and the type bounds, and every field has to fit
+#define X(id, mnemonic, type, opcode, funct, rt, params) \
+    _Static_assert(sizeof(mnemonic) - 1 <= MAX_MNEMONIC_LEN, #id " mnemonic is too long"); \
+    _Static_assert((opcode) <= INSTR_OPCODE_MSK && (funct) <= INSTR_FUNCT_MSK && (rt) <= INSTR_RT_MSK, #id " field out of range"); \
+    _Static_assert((type == R_TYPE) == (id >= R_TYPE_START && id <= R_TYPE_END), #id " is outside the R type bounds"); \
+    _Static_assert((type == I_TYPE) == (id >= I_TYPE_START && id <= I_TYPE_END), #id " is outside the I type bounds"); \
+    _Static_assert((type == J_TYPE) == (id >= J_TYPE_START && id <= J_TYPE_END), #id " is outside the J type bounds"); \
+    _Static_assert(type == R_TYPE || (funct) == 0, #id " has a funct but isn't R type");
+INSTR_TABLE(X)
+#undef X
+
+#define TABLE_LEN(table) (sizeof(table) / sizeof((table)[0]))
+_Static_assert(TABLE_LEN(INSTRUCTIONS) == NUM_INSTR, "INSTRUCTIONS[] doesn't match InstrID");
+_Static_assert(TABLE_LEN(PARAM_ORDERS) == NUM_INSTR, "PARAM_ORDERS[] doesn't match InstrID");
+_Static_assert(TABLE_LEN(INSTR_TYPES) == NUM_INSTR, "INSTR_TYPES[] doesn't match InstrID");
+_Static_assert(TABLE_LEN(OPCODES) == NUM_INSTR, "OPCODES[] doesn't match InstrID");
+_Static_assert(TABLE_LEN(FUNCTS) == NUM_INSTR, "FUNCTS[] doesn't match InstrID");
+_Static_assert(TABLE_LEN(INSTR_BASE) == NUM_INSTR, "INSTR_BASE[] doesn't match InstrID");
+_Static_assert(TABLE_LEN(INSTR_ENCODERS) == NUM_INSTR, "INSTR_ENCODERS[] doesn't match InstrID");
+
+/**
+ * Packs one instruction through its specialized encoder
+ * Returns -1 if the shift amount doesn't fit
+ */
 int64_t pack_instr(const instr_t *instr) {
-    // based on instruction type, pack word differently
-    switch (instr->type) {
-        case R_TYPE:
-            if (instr->shamt > 31) {
-                printf("SHAMT TOO BIG! (%d)", instr->shamt);
-                return -1;
-            }
-            return (
-                ((instr->opcode & INSTR_OPCODE_MSK) << INSTR_OPCODE_POS) | 
-                ((instr->rs & INSTR_RS_MSK) << INSTR_RS_POS) | 
-                ((instr->rt & INSTR_RT_MSK) << INSTR_RT_POS) | 
-                ((instr->rd & INSTR_RD_MSK) << INSTR_RD_POS) | 
-                ((instr->shamt & INSTR_SHAMT_MSK) << INSTR_SHAMT_POS) | 
-                ((instr->funct & INSTR_FUNCT_MSK) << INSTR_FUNCT_POS)
-            );
-            
-        case I_TYPE:
-            return (
-                ((instr->opcode & INSTR_OPCODE_MSK) << INSTR_OPCODE_POS) | 
-                ((instr->rs & INSTR_RS_MSK) << INSTR_RS_POS) | 
-                ((instr->rt & INSTR_RT_MSK) << INSTR_RT_POS) | 
-                ((instr->imm & INSTR_IMM_MSK) << INSTR_IMM_POS)
-            );
+    if (instr->shamt > INSTR_SHAMT_MSK)
+        return -1;
 
-        case J_TYPE:
-            return (
-                ((instr->opcode & INSTR_OPCODE_MSK) << INSTR_OPCODE_POS) | 
-                ((instr->target & INSTR_TARGET_MSK) << INSTR_TARGET_POS)
-            );
-    }
+    return INSTR_ENCODERS[instr->id](instr);
 }
 
+// MNEMONIC_SLOTS holds id + 1 for every occupied slot, 0 for empty ones
+// the table and its seed are generated at build time, the build fails if no seed works
+#include "mnemonic_table.h"
+
+#define X(id, mnemonic, type, opcode, funct, rt, params) sizeof(mnemonic) - 1,
+static const uint8_t MNEMONIC_LENS[] = { INSTR_TABLE(X) };
+#undef X
+_Static_assert(TABLE_LEN(MNEMONIC_LENS) == NUM_INSTR, "MNEMONIC_LENS[] doesn't match InstrID");
+
 /**
- * loop through instructions and try to find str
+ * Look up the len chars at str in the mnemonic hash table
+ * str doesn't need to be null terminated
+ * Costs one hash and at most one compare
  * return the ID if found, invalid (-1) if not
  */
+InstrID find_instr_n(const char *str, size_t len) {
+    if (len == 0 || len > MAX_MNEMONIC_LEN)
+        return INVALID;
+
+    int slot = MNEMONIC_SLOTS[hash_mnemonic(str, len, MNEMONIC_SEED)];
+
+    if (slot == 0)
+        return INVALID;
+
+    InstrID id = slot - 1;
+    if (MNEMONIC_LENS[id] != len || memcmp(str, INSTRUCTIONS[id], len) != 0)
+        return INVALID;
+
+    return id;
+}
+
+
 InstrID find_instr(const char *str) {
-    for (int i = 0; i < NUM_INSTR; i++) {
-        if (strcmp(str, INSTRUCTIONS[i]) == 0)
-            return i;
-    }
-    return INVALID;
+    return find_instr_n(str, strlen(str));
 }
 
 /**
  * Returns the type of an instruction given the id
  */
 InstrType get_type(InstrID id) {
-    if (id >= R_TYPE_START && id <= R_TYPE_END)
-        return R_TYPE;
-    if (id >= I_TYPE_START && id <= I_TYPE_END)
-        return I_TYPE;
-    if (id >= J_TYPE_START && id <= J_TYPE_END)
-        return J_TYPE;
+    return INSTR_TYPES[id];
 }
 
 /**
  * Find opcode based on InstrID
  */
 int get_opcode(InstrID id) {
-    if (get_type(id) == R_TYPE)
-        return 0; // all R-type instructions have opcode 0
-
-    // type must be J_TYPE or I_TYPE
-    // we must subtract out the number of R-type instructions
-    // because J and I type IDs are offset by the number of R type instructions
-    return OPCODES[id - R_TYPE_LEN];
+    return OPCODES[id];
 }
 
 /**
- * Find funct code based on InstrID
+ * Find funct code based on InstrID, 0 for anything but R types
  */
 int get_funct(InstrID id) {
-    if (get_type(id) != R_TYPE)
-        return 0; // all non R-type instructions don't use funct code, just set to zero
-
-    // type must be R-type
     return FUNCTS[id];
-}
\ No newline at end of file
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
+#include "instr_table.h"
 
 typedef enum {
     R_TYPE,
@@ -9,20 +11,6 @@ typedef enum {
     J_TYPE
 } InstrType;
 
-// instruction struct, contains fields for all types of instructions
-// gets packed down to 32 bits by a corresponding type function
-typedef struct {
-    InstrType type;  // type of instruction
-    uint32_t target; // J type
-    uint16_t imm;    // I type
-    uint16_t shamt;  // R type; 16 bits because it's immediate, but throws error if value is over 5 bits
-    uint8_t opcode;  // all types
-    uint8_t funct;   // R type
-    uint8_t rs;      // R type
-    uint8_t rt;      // R type
-    uint8_t rd;      // R type
-} instr_t;
-
 // positions of all register parameters
 #define INSTR_TARGET_POS (0)
 #define INSTR_TARGET_MSK ((1 << 26) - 1)
@@ -41,66 +29,12 @@ typedef struct {
 #define INSTR_SHAMT_POS  (6)
 #define INSTR_SHAMT_MSK  ((1 << 5) - 1)
 
+#define X(id, mnemonic, type, opcode, funct, rt, params) id,
 typedef enum {
-    /* R-type */
     INVALID = -1,
-    ADD,
-    ADDU,
-    AND,
-    BREAK,
-    DIV,
-    DIVU, 
-    JALR, 
-    JR,
-    MFHI,
-    MFLO,
-    MTHI,
-    MTLO,
-    MULT,
-    MULTU, 
-    NOR,
-    OR,
-    SLL,
-    SLLV,
-    SLT,
-    SLTU,
-    SRA,
-    SRAV,
-    SRL,
-    SRLV,
-    SUB,
-    SUBU, 
-    SYSCALL,
-    XOR,
-    /* J-type */
-    J,
-    JAL,
-    /* I-type */
-    ADDI,
-    ADDIU,
-    ANDI,
-    BEQ,
-    BGEZ,
-    BGTZ,
-    BLEZ,
-    BLTZ,
-    BNE,
-    LB,
-    LBU,
-    LH,
-    LHU,
-    LUI,
-    LW,
-    LWCL,
-    ORI,
-    SB,
-    SLTI,
-    SLTIU,
-    SH,
-    SW,
-    SWCL,
-    XORI
+    INSTR_TABLE(X)
 } InstrID;
+#undef X
 
 typedef enum {
     RS,
@@ -121,8 +55,21 @@ typedef enum {
 
 // J Types have one param order, LABEL
 
+// instruction struct, contains fields for all types of instructions
+// opcode, funct and any constant rt bits come from the id, see INSTR_BASE
+typedef struct {
+    InstrID id;
+    uint32_t target; // J type
+    uint16_t imm;    // I type
+    uint16_t shamt;  // R type; 16 bits because it's immediate, but throws error if value is over 5 bits
+    uint8_t rs;      // R type
+    uint8_t rt;      // R type
+    uint8_t rd;      // R type
+} instr_t;
+
 // ID bound #defines
 #define NUM_INSTR (XORI + 1)
+#define NUM_PARAM_ORDERS (NONE + 1)
 #define R_TYPE_START (ADD)
 #define R_TYPE_END (XOR)
 #define R_TYPE_LEN (R_TYPE_END - R_TYPE_START + 1)
@@ -133,15 +80,22 @@ typedef enum {
 #define J_TYPE_END (JAL)
 #define J_TYPE_LEN (J_TYPE_END - J_TYPE_START + 1)
 
-// LUTs
+// LUTs, all indexed by InstrID and generated from INSTR_TABLE
 extern const char *INSTRUCTIONS[];
 extern const ParamOrder PARAM_ORDERS[];
+extern const uint8_t INSTR_TYPES[];
 extern const uint8_t OPCODES[];
 extern const uint8_t FUNCTS[];
+extern const uint32_t INSTR_BASE[]; // opcode, funct and constant rt bits already in place
+
+// one encoder per instruction, ORs the operand fields its type uses onto INSTR_BASE
+typedef uint32_t (*instr_encoder_t)(const instr_t *instr);
+extern const instr_encoder_t INSTR_ENCODERS[];
 
 // Functions
 int64_t pack_instr(const instr_t *instr);
 InstrID find_instr(const char *str);
+InstrID find_instr_n(const char *str, size_t len);
 InstrType get_type(InstrID id);
 int get_opcode(InstrID id);
 int get_funct(InstrID id);
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+// every instruction the assembler knows, the single source for InstrID, INSTRUCTIONS[],
+// OPCODES[], FUNCTS[], PARAM_ORDERS[] and the per-instruction encoders
+// X(id, mnemonic, type, opcode, funct, rt, params)
+// rt is a constant rt field, only the REGIMM branches (opcode 1) use it to pick the condition
+// R types come first, then J, then I, the *_TYPE_START/END bounds in instr.h depend on it
+#define INSTR_TABLE(X) \
+    /* R-type */ \
+    X(ADD,     "add",     R_TYPE, 0b000000, 0b100000, 0, RD_RS_RT) \
+    X(ADDU,    "addu",    R_TYPE, 0b000000, 0b100001, 0, RD_RS_RT) \
+    X(AND,     "and",     R_TYPE, 0b000000, 0b100100, 0, RD_RS_RT) \
+    X(BREAK,   "break",   R_TYPE, 0b000000, 0b001101, 0, NONE) \
+    X(DIV,     "div",     R_TYPE, 0b000000, 0b011010, 0, RS_RT) \
+    X(DIVU,    "divu",    R_TYPE, 0b000000, 0b011011, 0, RS_RT) \
+    X(JALR,    "jalr",    R_TYPE, 0b000000, 0b001001, 0, RD_RS) \
+    X(JR,      "jr",      R_TYPE, 0b000000, 0b001000, 0, RS) \
+    X(MFHI,    "mfhi",    R_TYPE, 0b000000, 0b010000, 0, RD) \
+    X(MFLO,    "mflo",    R_TYPE, 0b000000, 0b010010, 0, RD) \
+    X(MTHI,    "mthi",    R_TYPE, 0b000000, 0b010001, 0, RS) \
+    X(MTLO,    "mtlo",    R_TYPE, 0b000000, 0b010011, 0, RS) \
+    X(MULT,    "mult",    R_TYPE, 0b000000, 0b011000, 0, RS_RT) \
+    X(MULTU,   "multu",   R_TYPE, 0b000000, 0b011001, 0, RS_RT) \
+    X(NOR,     "nor",     R_TYPE, 0b000000, 0b100111, 0, RD_RS_RT) \
+    X(OR,      "or",      R_TYPE, 0b000000, 0b100101, 0, RD_RS_RT) \
+    X(SLL,     "sll",     R_TYPE, 0b000000, 0b000000, 0, RD_RT_SA) \
+    X(SLLV,    "sllv",    R_TYPE, 0b000000, 0b000100, 0, RD_RT_RS) \
+    X(SLT,     "slt",     R_TYPE, 0b000000, 0b101010, 0, RD_RS_RT) \
+    X(SLTU,    "sltu",    R_TYPE, 0b000000, 0b101011, 0, RD_RS_RT) \
+    X(SRA,     "sra",     R_TYPE, 0b000000, 0b000011, 0, RD_RT_SA) \
+    X(SRAV,    "srav",    R_TYPE, 0b000000, 0b000111, 0, RD_RT_RS) \
+    X(SRL,     "srl",     R_TYPE, 0b000000, 0b000010, 0, RD_RT_SA) \
+    X(SRLV,    "srlv",    R_TYPE, 0b000000, 0b000110, 0, RD_RT_RS) \
+    X(SUB,     "sub",     R_TYPE, 0b000000, 0b100010, 0, RD_RS_RT) \
+    X(SUBU,    "subu",    R_TYPE, 0b000000, 0b100011, 0, RD_RS_RT) \
+    X(SYSCALL, "syscall", R_TYPE, 0b000000, 0b001100, 0, NONE) \
+    X(XOR,     "xor",     R_TYPE, 0b000000, 0b100110, 0, RD_RS_RT) \
+    /* J-type */ \
+    X(J,       "j",       J_TYPE, 0b000010, 0b000000, 0, LABEL) \
+    X(JAL,     "jal",     J_TYPE, 0b000011, 0b000000, 0, LABEL) \
+    /* I-type */ \
+    X(ADDI,    "addi",    I_TYPE, 0b001000, 0b000000, 0, RT_RS_IMM) \
+    X(ADDIU,   "addiu",   I_TYPE, 0b001001, 0b000000, 0, RT_RS_IMM) \
+    X(ANDI,    "andi",    I_TYPE, 0b001100, 0b000000, 0, RT_RS_IMM) \
+    X(BEQ,     "beq",     I_TYPE, 0b000100, 0b000000, 0, RS_RT_LABEL) \
+    X(BGEZ,    "bgez",    I_TYPE, 0b000001, 0b000000, 1, RS_LABEL) \
+    X(BGTZ,    "bgtz",    I_TYPE, 0b000111, 0b000000, 0, RS_LABEL) \
+    X(BLEZ,    "blez",    I_TYPE, 0b000110, 0b000000, 0, RS_LABEL) \
+    X(BLTZ,    "bltz",    I_TYPE, 0b000001, 0b000000, 0, RS_LABEL) \
+    X(BNE,     "bne",     I_TYPE, 0b000101, 0b000000, 0, RS_RT_LABEL) \
+    X(LB,      "lb",      I_TYPE, 0b100000, 0b000000, 0, RT_IMM_RS) \
+    X(LBU,     "lbu",     I_TYPE, 0b100100, 0b000000, 0, RT_IMM_RS) \
+    X(LH,      "lh",      I_TYPE, 0b100001, 0b000000, 0, RT_IMM_RS) \
+    X(LHU,     "lhu",     I_TYPE, 0b100101, 0b000000, 0, RT_IMM_RS) \
+    X(LUI,     "lui",     I_TYPE, 0b001111, 0b000000, 0, RT_IMM) \
+    X(LW,      "lw",      I_TYPE, 0b100011, 0b000000, 0, RT_IMM_RS) \
+    X(LWCL,    "lwcl",    I_TYPE, 0b110001, 0b000000, 0, RT_IMM_RS) \
+    X(ORI,     "ori",     I_TYPE, 0b001101, 0b000000, 0, RT_RS_IMM) \
+    X(SB,      "sb",      I_TYPE, 0b101000, 0b000000, 0, RT_IMM_RS) \
+    X(SLTI,    "slti",    I_TYPE, 0b001010, 0b000000, 0, RT_RS_IMM) \
+    X(SLTIU,   "sltiu",   I_TYPE, 0b001011, 0b000000, 0, RT_RS_IMM) \
+    X(SH,      "sh",      I_TYPE, 0b101001, 0b000000, 0, RT_IMM_RS) \
+    X(SW,      "sw",      I_TYPE, 0b101011, 0b000000, 0, RT_IMM_RS) \
+    X(SWCL,    "swcl",    I_TYPE, 0b111001, 0b000000, 0, RT_IMM_RS) \
+    X(XORI,    "xori",    I_TYPE, 0b001110, 0b000000, 0, RT_RS_IMM)
@@ -0,0 +1,228 @@
+#include "ir.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IR_X86 1
+#endif
+
+#define IR_INITIAL_ENTRIES (1024)
+
+// bytes one entry takes across all the arrays
+#define IR_ENTRY_BYTES (3 * sizeof(uint32_t) + 3 * sizeof(uint16_t) + 4 * sizeof(uint8_t))
+
+void ir_init(ir_batch_t *ir, const masm_allocator_t *alloc) {
+    memset(ir, 0, sizeof(*ir));
+    ir->alloc = alloc;
+}
+
+void ir_free(ir_batch_t *ir) {
+    // every array lives in the block base points at
+    mem_free(ir->alloc, ir->base, ir->cap * IR_ENTRY_BYTES);
+    ir_init(ir, ir->alloc);
+}
+
+/**
+ * Makes room for at least min_cap entries, growing geometrically
+ * All the arrays share one allocation, widest first so each one stays aligned
+ */
+int ir_grow(ir_batch_t *ir, size_t min_cap) {
+    if (min_cap <= ir->cap)
+        return 0;
+
+    size_t cap = ir->cap ? ir->cap : IR_INITIAL_ENTRIES;
+    while (cap < min_cap)
+        cap *= 2;
+
+    char *block = mem_alloc(ir->alloc, cap * IR_ENTRY_BYTES);
+    if (block == NULL)
+        return -1;
+
+    ir_batch_t grown = *ir;
+    grown.base   = (uint32_t *) block;
+    grown.target = grown.base + cap;
+    grown.line   = grown.target + cap;
+    grown.imm    = (uint16_t *) (grown.line + cap);
+    grown.shamt  = grown.imm + cap;
+    grown.col    = grown.shamt + cap;
+    grown.id     = (uint8_t *) (grown.col + cap);
+    grown.rs     = grown.id + cap;
+    grown.rt     = grown.rs + cap;
+    grown.rd     = grown.rt + cap;
+    grown.cap    = cap;
+
+    if (ir->count > 0) {
+        size_t n = ir->count;
+        memcpy(grown.base, ir->base, n * sizeof(uint32_t));
+        memcpy(grown.target, ir->target, n * sizeof(uint32_t));
+        memcpy(grown.line, ir->line, n * sizeof(uint32_t));
+        memcpy(grown.imm, ir->imm, n * sizeof(uint16_t));
+        memcpy(grown.shamt, ir->shamt, n * sizeof(uint16_t));
+        memcpy(grown.col, ir->col, n * sizeof(uint16_t));
+        memcpy(grown.id, ir->id, n);
+        memcpy(grown.rs, ir->rs, n);
+        memcpy(grown.rt, ir->rt, n);
+        memcpy(grown.rd, ir->rd, n);
+    }
+
+    mem_free(ir->alloc, ir->base, ir->cap * IR_ENTRY_BYTES);
+    *ir = grown;
+    return 0;
+}
+
+/**
+ * Reads entry i back into an instr_t
+ */
+void ir_get(const ir_batch_t *ir, size_t i, instr_t *instr) {
+    instr->id = ir->id[i];
+    instr->target = ir->target[i];
+    instr->imm = ir->imm[i];
+    instr->shamt = ir->shamt[i];
+    instr->rs = ir->rs[i];
+    instr->rt = ir->rt[i];
+    instr->rd = ir->rd[i];
+}
+
+static size_t pack_scalar(const ir_batch_t *ir, size_t start, size_t count, uint32_t *out) {
+    size_t bad = 0;
+
+    for (size_t i = start; i < start + count; i++) {
+        uint32_t word = ir->base[i] |
+            ((uint32_t) (ir->rs[i] & INSTR_RS_MSK) << INSTR_RS_POS) |
+            ((uint32_t) (ir->rt[i] & INSTR_RT_MSK) << INSTR_RT_POS) |
+            ((uint32_t) (ir->rd[i] & INSTR_RD_MSK) << INSTR_RD_POS) |
+            ((uint32_t) (ir->shamt[i] & INSTR_SHAMT_MSK) << INSTR_SHAMT_POS) |
+            ((uint32_t) ir->imm[i] << INSTR_IMM_POS) |
+            ((ir->target[i] & INSTR_TARGET_MSK) << INSTR_TARGET_POS);
+
+        int valid = ir->shamt[i] <= IR_SHAMT_MAX;
+        out[i - start] = valid ? word : 0;
+        bad += !valid;
+    }
+    return bad;
+}
+
+#ifdef IR_X86
+__attribute__((target("sse2")))
+static inline __m128i load4_u8(const uint8_t *p) {
+    int32_t bytes;
+    memcpy(&bytes, p, sizeof(bytes));
+    __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i load4_u16(const uint16_t *p) {
+    return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) p), _mm_setzero_si128());
+}
+
+__attribute__((target("sse2")))
+static size_t pack_sse2(const ir_batch_t *ir, size_t start, size_t count, uint32_t *out) {
+    const __m128i reg_mask = _mm_set1_epi32(INSTR_RS_MSK);
+    const __m128i target_mask = _mm_set1_epi32(INSTR_TARGET_MSK);
+    const __m128i shamt_max = _mm_set1_epi32(IR_SHAMT_MAX);
+    size_t bad = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        size_t j = start + i;
+        __m128i shamt = load4_u16(ir->shamt + j);
+
+        __m128i word = _mm_loadu_si128((const __m128i *) (ir->base + j));
+        word = _mm_or_si128(word, _mm_slli_epi32(_mm_and_si128(load4_u8(ir->rs + j), reg_mask), INSTR_RS_POS));
+        word = _mm_or_si128(word, _mm_slli_epi32(_mm_and_si128(load4_u8(ir->rt + j), reg_mask), INSTR_RT_POS));
+        word = _mm_or_si128(word, _mm_slli_epi32(_mm_and_si128(load4_u8(ir->rd + j), reg_mask), INSTR_RD_POS));
+        word = _mm_or_si128(word, _mm_slli_epi32(_mm_and_si128(shamt, reg_mask), INSTR_SHAMT_POS));
+        word = _mm_or_si128(word, load4_u16(ir->imm + j));
+        word = _mm_or_si128(word, _mm_and_si128(_mm_loadu_si128((const __m128i *) (ir->target + j)), target_mask));
+
+        // lanes with a shift amount out of range become 0
+        __m128i invalid = _mm_cmpgt_epi32(shamt, shamt_max);
+        _mm_storeu_si128((__m128i *) (out + i), _mm_andnot_si128(invalid, word));
+        bad += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(invalid)));
+    }
+    return bad + pack_scalar(ir, start + i, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load8_u8(const uint8_t *p) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) p));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load8_u16(const uint16_t *p) {
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p));
+}
+
+__attribute__((target("avx2")))
+static size_t pack_avx2(const ir_batch_t *ir, size_t start, size_t count, uint32_t *out) {
+    const __m256i reg_mask = _mm256_set1_epi32(INSTR_RS_MSK);
+    const __m256i target_mask = _mm256_set1_epi32(INSTR_TARGET_MSK);
+    const __m256i shamt_max = _mm256_set1_epi32(IR_SHAMT_MAX);
+    size_t bad = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        size_t j = start + i;
+        __m256i shamt = load8_u16(ir->shamt + j);
+
+        __m256i word = _mm256_loadu_si256((const __m256i *) (ir->base + j));
+        word = _mm256_or_si256(word, _mm256_slli_epi32(_mm256_and_si256(load8_u8(ir->rs + j), reg_mask), INSTR_RS_POS));
+        word = _mm256_or_si256(word, _mm256_slli_epi32(_mm256_and_si256(load8_u8(ir->rt + j), reg_mask), INSTR_RT_POS));
+        word = _mm256_or_si256(word, _mm256_slli_epi32(_mm256_and_si256(load8_u8(ir->rd + j), reg_mask), INSTR_RD_POS));
+        word = _mm256_or_si256(word, _mm256_slli_epi32(_mm256_and_si256(shamt, reg_mask), INSTR_SHAMT_POS));
+        word = _mm256_or_si256(word, load8_u16(ir->imm + j));
+        word = _mm256_or_si256(word, _mm256_and_si256(_mm256_loadu_si256((const __m256i *) (ir->target + j)), target_mask));
+
+        __m256i invalid = _mm256_cmpgt_epi32(shamt, shamt_max);
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_andnot_si256(invalid, word));
+        bad += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(invalid)));
+    }
+    return bad + pack_scalar(ir, start + i, count - i, out + i);
+}
+#endif
+
+static ir_pack_kernel_t kernel;
+static const char *kernel_name;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernel() {
+    kernel = pack_scalar;
+    kernel_name = "scalar";
+#ifdef IR_X86
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = pack_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = pack_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+/**
+ * Packs count entries from start into out with the widest kernel the cpu supports
+ * Returns how many entries failed a range check, their words are left 0
+ */
+size_t ir_pack(const ir_batch_t *ir, size_t start, size_t count, uint32_t *out) {
+    pthread_once(&kernel_once, pick_kernel);
+    return kernel(ir, start, count, out);
+}
+
+const char *ir_pack_kernel_name() {
+    pthread_once(&kernel_once, pick_kernel);
+    return kernel_name;
+}
+
+ir_pack_kernel_t ir_find_pack_kernel(const char *name) {
+    if (strcmp(name, "scalar") == 0)
+        return pack_scalar;
+#ifdef IR_X86
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+        return pack_sse2;
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        return pack_avx2;
+#endif
+    return NULL;
+}
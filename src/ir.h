@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "alloc.h"
+#include "instr.h"
+
+// decoded instructions as parallel arrays, one entry per instruction slot
+// the decoder fills it in, ir_pack encodes a whole run of entries at once, and anything that
+// wants decoded fields (an optimizer, the simulator) can read them without unpacking words
+// fields an instruction's type doesn't use are 0, so every type packs with the same formula
+typedef struct {
+    uint32_t *base;   // INSTR_BASE of the instruction, the constant bits
+    uint32_t *target;
+    uint32_t *line;   // source line of the instruction, for errors found while packing
+    uint16_t *imm;
+    uint16_t *shamt;  // the assembler has range checked it already, ir_pack checks again
+    uint16_t *col;
+    uint8_t *id;      // InstrID
+    uint8_t *rs;
+    uint8_t *rt;
+    uint8_t *rd;
+    size_t count;
+    size_t cap;
+    const masm_allocator_t *alloc;
+} ir_batch_t;
+
+// largest shift amount that fits the shamt field
+#define IR_SHAMT_MAX (31)
+
+void ir_init(ir_batch_t *ir, const masm_allocator_t *alloc);
+void ir_free(ir_batch_t *ir);
+int ir_grow(ir_batch_t *ir, size_t min_cap);
+void ir_get(const ir_batch_t *ir, size_t i, instr_t *instr);
+
+/**
+ * Appends a decoded instruction, returns -1 if out of memory
+ */
+static inline int ir_push(ir_batch_t *ir, const instr_t *instr, uint32_t line, uint16_t col) {
+    if (ir->count == ir->cap && ir_grow(ir, ir->count + 1) != 0)
+        return -1;
+
+    size_t i = ir->count++;
+    ir->base[i] = INSTR_BASE[instr->id];
+    ir->target[i] = instr->target;
+    ir->line[i] = line;
+    ir->imm[i] = instr->imm;
+    ir->shamt[i] = instr->shamt;
+    ir->col[i] = col;
+    ir->id[i] = instr->id;
+    ir->rs[i] = instr->rs;
+    ir->rt[i] = instr->rt;
+    ir->rd[i] = instr->rd;
+    return 0;
+}
+
+// packs count entries starting at start into out, returns how many failed a range check
+// those get a 0 word, the caller can find them again with ir_entry_valid
+typedef size_t (*ir_pack_kernel_t)(const ir_batch_t *ir, size_t start, size_t count, uint32_t *out);
+
+size_t ir_pack(const ir_batch_t *ir, size_t start, size_t count, uint32_t *out);
+const char *ir_pack_kernel_name();
+
+// look a kernel up by name ("scalar", "sse2" or "avx2") so they can be compared
+// returns NULL if this cpu or build can't run it
+ir_pack_kernel_t ir_find_pack_kernel(const char *name);
+
+static inline int ir_entry_valid(const ir_batch_t *ir, size_t i) {
+    return ir->shamt[i] <= IR_SHAMT_MAX;
+}
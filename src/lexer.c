@@ -0,0 +1,83 @@
+#include "lexer.h"
+
+static inline int isblank_char(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// chars that end the mnemonic (or a label definition)
+static inline int isterminator(char c) { return isblank_char(c) || c == '\n' || c == '#' || c == ':'; }
+
+// a word is taken for what its first char says, the lookups have the final word on what it is
+static inline TokenKind word_kind(char c) {
+    if (c == '$')
+        return TOK_REGISTER;
+    if ((c >= '0' && c <= '9') || c == '-' || c == '+')
+        return TOK_INTEGER;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.')
+        return TOK_LABEL;
+    return TOK_ERROR;
+}
+
+/**
+ * Appends a token, returns the new count
+ * Once there's no room left the last token swallows the rest of the line as TOK_ERROR
+ */
+static inline int add_token(token_t *toks, int n, const char *str, const char *end, TokenKind kind) {
+    if (n < MAX_LINE_TOKENS - 1) {
+        toks[n] = (token_t) { str, end - str, kind };
+        return n + 1;
+    }
+    toks[n - 1].len = end - toks[n - 1].str;
+    toks[n - 1].kind = TOK_ERROR;
+    return n;
+}
+
+/**
+ * Tokenizes one statement, p has to be on its first char
+ * A label definition is lexed on its own, so a line is only ever looked at here
+ * After the mnemonic the separators come from the structural bitmap and the words are whatever
+ * is between them, less the blanks at either end, so inside a word no char is looked at
+ * Two words with only blanks between them stay one word, the lookups report it if they fail
+ * toks gets up to MAX_LINE_TOKENS tokens, the last one always TOK_NEWLINE
+ * Returns where lexing stopped: the newline, the '#' of a comment, the end of the buffer, or
+ * just past the ':' of a label definition
+ */
+const char *lex_line(scanner_t *scan, const char *p, token_t *toks) {
+    const char *end = scan->end;
+    const char *q = p;
+    int n = 0;
+
+    while (q < end && !isterminator(*q))
+        q++;
+
+    // a lone ':' names nothing, it's left to be reported as an unknown instruction
+    if (q < end && *q == ':' && q > p) {
+        toks[0] = (token_t) { p, q - p, TOK_LABEL_DEF };
+        toks[1] = (token_t) { q + 1, 0, TOK_NEWLINE };
+        return q + 1;
+    }
+    n = add_token(toks, n, p, q, TOK_MNEMONIC);
+
+    for (;;) {
+        const char *sep = scanner_next(scan, q);
+
+        // ':' only means something after the first word, anywhere else it's part of a word
+        while (sep < end && *sep == ':')
+            sep = scanner_next(scan, sep + 1);
+
+        const char *word = q;
+        const char *word_end = sep;
+        while (word < word_end && isblank_char(*word))
+            word++;
+        while (word_end > word && isblank_char(word_end[-1]))
+            word_end--;
+        if (word < word_end)
+            n = add_token(toks, n, word, word_end, word_kind(*word));
+
+        if (sep >= end || *sep == '\n' || *sep == '#') {
+            toks[n] = (token_t) { sep, 0, TOK_NEWLINE };
+            return sep;
+        }
+
+        n = add_token(toks, n, sep, sep + 1, *sep == ',' ? TOK_COMMA : *sep == '(' ? TOK_LPAREN : TOK_RPAREN);
+        q = sep + 1;
+    }
+}
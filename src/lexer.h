@@ -0,0 +1,29 @@
+#pragma once
+
+#include "scan.h"
+#include <stdint.h>
+
+// tokens of one statement, in order, always ended by TOK_NEWLINE
+typedef enum {
+    TOK_MNEMONIC,  // first word of the statement, anything up to whitespace
+    TOK_REGISTER,  // word starting with '$'
+    TOK_INTEGER,   // word starting with a digit or a sign
+    TOK_LABEL,     // word starting with a letter, '_' or '.', a label reference
+    TOK_LABEL_DEF, // "name:" at the start of a statement, always lexed on its own
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_COMMA,
+    TOK_NEWLINE,   // end of the line, a comment or the end of the buffer
+    TOK_ERROR      // any other word, or the rest of an overlong line
+} TokenKind;
+
+typedef struct {
+    const char *str;
+    uint32_t len;
+    TokenKind kind;
+} token_t;
+
+// longer lines keep their first tokens, everything after is merged into one TOK_ERROR
+#define MAX_LINE_TOKENS (16)
+
+const char *lex_line(scanner_t *scan, const char *p, token_t *toks);
@@ -1,12 +1,233 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
 #include "assemble.h"
+#include "batch.h"
+#include "server.h"
+#include "disasm.h"
+#include "run.h"
+#include "prof.h"
 
-int main() {
-    int ret = assemble("./test.asm", "./test.bin");
+static void usage(const char *name) {
+    printf("Usage: %s [--symbols] [--one-pass] [--endian=big|little] [-j N] [--stats[=json]] [-o output] [input]\n", name);
+    printf("       %s [options] input... | @filelist\n", name);
+    printf("       %s --serve SOCKET [-j N]\n", name);
+    printf("       %s --client SOCKET [options] [input... | @filelist]\n", name);
+    printf("       %s --disasm [--endian=big|little] [-o listing] [binary]\n", name);
+    printf("       %s run [--max-steps N] [--no-blocks] [--trace[=FILE]] [--sample N] [--stats] [-j N] [input... | @filelist]\n", name);
+    printf("       %s prof [-o report] input [trace]\n", name);
+    printf("  -o, --output FILE  write the binary to FILE (default ./test.bin), - for stdout\n");
+    printf("      --symbols      print the symbol table after assembling\n");
+    printf("      --one-pass     read the source once and backpatch forward references\n");
+    printf("      --endian=ORDER byte order of the output, big or little (default little)\n");
+    printf("  -j, --jobs N       split the input across N threads, or with several inputs assemble N at a time\n");
+    printf("      --stats[=FMT]  print phase times and counters to stderr, as text or json\n");
+    printf("      --verify       decode the binary again and check every word re-encodes bit for bit\n");
+    printf("      --disasm       print a listing of a binary (default ./test.bin) instead of assembling\n");
+    printf("      --serve SOCKET run an assembler server on a unix socket, with N workers (default one per CPU)\n");
+    printf("      --client SOCKET send the inputs to the server at SOCKET instead of assembling them here\n");
+    printf("      --max-steps N  with run, stop the program after about N instructions\n");
+    printf("      --no-blocks    with run, interpret the predecoded instructions one at a time instead of\n");
+    printf("                     running translated basic blocks\n");
+    printf("      --trace[=FILE] with run, record every instruction, its word and the register it wrote to\n");
+    printf("                     FILE (default a.trace next to a.asm), one at a time without blocks\n");
+    printf("      --sample N     with run, trace only every Nth instruction\n");
+    printf("run assembles the input in memory (or loads a .bin) and simulates it, with SPIM's syscalls on stdin/stdout\n");
+    printf("With several inputs run takes N at a time, writing each a.asm's output to a.out\n");
+    printf("prof reads the trace of a program (default a.trace) and prints a flat profile by label\n");
+    printf("An input of - streams stdin through a fixed buffer, writing words as soon as they're final\n");
+    printf("  in one pass, so a label can be used at most %d instructions before it's defined\n", MASM_STREAM_MAX_PENDING);
+    printf("With several inputs (or an @filelist with one path per line) each a.asm is written to a.bin\n");
+}
+
+int main(int argc, char **argv) {
+    const char *infile = "./test.asm";
+    const char *outfile = NULL;
+    const char *serve_path = NULL;
+    const char *client_path = NULL;
+    int disasm = 0;
+    int run = 0;
+    int prof = 0;
+    int blocks = 1;
+    unsigned long long max_steps = 0;
+    int trace = 0;
+    const char *trace_path = NULL;
+    unsigned long sample = 0;
+    assemble_opts_t opts = { 0 };
+
+    static const struct option long_opts[] = {
+        { "output",   required_argument, NULL, 'o' },
+        { "symbols",  no_argument,       NULL, 's' },
+        { "one-pass", no_argument,       NULL, '1' },
+        { "endian",   required_argument, NULL, 'e' },
+        { "jobs",     required_argument, NULL, 'j' },
+        { "stats",    optional_argument, NULL, 'S' },
+        { "verify",   no_argument,       NULL, 'V' },
+        { "disasm",   no_argument,       NULL, 'D' },
+        { "serve",    required_argument, NULL, 'L' },
+        { "client",   required_argument, NULL, 'C' },
+        { "max-steps", required_argument, NULL, 'M' },
+        { "no-blocks", no_argument,      NULL, 'B' },
+        { "trace",    optional_argument, NULL, 'T' },
+        { "sample",   required_argument, NULL, 'N' },
+        { "help",     no_argument,       NULL, 'h' },
+        { 0 }
+    };
+
+    // "run" and "prof" are subcommands rather than flags, the rest of the arguments are parsed as usual
+    if (argc > 1 && (strcmp(argv[1], "run") == 0 || strcmp(argv[1], "prof") == 0)) {
+        run = argv[1][0] == 'r';
+        prof = !run;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    int c;
+    while ((c = getopt_long(argc, argv, "o:j:h", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'o': outfile = optarg; break;
+            case 'j': opts.jobs = atoi(optarg); break;
+            case 's': opts.dump_symbols = 1; break;
+            case '1': opts.one_pass = 1; break;
+            case 'e':
+                if (strcmp(optarg, "big") == 0)
+                    opts.endian = ENDIAN_BIG;
+                else if (strcmp(optarg, "little") == 0)
+                    opts.endian = ENDIAN_LITTLE;
+                else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'S':
+                if (optarg == NULL || strcmp(optarg, "text") == 0)
+                    opts.stats = STATS_TEXT;
+                else if (strcmp(optarg, "json") == 0)
+                    opts.stats = STATS_JSON;
+                else {
+                    usage(argv[0]);
+                    return 1;
+                }
+#ifndef MASM_STATS
+                printf("Stats weren't compiled in, rebuild with make STATS=1\n");
+                return 1;
+#endif
+                break;
+            case 'V': opts.verify = 1; break;
+            case 'D': disasm = 1; break;
+            case 'L': serve_path = optarg; break;
+            case 'C': client_path = optarg; break;
+            case 'M': max_steps = strtoull(optarg, NULL, 10); break;
+            case 'B': blocks = 0; break;
+            case 'T': trace = 1; trace_path = optarg; break;
+            case 'N': trace = 1; sample = strtoul(optarg, NULL, 10); break;
+            case 'h': usage(argv[0]); return 0;
+            default:  usage(argv[0]); return 1;
+        }
+    }
+
+    if (serve_path != NULL)
+        return serve(serve_path, &opts) == 0 ? 0 : 1;
+
+    if (disasm)
+        return disassemble_file(optind < argc ? argv[optind] : "./test.bin", outfile != NULL ? outfile : "-", opts.endian) == 0 ? 0 : 1;
+
+    // one plain path keeps the single file behaviour, anything more is a batch
+    int batch = argc - optind > 1 || (optind < argc && argv[optind][0] == '@');
+
+    if (prof) {
+        if (argc - optind > 2) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *prof_trace = argc - optind > 1 ? argv[optind + 1] : NULL;
+        return prof_file(optind < argc ? argv[optind] : infile, prof_trace, outfile, &opts) == 0 ? 0 : 1;
+    }
+
+    if (run) {
+        run_opts_t run_opts = { .max_steps = max_steps, .blocks = blocks, .trace = trace,
+                                .trace_path = trace_path, .sample = sample };
+        if (!batch)
+            return run_file(optind < argc ? argv[optind] : infile, &opts, &run_opts);
+
+        if (trace_path != NULL) {
+            printf("--trace=FILE can't be used with more than one input\n");
+            return 1;
+        }
+
+        file_list_t files;
+        file_list_init(&files);
+        for (int i = optind; i < argc; i++) {
+            if (file_list_add(&files, argv[i]) != 0) {
+                printf("Couldn't read %s\n", argv[i]);
+                file_list_free(&files);
+                return 1;
+            }
+        }
+
+        int ret = run_files(&files, &opts, &run_opts);
+        file_list_free(&files);
+        return ret == 0 ? 0 : 1;
+    }
+
+    if (batch && outfile != NULL) {
+        printf("-o can't be used with more than one input\n");
+        return 1;
+    }
+
+    if (client_path != NULL) {
+        file_list_t files;
+        file_list_init(&files);
+
+        int ret = optind < argc ? 0 : file_list_add(&files, infile);
+        for (int i = optind; i < argc && ret == 0; i++) {
+            ret = file_list_add(&files, argv[i]);
+            if (ret != 0)
+                printf("Couldn't read %s\n", argv[i]);
+        }
+
+        if (ret == 0) {
+            if (!batch && outfile == NULL)
+                outfile = "./test.bin";
+            ret = assemble_client(client_path, &files, outfile, &opts);
+            if (ret == -1 && !batch)
+                fprintf(strcmp(outfile, "-") == 0 ? stderr : stdout, "Assembly error.\n");
+        }
+
+        file_list_free(&files);
+        return ret == 0 ? 0 : 1;
+    }
+
+    if (batch) {
+        file_list_t files;
+        file_list_init(&files);
+        for (int i = optind; i < argc; i++) {
+            if (file_list_add(&files, argv[i]) != 0) {
+                printf("Couldn't read %s\n", argv[i]);
+                file_list_free(&files);
+                return 1;
+            }
+        }
+
+        int ret = assemble_batch(&files, &opts);
+        file_list_free(&files);
+        return ret == 0 ? 0 : 1;
+    }
+
+    if (optind < argc)
+        infile = argv[optind];
+
+    if (outfile == NULL)
+        outfile = "./test.bin";
+
+    int ret = assemble_file(infile, outfile, &opts);
 
     if (ret == -1) {
-        printf("Assembly error.");
+        // stdout may be carrying the binary
+        fprintf(strcmp(outfile, "-") == 0 ? stderr : stdout, "Assembly error.\n");
     }
 
     return ret;
-}
\ No newline at end of file
+}
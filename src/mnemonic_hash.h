@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// mnemonics hash into MNEMONIC_SLOTS_LEN slots, under a seed tools/gen_mnemonics.c picks at build
+// time so every mnemonic in instr_table.h gets a slot of its own, see mnemonic_table.h in the build dir
+#define MNEMONIC_SLOTS_LEN (128)
+
+static inline uint32_t hash_mnemonic(const char *str, size_t len, uint32_t seed) {
+    // FNV-1a, seeded so we can search for a seed that makes it collision-free
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t) str[i]) * 16777619u;
+    return (h ^ (h >> 15)) & (MNEMONIC_SLOTS_LEN - 1);
+}
@@ -0,0 +1,123 @@
+#include "pool.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// a worker's slice of job indices, next in the low half and end in the high half
+// both move in one CAS, so the owner taking from the front and thieves taking from the back never hand out a job twice
+// padded to a cache line so workers don't slow each other down just by taking jobs
+typedef struct {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} queue_t;
+
+typedef struct {
+    queue_t queues[POOL_MAX_WORKERS];
+    int workers;
+    pool_job_fn fn;
+    void *arg;
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    int id;
+} worker_t;
+
+static inline uint64_t pack(uint32_t next, uint32_t end) {
+    return (uint64_t) end << 32 | next;
+}
+
+/**
+ * Takes the job at the front of the worker's own slice
+ * Returns -1 if the slice is empty
+ */
+static int take(queue_t *queue, size_t *job) {
+    uint64_t range = atomic_load_explicit(&queue->range, memory_order_relaxed);
+
+    while (1) {
+        uint32_t next = range, end = range >> 32;
+        if (next >= end)
+            return -1;
+
+        if (atomic_compare_exchange_weak(&queue->range, &range, pack(next + 1, end))) {
+            *job = next;
+            return 0;
+        }
+    }
+}
+
+/**
+ * Moves the back half of some other worker's slice into self's, which has to be empty
+ * Every index is handed out once, so a slice can never go back to a value a thief saw earlier
+ * Returns -1 if every other slice is empty
+ */
+static int steal(pool_t *pool, int self) {
+    for (int i = 1; i < pool->workers; i++) {
+        queue_t *victim = &pool->queues[(self + i) % pool->workers];
+        uint64_t range = atomic_load_explicit(&victim->range, memory_order_relaxed);
+
+        while (1) {
+            uint32_t next = range, end = range >> 32;
+            if (next >= end)
+                break;
+
+            // at least one job, and the victim keeps the front half it's about to work on
+            uint32_t mid = end - (end - next + 1) / 2;
+            if (atomic_compare_exchange_weak(&victim->range, &range, pack(next, mid))) {
+                atomic_store(&pool->queues[self].range, pack(mid, end));
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+static void *run_worker(void *arg) {
+    worker_t *worker = arg;
+    pool_t *pool = worker->pool;
+    queue_t *own = &pool->queues[worker->id];
+    size_t job;
+
+    do {
+        while (take(own, &job) == 0)
+            pool->fn(pool->arg, worker->id, job);
+    } while (steal(pool, worker->id) == 0);
+
+    return NULL;
+}
+
+/**
+ * Runs fn on every job index in [0, count) across workers threads, the calling thread included
+ * Returns once every job has finished, or -1 without running anything if the arguments are out of range
+ */
+int pool_run(size_t count, int workers, pool_job_fn fn, void *arg) {
+    if (workers < 1 || workers > POOL_MAX_WORKERS || count > UINT32_MAX)
+        return -1;
+    if ((size_t) workers > count)
+        workers = count > 0 ? count : 1;
+
+    pool_t pool = { .workers = workers, .fn = fn, .arg = arg };
+
+    for (int i = 0; i < workers; i++)
+        atomic_init(&pool.queues[i].range, pack(count * i / workers, count * (i + 1) / workers));
+
+    pthread_t threads[workers];
+    worker_t args[workers];
+    int started[workers];
+
+    for (int i = 0; i < workers; i++)
+        args[i] = (worker_t) { &pool, i };
+
+    for (int i = 1; i < workers; i++)
+        started[i] = pthread_create(&threads[i], NULL, run_worker, &args[i]) == 0;
+
+    run_worker(&args[0]);
+
+    for (int i = 1; i < workers; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            run_worker(&args[i]); // couldn't get a thread, its slice has been stolen or gets done here
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+// runs a fixed set of independent jobs on a group of threads
+// each worker starts with an even slice of the job indices and works through it front to back,
+// one that runs dry steals the back half of another's slice, so a few slow jobs don't leave
+// the rest of the threads idle
+// fn gets the index of the worker running it, so per-worker state can be kept in an array
+typedef void (*pool_job_fn)(void *arg, int worker, size_t job);
+
+#define POOL_MAX_WORKERS (256)
+
+int pool_run(size_t count, int workers, pool_job_fn fn, void *arg);
@@ -0,0 +1,183 @@
+#include "prof.h"
+#include "batch.h"
+#include "source.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+typedef struct {
+    const char *name;
+    uint32_t pc;
+    size_t id;       // labels at the same address go to the first one seen
+    uint64_t samples;
+} bucket_t;
+
+static int by_pc(const void *a, const void *b) {
+    const bucket_t *x = a, *y = b;
+    if (x->pc != y->pc)
+        return x->pc < y->pc ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static int by_samples(const void *a, const void *b) {
+    const bucket_t *x = a, *y = b;
+    if (x->samples != y->samples)
+        return x->samples > y->samples ? -1 : 1;
+    return by_pc(a, b);
+}
+
+/**
+ * Assembles infile for its image and labels, in host byte order like masm run
+ * Returns -1 after printing why if it doesn't assemble
+ */
+static int assemble_program(masm_ctx_t *ctx, const char *infile, const assemble_opts_t *opts,
+                            const void **image, size_t *image_len) {
+    assemble_opts_t prof_opts = *opts;
+    source_t src;
+
+    if (source_open(&src, infile) != 0) {
+        printf("Couldn't read %s\n", infile);
+        return -1;
+    }
+
+    prof_opts.endian = host_endian();
+    masm_ctx_set_opts(ctx, &prof_opts);
+    int ret = masm_assemble_buffer(ctx, src.data, src.len, image, image_len);
+    masm_print_file_errors(ctx, infile, stdout);
+    source_close(&src);
+    return ret == 0 && masm_error_count(ctx) == 0 ? 0 : -1;
+}
+
+/**
+ * Folds the samples per instruction into buckets, one per label plus one for code before the first
+ * Returns the number of buckets, with the ones that got samples sorted hottest first
+ */
+static size_t fold(const masm_ctx_t *ctx, const uint64_t *samples, size_t count, bucket_t *buckets) {
+    size_t n = 0;
+
+    buckets[n++] = (bucket_t) { "<start>", 0, 0, 0 };
+    for (size_t id = 0; id < masm_symbol_count(ctx); id++) {
+        bucket_t *b = &buckets[n];
+        if (masm_get_symbol(ctx, id, &b->name, &b->pc) == 0) {
+            b->id = id + 1;
+            b->samples = 0;
+            n++;
+        }
+    }
+    qsort(buckets, n, sizeof(bucket_t), by_pc);
+
+    // one bucket per address, the first label seen there, which beats <start>
+    size_t kept = 0;
+    for (size_t i = 1; i < n; i++) {
+        if (buckets[i].pc != buckets[kept].pc)
+            buckets[++kept] = buckets[i];
+        else if (buckets[kept].id == 0)
+            buckets[kept] = buckets[i];
+    }
+    n = kept + 1;
+
+    size_t at = 0;
+    for (size_t i = 0; i < count; i++) {
+        while (at + 1 < n && buckets[at + 1].pc <= i * 4)
+            at++;
+        buckets[at].samples += samples[i];
+    }
+
+    qsort(buckets, n, sizeof(bucket_t), by_samples);
+    return n;
+}
+
+static void print_profile(FILE *fp, const char *infile, const trace_reader_t *trace, uint64_t total,
+                          const bucket_t *buckets, size_t n) {
+    uint64_t sum = 0;
+
+    fprintf(fp, "Flat profile of %s, %llu samples of 1 in %u instructions, %llu instructions run\n",
+            infile, (unsigned long long) total, trace->period, (unsigned long long) trace->steps);
+    fprintf(fp, "%7s %7s %12s %14s  %s\n", "%", "cum %", "samples", "instructions", "label");
+
+    for (size_t i = 0; i < n && buckets[i].samples > 0; i++) {
+        sum += buckets[i].samples;
+        fprintf(fp, "%6.2f%% %6.2f%% %12llu %14llu  %s\n", 100.0 * buckets[i].samples / total, 100.0 * sum / total,
+                (unsigned long long) buckets[i].samples,
+                (unsigned long long) buckets[i].samples * trace->period, buckets[i].name);
+    }
+}
+
+/**
+ * Reads the trace of infile (by default next to it, a.asm to a.trace) and prints the share of
+ * instructions spent under each of its labels to outfile, or stdout if NULL
+ * Returns -1 if the program doesn't assemble, the trace can't be read or was taken from another program
+ */
+int prof_file(const char *infile, const char *trace_path, const char *outfile, const assemble_opts_t *opts) {
+    char default_path[PATH_MAX];
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+    trace_reader_t trace;
+    const void *image;
+    size_t image_len;
+    int ret = -1;
+
+    const char *dot = strrchr(infile, '.');
+    if (dot != NULL && strcmp(dot, ".bin") == 0) {
+        printf("prof needs the source of %s for its labels\n", infile);
+        masm_ctx_destroy(ctx);
+        return -1;
+    }
+
+    if (trace_path == NULL) {
+        if (batch_output_path(infile, ".trace", default_path, sizeof(default_path)) != 0) {
+            printf("%s: path too long\n", infile);
+            masm_ctx_destroy(ctx);
+            return -1;
+        }
+        trace_path = default_path;
+    }
+
+    if (ctx == NULL || assemble_program(ctx, infile, opts, &image, &image_len) != 0) {
+        masm_ctx_destroy(ctx);
+        return -1;
+    }
+    if (trace_reader_open(&trace, trace_path) != 0) {
+        printf("Couldn't read the trace %s\n", trace_path);
+        masm_ctx_destroy(ctx);
+        return -1;
+    }
+
+    uint64_t *samples = calloc(trace.count + 1, sizeof(uint64_t));
+    bucket_t *buckets = malloc((masm_symbol_count(ctx) + 1) * sizeof(bucket_t));
+
+    if (trace.count != image_len / 4 || (image_len > 0 && memcmp(trace.image, image, image_len) != 0))
+        printf("The trace %s wasn't taken of %s as it assembles now\n", trace_path, infile);
+    else if (samples != NULL && buckets != NULL) {
+        trace_record_t rec;
+        uint64_t total = 0;
+        int more;
+
+        while ((more = trace_next(&trace, &rec)) > 0) {
+            if (rec.pc / 4 < trace.count) {
+                samples[rec.pc / 4]++;
+                total++;
+            }
+        }
+
+        FILE *fp = outfile != NULL ? fopen(outfile, "w") : stdout;
+        if (more < 0)
+            printf("The trace %s is cut short or corrupt\n", trace_path);
+        else if (fp == NULL)
+            printf("Couldn't write %s\n", outfile);
+        else {
+            size_t n = fold(ctx, samples, trace.count, buckets);
+            print_profile(fp, infile, &trace, total, buckets, n);
+            ret = 0;
+        }
+        if (fp != NULL && fp != stdout && fclose(fp) != 0)
+            ret = -1;
+    }
+
+    free(samples);
+    free(buckets);
+    trace_reader_close(&trace);
+    masm_ctx_destroy(ctx);
+    return ret;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "assemble.h"
+
+// masm prof, a flat profile of a program from a trace masm run --trace took of it (see trace.h)
+// the program is assembled again for its symbol table, and every recorded instruction is
+// counted against the closest label at or before it, so a label's share is everything from it up
+// to the next one, its own code and none of what it calls
+// sampled traces count each sample as the period of instructions around it
+
+int prof_file(const char *infile, const char *trace_path, const char *outfile, const assemble_opts_t *opts);
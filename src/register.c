@@ -77,16 +77,72 @@ const char* REGISTERS[] = {
 int find_register(const char *str) {
     if (str == NULL)
         return -1;
+    return find_register_n(str, strlen(str));
+}
+
+static inline int isdigit_char(char c) { return c >= '0' && c <= '9'; }
+
+/**
+ * Same as find_register, but looks at exactly len chars of str
+ * str doesn't need to be null terminated
+ * Decodes the name directly instead of searching REGISTERS[]:
+ * numbers are parsed, and every symbolic name is two chars so a switch on both covers them
+ */
+int find_register_n(const char *str, size_t len) {
     // if first character isn't a $, the string is a malformatted register
     // increment str pointer to skip the $
-    if (*str++ != '$')
+    if (len == 0 || *str++ != '$')
         return -1;
+    len--;
+
+    if (len == 0 || len > 2)
+        return -2; // unknown register
+
+    char c0 = str[0];
+    char c1 = len == 2 ? str[1] : '\0';
+
+    // numeric names, $0 to $31 without leading zeros
+    if (isdigit_char(c0)) {
+        if (len == 1)
+            return c0 - '0';
+        if (c0 == '0' || !isdigit_char(c1))
+            return -2;
+
+        int num = (c0 - '0') * 10 + (c1 - '0');
+        return num < NUM_REGS ? num : -2;
+    }
+
+    if (len != 2)
+        return -2;
 
-    // There are 32 regs, but they can be represented by both their
-    // functional names and by their ID. This is why I return the index & 0x1F
-    for (int i = 0; i < NUM_REGS * 2; i++) {
-        if (strcmp(str, REGISTERS[i]) == 0)
-            return i & 0x1F;
+    switch (c0) {
+        case 'a':
+            if (c1 == 't') return 1;
+            if (c1 >= '0' && c1 <= '3') return 4 + (c1 - '0');
+            break;
+        case 'v':
+            if (c1 >= '0' && c1 <= '1') return 2 + (c1 - '0');
+            break;
+        case 't':
+            if (c1 >= '0' && c1 <= '7') return 8 + (c1 - '0');
+            if (c1 >= '8' && c1 <= '9') return 24 + (c1 - '8');
+            break;
+        case 's':
+            if (c1 >= '0' && c1 <= '7') return 16 + (c1 - '0');
+            if (c1 == 'p') return 29;
+            break;
+        case 'k':
+            if (c1 >= '0' && c1 <= '1') return 26 + (c1 - '0');
+            break;
+        case 'g':
+            if (c1 == 'p') return 28;
+            break;
+        case 'f':
+            if (c1 == 'p') return 30;
+            break;
+        case 'r':
+            if (c1 == 'a') return 31;
+            break;
     }
     return -2; // unknown register
-}
\ No newline at end of file
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stddef.h>
+
 #define NUM_REGS (32)
 
 extern const char *REGISTERS[];
 
-int find_register(const char *str);
\ No newline at end of file
+int find_register(const char *str);
+int find_register_n(const char *str, size_t len);
\ No newline at end of file
@@ -0,0 +1,280 @@
+#include "run.h"
+#include "sim.h"
+#include "pool.h"
+#include "image.h"
+#include "source.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// how one program ran, kept until every program is done so the report comes out in input order
+typedef struct {
+    char *text;      // diagnostics, then how the run ended
+    size_t text_len;
+    int failed;      // didn't load, didn't exit, or exited with a non-zero code
+    uint64_t steps;
+} run_result_t;
+
+typedef struct {
+    const file_list_t *files;
+    const assemble_opts_t *opts;
+    const run_opts_t *run;
+    masm_ctx_t *ctxs[POOL_MAX_WORKERS]; // one per worker, reused for every program it takes
+    run_result_t *results;
+} run_batch_t;
+
+static int is_image(const char *path) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    return dot != NULL && (slash == NULL || dot > slash) && strcmp(dot, ".bin") == 0;
+}
+
+/**
+ * Sets sim up with the program at path, assembled with ctx unless it's a .bin image
+ * Diagnostics go to errors, starting with the path if named is set
+ * Returns -1 if it couldn't be read, assembled or loaded
+ */
+static int load_program(sim_t *sim, masm_ctx_t *ctx, const char *path, const assemble_opts_t *opts,
+                        FILE *errors, int named) {
+    source_t src;
+    int ret = -1;
+
+    if (source_open(&src, path) != 0) {
+        fprintf(errors, "Couldn't read %s\n", path);
+        return -1;
+    }
+
+    if (is_image(path)) {
+        // the mapping may not be aligned for words, and the sim wants them in host order
+        uint32_t *words = malloc(src.len ? src.len : 1);
+        size_t count = src.len / sizeof(uint32_t);
+
+        if (src.len % sizeof(uint32_t) != 0)
+            fprintf(errors, "%s isn't a whole number of words\n", path);
+        else if (words != NULL) {
+            memcpy(words, src.data, src.len);
+            if (opts->endian != host_endian())
+                image_bswap(words, count);
+            ret = sim_init(sim, words, count, SIM_DEFAULT_MEMORY);
+        }
+        free(words);
+    } else {
+        // the simulated machine runs in host byte order whatever --endian says
+        assemble_opts_t run_opts = *opts;
+        run_opts.endian = host_endian();
+        masm_ctx_set_opts(ctx, &run_opts);
+
+        const void *image;
+        size_t image_len;
+        if (masm_assemble_buffer(ctx, src.data, src.len, &image, &image_len) == 0)
+            ret = sim_init(sim, image, image_len / sizeof(uint32_t), SIM_DEFAULT_MEMORY);
+
+        if (named)
+            masm_print_file_errors(ctx, path, errors);
+        else
+            masm_print_errors(ctx, errors);
+        if (masm_error_count(ctx) > 0) {
+            fprintf(errors, named ? "%s: assembly error\n" : "Assembly error.\n", path);
+            source_close(&src);
+            return -1;
+        }
+    }
+
+    if (ret != 0)
+        fprintf(errors, "Couldn't load %s\n", path);
+    source_close(&src);
+    return ret;
+}
+
+static SimStatus run_program(sim_t *sim, const run_opts_t *run) {
+    return run->blocks ? sim_run_blocks(sim, run->max_steps) : sim_run(sim, run->max_steps);
+}
+
+/**
+ * Assembles infile in memory (unless it's a .bin image) and runs it on stdin and stdout
+ * Returns the program's exit code, or 1 if it didn't load or didn't exit cleanly
+ */
+int run_file(const char *infile, const assemble_opts_t *opts, const run_opts_t *run) {
+    masm_ctx_t *ctx = masm_ctx_create(NULL);
+    char trace_path[PATH_MAX];
+    sim_t sim;
+    int ret;
+
+    if (ctx == NULL)
+        return 1;
+    if (load_program(&sim, ctx, infile, opts, stderr, 0) != 0) {
+        masm_ctx_destroy(ctx);
+        return 1;
+    }
+
+    // the trace goes next to the input unless it was given somewhere else
+    const char *trace = run->trace_path;
+    if (run->trace && trace == NULL && batch_output_path(infile, ".trace", trace_path, sizeof(trace_path)) == 0)
+        trace = trace_path;
+    if (run->trace) {
+        if (trace == NULL || sim_trace_start(&sim, trace, run->sample) != 0) {
+            fprintf(stderr, "Couldn't write the trace of %s\n", infile);
+            sim_free(&sim);
+            masm_ctx_destroy(ctx);
+            return 1;
+        }
+    }
+
+    uint64_t t0 = stats_now();
+    SimStatus status = run_program(&sim, run);
+    double secs = (stats_now() - t0) / 1e9;
+    fflush(sim.out);
+
+    if (status == SIM_EXIT)
+        ret = sim.exit_code;
+    else {
+        if (status == SIM_BREAK)
+            fprintf(stderr, "Error: 'Break' at 0x%08x\n", sim.pc);
+        else if (status == SIM_LIMIT)
+            fprintf(stderr, "Error: 'Stopped after %llu instructions' at 0x%08x\n", (unsigned long long) sim.steps, sim.pc);
+        else
+            fprintf(stderr, "Error: '%s' at 0x%08x\n", sim.fault, sim.pc);
+        ret = 1;
+    }
+
+    if (opts->stats != STATS_OFF) {
+        fprintf(stderr, "%llu instructions in %.1f ms (%.1f MIPS), %zu KB of memory touched\n",
+                (unsigned long long) sim.steps, secs * 1e3, secs > 0 ? sim.steps / secs / 1e6 : 0, sim.mem_used / 1024);
+        if (run->blocks && !run->trace) {
+            const sim_block_stats_t *b = &sim.block_stats;
+            fprintf(stderr, "blocks: %llu translated, %llu hits, %llu misses, %llu chained, %llu invalidated, %llu flushes\n",
+                    (unsigned long long) b->translated, (unsigned long long) b->hits, (unsigned long long) b->misses,
+                    (unsigned long long) b->chains, (unsigned long long) b->invalidated, (unsigned long long) b->flushes);
+        }
+    }
+
+    if (run->trace && sim_trace_stop(&sim) != 0) {
+        fprintf(stderr, "Couldn't write the trace to %s\n", trace);
+        ret = 1;
+    }
+    sim_free(&sim);
+    masm_ctx_destroy(ctx);
+    return ret;
+}
+
+static void run_job(void *arg, int worker, size_t job) {
+    run_batch_t *batch = arg;
+    const char *in = batch->files->paths[job];
+    run_result_t *res = &batch->results[job];
+    char out[PATH_MAX], trace_path[PATH_MAX];
+    sim_t sim;
+
+    res->failed = 1;
+    FILE *fp = open_memstream(&res->text, &res->text_len);
+    if (fp == NULL)
+        return;
+
+    if (batch_output_path(in, ".out", out, sizeof(out)) != 0
+        || batch_output_path(in, ".trace", trace_path, sizeof(trace_path)) != 0)
+        fprintf(fp, "%s: path too long\n", in);
+    else if (load_program(&sim, batch->ctxs[worker], in, batch->opts, fp, 1) == 0) {
+        FILE *null_in = fopen("/dev/null", "r");
+        FILE *out_fp = fopen(out, "w");
+
+        if (null_in == NULL || out_fp == NULL)
+            fprintf(fp, "%s: couldn't write %s\n", in, out);
+        else if (batch->run->trace && sim_trace_start(&sim, trace_path, batch->run->sample) != 0)
+            fprintf(fp, "%s: couldn't write %s\n", in, trace_path);
+        else {
+            sim.in = null_in;
+            sim.out = out_fp;
+            SimStatus status = run_program(&sim, batch->run);
+            unsigned long long steps = res->steps = sim.steps;
+
+            if (status == SIM_EXIT) {
+                fprintf(fp, "%s: exit %d, %llu instructions\n", in, sim.exit_code, steps);
+                res->failed = sim.exit_code != 0;
+            } else if (status == SIM_BREAK)
+                fprintf(fp, "%s: 'Break' at 0x%08x, %llu instructions\n", in, sim.pc, steps);
+            else if (status == SIM_LIMIT)
+                fprintf(fp, "%s: stopped after %llu instructions at 0x%08x\n", in, steps, sim.pc);
+            else
+                fprintf(fp, "%s: '%s' at 0x%08x, %llu instructions\n", in, sim.fault, sim.pc, steps);
+        }
+
+        if (sim.trace.out != NULL && sim_trace_stop(&sim) != 0 && !res->failed) {
+            fprintf(fp, "%s: couldn't write %s\n", in, trace_path);
+            res->failed = 1;
+        }
+        if (null_in != NULL)
+            fclose(null_in);
+        if (out_fp != NULL && fclose(out_fp) != 0 && !res->failed) {
+            fprintf(fp, "%s: couldn't write %s\n", in, out);
+            res->failed = 1;
+        }
+        sim_free(&sim);
+    }
+
+    fclose(fp);
+}
+
+/**
+ * Runs every program in the list on its own sim, opts->jobs workers at a time
+ * Each program's output goes next to it, see batch_output_path, and how it ended is printed
+ * grouped by program in input order, followed by a summary line
+ * Returns 0 if every program exited with 0, -1 otherwise
+ */
+int run_files(const file_list_t *files, const assemble_opts_t *opts, const run_opts_t *run) {
+    // pool_run starts no more workers than there are programs, the summary line counts what ran
+    int workers = opts->jobs > 1 ? opts->jobs : 1;
+    if (workers > POOL_MAX_WORKERS)
+        workers = POOL_MAX_WORKERS;
+    if ((size_t) workers > files->count)
+        workers = files->count > 0 ? files->count : 1;
+
+    run_batch_t *batch = calloc(1, sizeof(run_batch_t));
+    run_result_t *results = calloc(files->count ? files->count : 1, sizeof(run_result_t));
+    int ret = -1;
+
+    // programs are small and many, so each one is assembled serially and the workers are the parallelism
+    assemble_opts_t file_opts = *opts;
+    file_opts.jobs = 0;
+
+    if (batch != NULL && results != NULL) {
+        batch->files = files;
+        batch->opts = &file_opts;
+        batch->run = run;
+        batch->results = results;
+
+        int ready = 1;
+        for (int i = 0; i < workers && ready; i++) {
+            batch->ctxs[i] = masm_ctx_create(NULL);
+            ready = batch->ctxs[i] != NULL;
+        }
+
+        uint64_t t0 = stats_now();
+        if (ready && pool_run(files->count, workers, run_job, batch) == 0) {
+            double secs = (stats_now() - t0) / 1e9;
+            size_t failed = 0;
+            uint64_t steps = 0;
+
+            for (size_t i = 0; i < files->count; i++) {
+                if (results[i].text != NULL)
+                    fwrite(results[i].text, 1, results[i].text_len, stdout);
+                failed += results[i].failed;
+                steps += results[i].steps;
+            }
+
+            printf("%zu programs, %zu failed, %llu instructions in %.1f ms (%.1f MIPS, %d thread%s)\n",
+                   files->count, failed, (unsigned long long) steps, secs * 1e3,
+                   secs > 0 ? steps / secs / 1e6 : 0, workers, workers == 1 ? "" : "s");
+            ret = failed > 0 ? -1 : 0;
+        }
+
+        for (int i = 0; i < workers; i++)
+            masm_ctx_destroy(batch->ctxs[i]);
+    }
+
+    for (size_t i = 0; results != NULL && i < files->count; i++)
+        free(results[i].text);
+    free(results);
+    free(batch);
+    return ret;
+}
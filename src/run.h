@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include "assemble.h"
+#include "batch.h"
+
+// masm run, assembling programs in memory and simulating them (see sim.h)
+// an input ending in .bin is an image that's already assembled, in --endian byte order
+// with several inputs each runs on its own sim, opts->jobs at a time, with no input and its
+// output written next to it (a.asm to a.out), and how each one ended is reported in input order
+// with trace set each program's run is recorded (see trace.h), by default next to it in a.trace,
+// which masm prof folds into a flat profile by label
+
+typedef struct {
+    uint64_t max_steps; // stop each program after about this many instructions, 0 for no limit
+    int blocks;         // run through the block cache rather than one instruction at a time
+    int trace;          // record an execution trace, which runs one instruction at a time
+    const char *trace_path; // where, with one program, NULL for next to it
+    uint32_t sample;    // record only every sample-th instruction, 0 or 1 for every one
+} run_opts_t;
+
+int run_file(const char *infile, const assemble_opts_t *opts, const run_opts_t *run);
+int run_files(const file_list_t *files, const assemble_opts_t *opts, const run_opts_t *run);
@@ -0,0 +1,135 @@
+#include "scan.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// one bit per byte, set for each structural char
+static const uint8_t STRUCTURAL[256] = {
+    ['\n'] = 1, ['#'] = 1, [','] = 1, [':'] = 1, ['('] = 1, [')'] = 1
+};
+
+static uint64_t scan_block_scalar(const char *block) {
+    uint64_t mask = 0;
+
+    for (int i = 0; i < SCAN_BLOCK; i++)
+        mask |= (uint64_t) STRUCTURAL[(uint8_t) block[i]] << i;
+
+    return mask;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static inline uint32_t match16(__m128i v) {
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('#'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), _mm_cmpeq_epi8(v, _mm_set1_epi8(':'))));
+    // ( and ) are 0x28 and 0x29, so clearing the low bit matches both with one compare
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(~1)), _mm_set1_epi8('(')));
+    return _mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static uint64_t scan_block_sse2(const char *block) {
+    uint64_t m0 = match16(_mm_loadu_si128((const __m128i *) block));
+    uint64_t m1 = match16(_mm_loadu_si128((const __m128i *) (block + 16)));
+    uint64_t m2 = match16(_mm_loadu_si128((const __m128i *) (block + 32)));
+    uint64_t m3 = match16(_mm_loadu_si128((const __m128i *) (block + 48)));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t match32(__m256i v) {
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('#'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':'))));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(~1)), _mm256_set1_epi8('(')));
+    return _mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static uint64_t scan_block_avx2(const char *block) {
+    uint64_t lo = match32(_mm256_loadu_si256((const __m256i *) block));
+    uint64_t hi = match32(_mm256_loadu_si256((const __m256i *) (block + 32)));
+    return lo | (hi << 32);
+}
+
+#endif
+
+static scan_kernel_t kernel;
+static const char *kernel_name;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernel() {
+    kernel = scan_block_scalar;
+    kernel_name = "scalar";
+
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = scan_block_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = scan_block_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+scan_kernel_t scan_get_kernel() {
+    pthread_once(&kernel_once, pick_kernel);
+    return kernel;
+}
+
+const char *scan_kernel_name() {
+    pthread_once(&kernel_once, pick_kernel);
+    return kernel_name;
+}
+
+scan_kernel_t scan_find_kernel(const char *name) {
+    if (strcmp(name, "scalar") == 0)
+        return scan_block_scalar;
+#ifdef SCAN_X86
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+        return scan_block_sse2;
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        return scan_block_avx2;
+#endif
+    return NULL;
+}
+
+void scanner_init(scanner_t *scan, const char *start, const char *end) {
+    scan->start = start;
+    scan->end = end;
+    scan->block = NULL;
+    scan->mask = 0;
+    scan->kernel = scan_get_kernel();
+}
+
+/**
+ * Slow path of scanner_next, scans blocks from the one holding p until a structural char turns up
+ */
+const char *scanner_refill(scanner_t *scan, const char *p) {
+    while (p < scan->end) {
+        const char *block = scan->start + (p - scan->start) / SCAN_BLOCK * SCAN_BLOCK;
+
+        if (scan->end - block >= SCAN_BLOCK)
+            scan->mask = scan->kernel(block);
+        else {
+            // the last partial block gets padded with zeros so the kernel never reads past the end
+            char tail[SCAN_BLOCK] = { 0 };
+            memcpy(tail, block, scan->end - block);
+            scan->mask = scan->kernel(tail);
+        }
+        scan->block = block;
+
+        uint64_t m = scan->mask & (~0ULL << (p - block));
+        if (m != 0)
+            return block + __builtin_ctzll(m);
+
+        p = block + SCAN_BLOCK;
+    }
+    return scan->end;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// structural chars are the ones the tokenizer has to stop at: newline, '#', ',', ':', '(' and ')'
+// a scan kernel turns a 64 byte block into a bitmap with bit i set if byte i is structural
+#define SCAN_BLOCK (64)
+
+typedef uint64_t (*scan_kernel_t)(const char *block);
+
+// the widest kernel this cpu supports, picked by cpuid the first time it's asked for
+scan_kernel_t scan_get_kernel();
+const char *scan_kernel_name();
+
+// look a kernel up by name ("scalar", "sse2" or "avx2") so they can be compared
+// returns NULL if this cpu or build can't run it
+scan_kernel_t scan_find_kernel(const char *name);
+
+// walks the structural chars of a buffer one 64 byte block at a time
+typedef struct {
+    const char *start;  // blocks are 64 byte aligned relative to this
+    const char *end;
+    const char *block;  // block the mask belongs to
+    uint64_t mask;
+    scan_kernel_t kernel;
+} scanner_t;
+
+void scanner_init(scanner_t *scan, const char *start, const char *end);
+const char *scanner_refill(scanner_t *scan, const char *p);
+
+/**
+ * Returns the first structural char at or after p, or end if there isn't one
+ */
+static inline const char *scanner_next(scanner_t *scan, const char *p) {
+    if (p >= scan->block && p < scan->block + SCAN_BLOCK) {
+        uint64_t m = scan->mask & (~0ULL << (p - scan->block));
+        if (m != 0)
+            return scan->block + __builtin_ctzll(m);
+        p = scan->block + SCAN_BLOCK;
+    }
+    return scanner_refill(scan, p);
+}
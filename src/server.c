@@ -0,0 +1,466 @@
+#include "server.h"
+#include "source.h"
+#include "image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define REQUEST_WORDS (4)
+#define REPLY_WORDS (3)
+
+// one per thread, everything in it stays warm from one request to the next
+typedef struct {
+    int listen_fd;
+    masm_ctx_t *ctx;
+    char *buf;      // name, a terminator, then the source of the current request
+    size_t cap;
+} server_worker_t;
+
+/**
+ * Reads exactly len bytes
+ * Returns 1 on success, 0 if the peer hung up before the first byte, -1 on errors or a short read
+ */
+static int read_full(int fd, void *data, size_t len) {
+    char *p = data;
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t n = read(fd, p + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n == 0 && got == 0 ? 0 : -1;
+        got += n;
+    }
+    return 1;
+}
+
+/**
+ * Sends every iovec, the peer hanging up is an error rather than a SIGPIPE
+ * Returns -1 on failure
+ */
+static int send_all(int fd, struct iovec *iov, int count) {
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+
+        // drop whatever went out and carry on from the middle of the iovec it stopped in
+        while (msg.msg_iovlen > 0 && (size_t) n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int send_reply(int fd, ReplyStatus status, const void *image, size_t image_len, const char *text, size_t text_len) {
+    uint32_t head[REPLY_WORDS] = { status, image_len, text_len };
+    struct iovec iov[3] = {
+        { head, sizeof(head) },
+        { (void *) image, image_len },
+        { (void *) text, text_len },
+    };
+    return send_all(fd, iov, 3);
+}
+
+static int reject(int fd, const char *why) {
+    return send_reply(fd, REPLY_BAD, NULL, 0, why, strlen(why));
+}
+
+/**
+ * Assembles one request that's already in the worker's buffer and sends the reply
+ * Returns -1 if the reply couldn't be sent or the request was rejected
+ */
+static int handle_request(server_worker_t *w, int fd, uint32_t flags, uint32_t name_len, uint32_t src_len) {
+    assemble_opts_t opts = {
+        .dump_symbols = (flags & SERVER_SYMBOLS) != 0,
+        .one_pass = (flags & SERVER_ONE_PASS) != 0,
+        .endian = flags & SERVER_BIG_ENDIAN ? ENDIAN_BIG : ENDIAN_LITTLE,
+        .verify = (flags & SERVER_VERIFY) != 0,
+    };
+    masm_ctx_set_opts(w->ctx, &opts);
+
+    const void *image;
+    size_t image_len;
+    int failed = masm_assemble_buffer(w->ctx, w->buf + name_len + 1, src_len, &image, &image_len) != 0;
+
+    if (!failed && image_len > SERVER_MAX_IMAGE) {
+        reject(fd, "Image too big to send");
+        return -1;
+    }
+
+    // most requests are clean, so only those with something to say pay for the text
+    char *text = NULL;
+    size_t text_len = 0;
+    if (masm_error_count(w->ctx) > 0 || opts.dump_symbols) {
+        FILE *fp = open_memstream(&text, &text_len);
+        if (fp == NULL) {
+            reject(fd, "Server out of memory");
+            return -1;
+        }
+
+        masm_print_file_errors(w->ctx, name_len > 0 ? w->buf : NULL, fp);
+        if (opts.dump_symbols)
+            masm_print_symbols(w->ctx, fp);
+        fclose(fp);
+    }
+    if (text_len > SERVER_MAX_TEXT) {
+        free(text);
+        reject(fd, "Diagnostics too big to send");
+        return -1;
+    }
+
+    int ret = send_reply(fd, failed ? REPLY_ERRORS : REPLY_OK, failed ? NULL : image,
+                         failed ? 0 : image_len, text, text_len);
+    free(text);
+    return ret;
+}
+
+/**
+ * Answers requests on a connection until the client hangs up or sends something malformed
+ */
+static void serve_connection(server_worker_t *w, int fd) {
+    while (1) {
+        uint32_t head[REQUEST_WORDS];
+        if (read_full(fd, head, sizeof(head)) != 1)
+            return;
+
+        uint32_t flags = head[1], name_len = head[2], src_len = head[3];
+        if (head[0] != SERVER_MAGIC) {
+            reject(fd, "Not a masm request");
+            return;
+        }
+        if (name_len > SERVER_MAX_NAME || src_len > SERVER_MAX_SOURCE) {
+            reject(fd, "Request too big");
+            return;
+        }
+
+        size_t need = (size_t) name_len + 1 + src_len;
+        if (need > w->cap) {
+            char *buf = realloc(w->buf, need);
+            if (buf == NULL) {
+                reject(fd, "Server out of memory");
+                return;
+            }
+            w->buf = buf;
+            w->cap = need;
+        }
+
+        if (read_full(fd, w->buf, name_len) < 0 || read_full(fd, w->buf + name_len + 1, src_len) < 0)
+            return;
+        w->buf[name_len] = '\0';
+
+        if (handle_request(w, fd, flags, name_len, src_len) != 0)
+            return;
+    }
+}
+
+static void *worker_main(void *arg) {
+    server_worker_t *w = arg;
+    struct timeval idle = { SERVER_IDLE_TIMEOUT, 0 };
+
+    while (1) {
+        int fd = accept(w->listen_fd, NULL, NULL);
+
+        if (fd < 0) {
+            // the listening socket is gone, anything else is the client's problem or passes
+            if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK)
+                return NULL;
+            continue;
+        }
+
+        // reads and writes that wait too long fail, so a quiet client can't hold the worker
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+        serve_connection(w, fd);
+        close(fd);
+    }
+}
+
+/**
+ * Creates a unix socket listening at path, replacing a stale socket left there
+ * Returns the socket, or -1 on failure
+ */
+int server_listen(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // only ever remove a socket, a regular file in the way is a mistake in the path
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Serves connections on listen_fd with workers threads, each with its own context, until the socket is closed
+ * A worker stays with one connection until the client hangs up or goes quiet for SERVER_IDLE_TIMEOUT seconds,
+ * so at most workers clients are served at once
+ * Returns 0 once every worker has stopped, -1 if none could be started
+ */
+int server_run(int listen_fd, int workers) {
+    if (workers < 1)
+        workers = 1;
+
+    server_worker_t *ws = calloc(workers, sizeof(server_worker_t));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    int started = 0;
+
+    for (int i = 0; ws != NULL && threads != NULL && i < workers; i++) {
+        ws[i].listen_fd = listen_fd;
+        ws[i].ctx = masm_ctx_create(NULL);
+        if (ws[i].ctx == NULL)
+            break;
+
+        // the calling thread is worker 0
+        if (i > 0 && pthread_create(&threads[i], NULL, worker_main, &ws[i]) != 0) {
+            masm_ctx_destroy(ws[i].ctx);
+            break;
+        }
+        started++;
+    }
+
+    if (started > 0)
+        worker_main(&ws[0]);
+
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+    for (int i = 0; i < started; i++) {
+        masm_ctx_destroy(ws[i].ctx);
+        free(ws[i].buf);
+    }
+
+    free(threads);
+    free(ws);
+    return started > 0 ? 0 : -1;
+}
+
+static const char *socket_path;
+
+static void stop_serving(int sig) {
+    (void) sig;
+    unlink(socket_path);
+    _exit(0);
+}
+
+/**
+ * Runs the server at path until it's killed, with opts->jobs workers or one per CPU
+ * Returns -1 if it couldn't start
+ */
+int serve(const char *path, const assemble_opts_t *opts) {
+    int workers = opts->jobs;
+    if (workers < 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? cpus : 1;
+    }
+
+    int fd = server_listen(path);
+    if (fd < 0) {
+        printf("Couldn't listen on %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    socket_path = path;
+    signal(SIGINT, stop_serving);
+    signal(SIGTERM, stop_serving);
+
+    printf("Listening on %s with %d worker%s\n", path, workers, workers == 1 ? "" : "s");
+    fflush(stdout);
+
+    int ret = server_run(fd, workers);
+    close(fd);
+    unlink(path);
+    return ret;
+}
+
+/**
+ * Returns a socket connected to the server at path, or -1 on failure
+ */
+int server_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Sends one source to the server on fd and waits for the reply, name can be NULL
+ * reply has to be freed with server_reply_free whatever this returns
+ * Returns 0 if a reply came back (see reply->status), -1 if the connection failed
+ */
+int server_assemble(int fd, const assemble_opts_t *opts, const char *name,
+                    const char *src, size_t len, server_reply_t *reply) {
+    memset(reply, 0, sizeof(*reply));
+
+    size_t name_len = name != NULL ? strlen(name) : 0;
+    if (name_len > SERVER_MAX_NAME || len > SERVER_MAX_SOURCE) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    uint32_t flags = (opts->dump_symbols ? SERVER_SYMBOLS : 0)
+                   | (opts->one_pass ? SERVER_ONE_PASS : 0)
+                   | (opts->endian == ENDIAN_BIG ? SERVER_BIG_ENDIAN : 0)
+                   | (opts->verify ? SERVER_VERIFY : 0);
+    uint32_t head[REQUEST_WORDS] = { SERVER_MAGIC, flags, name_len, len };
+    struct iovec iov[3] = {
+        { head, sizeof(head) },
+        { (void *) name, name_len },
+        { (void *) src, len },
+    };
+
+    if (send_all(fd, iov, 3) != 0)
+        return -1;
+
+    uint32_t answer[REPLY_WORDS];
+    if (read_full(fd, answer, sizeof(answer)) != 1)
+        return -1;
+
+    // never allocate more than a server could have sent
+    if (answer[0] > REPLY_BAD || answer[1] > SERVER_MAX_IMAGE || answer[2] > SERVER_MAX_TEXT) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    reply->status = answer[0];
+    reply->image_len = answer[1];
+    reply->text_len = answer[2];
+    reply->image = malloc(reply->image_len ? reply->image_len : 1);
+    reply->text = malloc(reply->text_len + 1);
+    if (reply->image == NULL || reply->text == NULL)
+        return -1;
+
+    if (read_full(fd, reply->image, reply->image_len) < 0 || read_full(fd, reply->text, reply->text_len) < 0)
+        return -1;
+    reply->text[reply->text_len] = '\0';
+    return 0;
+}
+
+void server_reply_free(server_reply_t *reply) {
+    free(reply->image);
+    free(reply->text);
+    memset(reply, 0, sizeof(*reply));
+}
+
+/**
+ * Assembles one input through the server, writing the image to out
+ * Returns 0 on success, -1 if it failed to assemble, -2 if the connection is no good any more
+ */
+static int client_file(int fd, const char *in, const char *out, const char *name, const assemble_opts_t *opts, FILE *msgs) {
+    source_t src;
+    server_reply_t reply;
+
+    if (source_open(&src, in) != 0) {
+        fprintf(msgs, "%s: couldn't read the file\n", in);
+        return -1;
+    }
+
+    int ret = server_assemble(fd, opts, name, src.data, src.len, &reply);
+    source_close(&src);
+
+    if (ret != 0) {
+        fprintf(msgs, "%s: lost the server: %s\n", in, strerror(errno));
+        ret = -2;
+    } else if (reply.status == REPLY_BAD) {
+        fprintf(msgs, "%s: the server refused it: %s\n", in, reply.text);
+        ret = -2;
+    } else {
+        fwrite(reply.text, 1, reply.text_len, msgs);
+        if (reply.status != REPLY_OK)
+            ret = -1;
+        else if (write_file(out, reply.image, reply.image_len) != 0) {
+            fprintf(msgs, "%s: couldn't write %s\n", in, out);
+            ret = -1;
+        }
+    }
+
+    server_reply_free(&reply);
+    return ret;
+}
+
+/**
+ * Assembles every file through the server at path, over one connection
+ * With an outfile there has to be one input, without one each goes next to its input like a batch
+ * Returns 0 if every file assembled, -1 otherwise
+ */
+int assemble_client(const char *path, const file_list_t *files, const char *outfile, const assemble_opts_t *opts) {
+    int fd = server_connect(path);
+    if (fd < 0) {
+        printf("Couldn't connect to %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int single = outfile != NULL;
+    FILE *msgs = single && strcmp(outfile, "-") == 0 ? stderr : stdout;
+    int ret = 0;
+
+    for (size_t i = 0; i < files->count; i++) {
+        const char *in = files->paths[i];
+        char path_buf[PATH_MAX];
+        const char *out = path_buf;
+
+        if (single)
+            out = outfile;
+        else if (batch_output_path(in, ".bin", path_buf, sizeof(path_buf)) != 0) {
+            fprintf(msgs, "%s: path too long\n", in);
+            ret = -1;
+            continue;
+        }
+
+        int res = client_file(fd, in, out, single ? NULL : in, opts, msgs);
+        if (res != 0)
+            ret = -1;
+        if (res == -2)
+            break;
+    }
+
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "assemble.h"
+#include "batch.h"
+
+// wire format over a unix socket, every field is a uint32_t in host byte order since both ends
+// are on the same machine, and a connection carries any number of requests one after another
+// request:  magic, flags, name length, source length, then the name and the source
+// response: status, image length, text length, then the image and the text
+// the name only prefixes the diagnostics, it can be empty
+// a worker serves one connection at a time, so it hangs up on a client that leaves it waiting
+// for the next read or write for longer than SERVER_IDLE_TIMEOUT seconds
+#define SERVER_MAGIC (0x4d53414d)
+#define SERVER_MAX_SOURCE ((uint32_t) 256 << 20)
+#define SERVER_MAX_NAME (4096)
+// an instruction and its newline take at least 4 bytes of source, the last one may not have a newline
+#define SERVER_MAX_IMAGE (SERVER_MAX_SOURCE + 4)
+#define SERVER_MAX_TEXT ((uint32_t) 512 << 20)
+#define SERVER_IDLE_TIMEOUT (10)
+
+// request flags, the rest of the options are the server's
+enum {
+    SERVER_SYMBOLS    = 1 << 0,
+    SERVER_ONE_PASS   = 1 << 1,
+    SERVER_BIG_ENDIAN = 1 << 2,
+    SERVER_VERIFY     = 1 << 3,
+};
+
+typedef enum {
+    REPLY_OK,       // assembled, image holds the binary
+    REPLY_ERRORS,   // the source had errors, see text
+    REPLY_BAD,      // the request itself was rejected and the server hung up
+} ReplyStatus;
+
+typedef struct {
+    ReplyStatus status;
+    void *image;
+    size_t image_len;
+    char *text;     // diagnostics, then the symbol table if asked for
+    size_t text_len;
+} server_reply_t;
+
+int server_listen(const char *path);
+int server_run(int listen_fd, int workers);
+int serve(const char *path, const assemble_opts_t *opts);
+
+int server_connect(const char *path);
+int server_assemble(int fd, const assemble_opts_t *opts, const char *name,
+                    const char *src, size_t len, server_reply_t *reply);
+void server_reply_free(server_reply_t *reply);
+int assemble_client(const char *path, const file_list_t *files, const char *outfile, const assemble_opts_t *opts);
@@ -0,0 +1,1049 @@
+#include "sim.h"
+#include "disasm.h"
+#include <stdlib.h>
+#include <string.h>
+
+// pseudo instructions the predecoder puts in, after the real ones so ops stay InstrIDs
+enum {
+    SIM_OP_INVALID = NUM_INSTR, // a word that isn't an instruction
+    SIM_OP_END,                 // one past the image, running into it ends the program
+    SIM_OP_BAD_TARGET,          // where branches and jumps outside the image go
+    SIM_NUM_OPS
+};
+
+#define REG_V0 (2)
+#define REG_A0 (4)
+#define REG_A1 (5)
+#define REG_GP (28)
+#define REG_SP (29)
+#define REG_RA (31)
+
+/**
+ * Which register an instruction writes, from its ParamOrder
+ */
+static int dest_reg(const instr_t *in) {
+    switch (in->id) {
+        case SB: case SH: case SW: case SWCL: case LWCL:
+            return -1; // rt is a source, or an fpr
+        case JAL:
+            return REG_RA;
+        default:
+            break;
+    }
+
+    switch (PARAM_ORDERS[in->id]) {
+        case RD: case RD_RS: case RD_RS_RT: case RD_RT_RS: case RD_RT_SA:
+            return in->rd;
+        case RT_RS_IMM: case RT_IMM: case RT_IMM_RS:
+            return in->rt;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Instruction index a jump or branch at index i goes to, or the bad target sentinel
+ */
+static uint32_t target_index(const instr_t *in, size_t i, size_t count) {
+    int64_t target;
+
+    if (PARAM_ORDERS[in->id] == LABEL)
+        target = ((((uint64_t) i * 4 + 4) & 0xf0000000) | (uint64_t) in->target << 2) / 4;
+    else
+        target = (int64_t) i + 1 + (int16_t) in->imm;
+
+    // the end sentinel is a fine place to branch to, it just ends the program
+    if (target < 0 || (uint64_t) target > count)
+        return count + 1;
+    return target;
+}
+
+/**
+ * Decodes word, instruction i of count, into out
+ */
+static void decode_word(uint32_t word, size_t i, size_t count, sim_instr_t *out) {
+    instr_t in;
+
+    memset(out, 0, sizeof(*out));
+    if (disasm_decode(word, &in) == INVALID) {
+        out->op = SIM_OP_INVALID;
+        return;
+    }
+
+    int dest = dest_reg(&in);
+    out->op = in.id;
+    out->dest = dest <= 0 ? SIM_SINK : dest;
+    out->rs = in.rs;
+    out->rt = in.rt;
+
+    switch (PARAM_ORDERS[in.id]) {
+        case RD_RT_SA:
+            out->imm = in.shamt;
+            break;
+        case LABEL: case RS_RT_LABEL: case RS_LABEL:
+            out->imm = target_index(&in, i, count);
+            break;
+        case RT_IMM:
+            out->imm = (uint32_t) in.imm << 16; // lui
+            break;
+        default:
+            // the logical immediates are zero extended, everything else sign extended
+            if (in.id == ANDI || in.id == ORI || in.id == XORI)
+                out->imm = in.imm;
+            else
+                out->imm = (int32_t) (int16_t) in.imm;
+            break;
+    }
+}
+
+/**
+ * Decodes every word once into code, which has room for count + 2
+ */
+static void predecode(const uint32_t *words, size_t count, sim_instr_t *code) {
+    for (size_t i = 0; i < count; i++)
+        decode_word(words[i], i, count, &code[i]);
+
+    code[count] = (sim_instr_t) { .op = SIM_OP_END };
+    code[count + 1] = (sim_instr_t) { .op = SIM_OP_BAD_TARGET };
+}
+
+#define L1_INDEX(addr)    ((addr) >> (SIM_PAGE_SHIFT + SIM_L2_SHIFT))
+#define L2_INDEX(addr)    (((addr) >> SIM_PAGE_SHIFT) & (SIM_L2_ENTRIES - 1))
+#define PAGE_OFFSET(addr) ((addr) & (SIM_PAGE_SIZE - 1))
+
+// what every untouched page and second level table is, never written through
+static const uint8_t ZERO_PAGE[SIM_PAGE_SIZE];
+static const sim_l2_t ZERO_L2 = { .pages = { [0 ... SIM_L2_ENTRIES - 1] = (uint8_t *) ZERO_PAGE } };
+
+/**
+ * Where addr is for reading, untouched memory reads as zeroes from the shared zero page
+ */
+static inline const uint8_t *mem_read(const sim_t *sim, uint32_t addr) {
+    return sim->l1[L1_INDEX(addr)]->pages[L2_INDEX(addr)] + PAGE_OFFSET(addr);
+}
+
+/**
+ * Gives the page addr is in one of its own, zeroed, from the pool
+ * Returns NULL if that would go past mem_limit or out of memory
+ */
+static uint8_t *touch_page(sim_t *sim, uint32_t addr) {
+    sim_l2_t **l2 = &sim->l1[L1_INDEX(addr)];
+
+    if (sim->mem_used + SIM_PAGE_SIZE > sim->mem_limit)
+        return NULL;
+    if (*l2 == &ZERO_L2) {
+        sim_l2_t *table = arena_alloc(&sim->page_pool, sizeof(sim_l2_t));
+        if (table == NULL)
+            return NULL;
+        memcpy(table, &ZERO_L2, sizeof(sim_l2_t));
+        *l2 = table;
+    }
+
+    uint8_t *page = arena_alloc(&sim->page_pool, SIM_PAGE_SIZE);
+    if (page == NULL)
+        return NULL;
+    memset(page, 0, SIM_PAGE_SIZE);
+    (*l2)->pages[L2_INDEX(addr)] = page;
+    sim->mem_used += SIM_PAGE_SIZE;
+    return page;
+}
+
+/**
+ * Where addr is for writing, its page is touched on the first store
+ * Returns NULL if it can't be
+ */
+static inline uint8_t *mem_write(sim_t *sim, uint32_t addr) {
+    uint8_t *page = sim->l1[L1_INDEX(addr)]->pages[L2_INDEX(addr)];
+
+    if (page == ZERO_PAGE && (page = touch_page(sim, addr)) == NULL)
+        return NULL;
+    return page + PAGE_OFFSET(addr);
+}
+
+/**
+ * Loads count words at address 0 and gets ready to run from there
+ * $sp starts at SIM_STACK_TOP, $ra at the end of the image so returning from the top ends the program
+ * Returns -1 if out of memory or the image doesn't fit in mem_limit
+ */
+int sim_init(sim_t *sim, const uint32_t *words, size_t count, size_t mem_limit) {
+    memset(sim, 0, sizeof(*sim));
+    arena_init(&sim->block_arena, &MASM_DEFAULT_ALLOCATOR);
+    arena_init(&sim->page_pool, &MASM_DEFAULT_ALLOCATOR);
+    for (uint32_t i = 0; i < SIM_L1_ENTRIES; i++)
+        sim->l1[i] = (sim_l2_t *) &ZERO_L2;
+
+    if (count * 4 > mem_limit || count * 4 >= SIM_STACK_TOP)
+        return -1;
+
+    sim->code = malloc((count + 2) * sizeof(sim_instr_t));
+    if (sim->code == NULL)
+        return -1;
+    predecode(words, count, sim->code);
+
+    sim->count = count;
+    sim->mem_limit = mem_limit;
+    for (size_t done = 0; done < count * 4; ) {
+        size_t chunk = count * 4 - done < SIM_PAGE_SIZE ? count * 4 - done : SIM_PAGE_SIZE;
+        uint8_t *page = mem_write(sim, done);
+        if (page == NULL) {
+            sim_free(sim);
+            return -1;
+        }
+        memcpy(page, (const uint8_t *) words + done, chunk);
+        done += chunk;
+    }
+
+    sim->brk = (count * 4 + 7) & ~(size_t) 7;
+    sim->regs[REG_GP] = sim->brk;
+    sim->regs[REG_SP] = SIM_STACK_TOP;
+    sim->regs[REG_RA] = count * 4;
+    sim->in = stdin;
+    sim->out = stdout;
+    return 0;
+}
+
+void sim_free(sim_t *sim) {
+    sim_trace_stop(sim);
+    free(sim->code);
+    free(sim->blocks);
+    free(sim->live_pages);
+    arena_free(&sim->block_arena);
+    arena_free(&sim->page_pool);
+    sim->code = NULL;
+    sim->blocks = NULL;
+    sim->live_pages = NULL;
+}
+
+// fmt takes at most the one value
+static void set_fault(sim_t *sim, const char *fmt, uint32_t value) {
+    snprintf(sim->fault, sizeof(sim->fault), fmt, value);
+}
+
+/**
+ * Drops every block that starts in page
+ */
+static void drop_page(sim_t *sim, size_t page) {
+    size_t end = (page + 1) * SIM_PAGE_WORDS;
+
+    for (size_t i = page * SIM_PAGE_WORDS; i < end && i <= sim->count; i++) {
+        if (sim->blocks[i] != NULL) {
+            // anything still linked to it lands on the stale handler, which looks again
+            sim->blocks[i]->ops[0].handler = sim->stale_handler;
+            sim->blocks[i]->dead = 1;
+            sim->blocks[i] = NULL;
+            sim->block_stats.invalidated++;
+        }
+    }
+    sim->live_pages[page] = 0;
+}
+
+/**
+ * Called after len bytes at addr were written somewhere in the image
+ * Decodes the words it touched again, and drops the blocks on their pages
+ */
+static void code_write(sim_t *sim, uint32_t addr, uint32_t len) {
+    size_t end = ((size_t) addr + len + 3) / 4;
+
+    if (end > sim->count)
+        end = sim->count;
+    for (size_t i = addr / 4; i < end; i++) {
+        uint32_t word;
+        memcpy(&word, mem_read(sim, i * 4), 4);
+        decode_word(word, i, sim->count, &sim->code[i]);
+
+        size_t page = i / SIM_PAGE_WORDS;
+        if (sim->live_pages != NULL && sim->live_pages[page])
+            drop_page(sim, page);
+    }
+}
+
+/**
+ * The SPIM syscalls that don't need a file system, picked by $v0
+ * Returns 0 to carry on, 1 if the program exited, -1 on a fault
+ */
+static int do_syscall(sim_t *sim) {
+    uint32_t *regs = sim->regs;
+    uint32_t a0 = regs[REG_A0];
+
+    switch (regs[REG_V0]) {
+        case 1: // print_int
+            fprintf(sim->out, "%d", (int32_t) a0);
+            return 0;
+        case 4: { // print_string, a page at a time, it ends at the latest on an untouched page
+            for (uint32_t addr = a0; ; ) {
+                const uint8_t *p = mem_read(sim, addr);
+                uint32_t room = SIM_PAGE_SIZE - PAGE_OFFSET(addr);
+                const uint8_t *end = memchr(p, '\0', room);
+
+                fwrite(p, 1, end != NULL ? (size_t) (end - p) : room, sim->out);
+                if (end != NULL)
+                    return 0;
+                addr += room;
+                if (addr == 0) {
+                    set_fault(sim, "Unterminated string at 0x%08x", a0);
+                    return -1;
+                }
+            }
+        }
+        case 5: { // read_int
+            int value = 0;
+            if (fscanf(sim->in, "%d", &value) != 1)
+                value = 0;
+            regs[REG_V0] = value;
+            return 0;
+        }
+        case 8: { // read_string, at most a1 - 1 chars and a terminator, like fgets
+            uint32_t len = regs[REG_A1];
+            uint32_t n = 0;
+            int c = 0;
+            uint8_t *p;
+
+            if (len == 0)
+                return 0;
+            while (n + 1 < len && c != '\n' && (c = fgetc(sim->in)) != EOF) {
+                if ((p = mem_write(sim, a0 + n)) == NULL)
+                    break;
+                *p = c;
+                n++;
+            }
+            if ((p = mem_write(sim, a0 + n)) == NULL) {
+                set_fault(sim, "Out of memory reading a string to 0x%08x", a0);
+                return -1;
+            }
+            *p = '\0';
+            if (a0 < sim->count * 4)
+                code_write(sim, a0, n + 1);
+            return 0;
+        }
+        case 9: { // sbrk, the heap can grow up to the stack pointer
+            uint32_t start = sim->brk;
+            uint64_t end = ((uint64_t) start + a0 + 7) & ~(uint64_t) 7;
+            if (end > regs[REG_SP]) {
+                set_fault(sim, "Out of memory for sbrk of %u bytes", a0);
+                return -1;
+            }
+            sim->brk = end;
+            regs[REG_V0] = start;
+            return 0;
+        }
+        case 10: // exit
+            sim->exit_code = 0;
+            return 1;
+        case 11: // print_char
+            fputc(a0 & 0xff, sim->out);
+            return 0;
+        case 12: { // read_char
+            int c = fgetc(sim->in);
+            regs[REG_V0] = c == EOF ? 0 : c;
+            return 0;
+        }
+        case 17: // exit2
+            sim->exit_code = a0;
+            return 1;
+        default:
+            set_fault(sim, "Unknown syscall %u", regs[REG_V0]);
+            return -1;
+    }
+}
+
+// what the handlers share, ip is the op being run and code_bytes the end of the image
+#define R(n)   (regs[n])
+#define SR(n)  ((int32_t) regs[n])
+#define DEST   (regs[ip->dest])
+#define ADDR   (regs[ip->rs] + ip->imm)
+
+#define LOAD(type, size) do { \
+        uint32_t a = ADDR; type v; \
+        if ((a & (size - 1)) != 0) { what = "Unaligned load from 0x%08x"; value = a; goto fault; } \
+        memcpy(&v, mem_read(sim, a), size); \
+        DEST = v; \
+    } while (0)
+
+// each run loop says what happens after a store into the image with AFTER_CODE_WRITE
+#define STORE(type, size, from) do { \
+        uint32_t a = ADDR; type v = (from); uint8_t *p; \
+        if ((a & (size - 1)) != 0) { what = "Unaligned store to 0x%08x"; value = a; goto fault; } \
+        if ((p = mem_write(sim, a)) == NULL) { what = "Out of memory storing to 0x%08x"; value = a; goto fault; } \
+        memcpy(p, &v, size); \
+        if (a < code_bytes) { code_write(sim, a, size); AFTER_CODE_WRITE; } \
+    } while (0)
+
+#define OVERFLOW_CHECK(op, a, b) do { \
+        int32_t res; \
+        if (op(a, b, &res)) { what = "Arithmetic overflow"; goto fault; } \
+        DEST = res; \
+    } while (0)
+
+// every instruction that carries on with the next one, both run loops expand these into
+// op_<id>: body; NEXT();
+// div by zero is undefined on MIPS, it just doesn't trap here and leaves hi and lo alone
+#define SIM_SIMPLE_OPS(X) \
+    X(ADD,   OVERFLOW_CHECK(__builtin_add_overflow, SR(ip->rs), SR(ip->rt))) \
+    X(ADDU,  DEST = R(ip->rs) + R(ip->rt)) \
+    X(AND,   DEST = R(ip->rs) & R(ip->rt)) \
+    X(DIV,   if (R(ip->rt) != 0 && !(SR(ip->rs) == INT32_MIN && SR(ip->rt) == -1)) { \
+                 sim->lo = SR(ip->rs) / SR(ip->rt); \
+                 sim->hi = SR(ip->rs) % SR(ip->rt); \
+             }) \
+    X(DIVU,  if (R(ip->rt) != 0) { \
+                 sim->lo = R(ip->rs) / R(ip->rt); \
+                 sim->hi = R(ip->rs) % R(ip->rt); \
+             }) \
+    X(MFHI,  DEST = sim->hi) \
+    X(MFLO,  DEST = sim->lo) \
+    X(MTHI,  sim->hi = R(ip->rs)) \
+    X(MTLO,  sim->lo = R(ip->rs)) \
+    X(MULT,  { \
+                 int64_t p = (int64_t) SR(ip->rs) * SR(ip->rt); \
+                 sim->lo = (uint32_t) p; \
+                 sim->hi = (uint32_t) ((uint64_t) p >> 32); \
+             }) \
+    X(MULTU, { \
+                 uint64_t p = (uint64_t) R(ip->rs) * R(ip->rt); \
+                 sim->lo = (uint32_t) p; \
+                 sim->hi = (uint32_t) (p >> 32); \
+             }) \
+    X(NOR,   DEST = ~(R(ip->rs) | R(ip->rt))) \
+    X(OR,    DEST = R(ip->rs) | R(ip->rt)) \
+    X(SLL,   DEST = R(ip->rt) << ip->imm) \
+    X(SLLV,  DEST = R(ip->rt) << (R(ip->rs) & 31)) \
+    X(SLT,   DEST = SR(ip->rs) < SR(ip->rt)) \
+    X(SLTU,  DEST = R(ip->rs) < R(ip->rt)) \
+    X(SRA,   DEST = (uint32_t) (SR(ip->rt) >> ip->imm)) \
+    X(SRAV,  DEST = (uint32_t) (SR(ip->rt) >> (R(ip->rs) & 31))) \
+    X(SRL,   DEST = R(ip->rt) >> ip->imm) \
+    X(SRLV,  DEST = R(ip->rt) >> (R(ip->rs) & 31)) \
+    X(SUB,   OVERFLOW_CHECK(__builtin_sub_overflow, SR(ip->rs), SR(ip->rt))) \
+    X(SUBU,  DEST = R(ip->rs) - R(ip->rt)) \
+    X(XOR,   DEST = R(ip->rs) ^ R(ip->rt)) \
+    X(ADDI,  OVERFLOW_CHECK(__builtin_add_overflow, SR(ip->rs), (int32_t) ip->imm)) \
+    X(ADDIU, DEST = R(ip->rs) + ip->imm) \
+    X(ANDI,  DEST = R(ip->rs) & ip->imm) \
+    X(LB,    LOAD(int8_t, 1)) \
+    X(LBU,   LOAD(uint8_t, 1)) \
+    X(LH,    LOAD(int16_t, 2)) \
+    X(LHU,   LOAD(uint16_t, 2)) \
+    X(LUI,   DEST = ip->imm) \
+    X(LW,    LOAD(uint32_t, 4)) \
+    X(LWCL,  { \
+                 uint32_t a = ADDR; \
+                 if ((a & 3) != 0) { what = "Unaligned load from 0x%08x"; value = a; goto fault; } \
+                 memcpy(&sim->fpr[ip->rt], mem_read(sim, a), 4); \
+             }) \
+    X(ORI,   DEST = R(ip->rs) | ip->imm) \
+    X(SB,    STORE(uint8_t, 1, R(ip->rt))) \
+    X(SLTI,  DEST = SR(ip->rs) < (int32_t) ip->imm) \
+    X(SLTIU, DEST = R(ip->rs) < ip->imm) \
+    X(SH,    STORE(uint16_t, 2, R(ip->rt))) \
+    X(SW,    STORE(uint32_t, 4, R(ip->rt))) \
+    X(SWCL,  STORE(uint32_t, 4, sim->fpr[ip->rt])) \
+    X(XORI,  DEST = R(ip->rs) ^ ip->imm)
+
+// and the ones each run loop has its own handler for
+#define SIM_CONTROL_OPS(X) \
+    X(BREAK) X(JALR) X(JR) X(SYSCALL) X(J) X(JAL) \
+    X(BEQ) X(BGEZ) X(BGTZ) X(BLEZ) X(BLTZ) X(BNE)
+
+#define DISPATCH() do { steps++; goto *labels[ip->op]; } while (0)
+#define NEXT()     do { ip++; DISPATCH(); } while (0)
+// taken branches and jumps are where the step limit is checked, so a loop can't get past it
+#define JUMP(idx)  do { ip = code + (idx); if (steps >= max_steps) goto limit; DISPATCH(); } while (0)
+#define BRANCH(cond) do { if (cond) JUMP(ip->imm); NEXT(); } while (0)
+// code_write already decoded the word again in place, so just carry on
+#define AFTER_CODE_WRITE ((void) 0)
+
+/**
+ * Called by sim_run with a trace open, when sim->trace.left runs out at instruction index
+ * Records the sample before it with the register it wrote, now that it's run, and takes the
+ * next sample when it's due
+ * Returns how many instructions to go until it has to be called again
+ */
+static uint32_t trace_instr(sim_t *sim, size_t index) {
+    sim_trace_t *t = &sim->trace;
+
+    if (t->pending) {
+        int reg = t->dest == SIM_SINK ? -1 : t->dest;
+        trace_record(t->out, t->pc, t->word, reg, sim->regs[t->dest]);
+        t->pending = 0;
+    }
+    if (!t->at_sample) {
+        t->at_sample = 1;
+        return t->period - 1;
+    }
+
+    // the sentinels past the image aren't instructions
+    if (index < sim->count) {
+        t->pending = 1;
+        t->pc = index * 4;
+        memcpy(&t->word, mem_read(sim, t->pc), 4);
+        // syscalls hand their results back in $v0
+        t->dest = sim->code[index].op == SYSCALL ? REG_V0 : sim->code[index].dest;
+    }
+    t->at_sample = t->period == 1;
+    return 1;
+}
+
+/**
+ * Starts recording every period-th instruction (every one for 0 or 1) into a new trace at path,
+ * with the image and registers as they are now
+ * Returns -1 if the trace can't be written
+ */
+int sim_trace_start(sim_t *sim, const char *path, uint32_t period) {
+    uint32_t *image = malloc(sim->count ? sim->count * sizeof(uint32_t) : 1);
+    if (image == NULL)
+        return -1;
+
+    for (size_t i = 0; i < sim->count; i++)
+        memcpy(&image[i], mem_read(sim, i * 4), 4);
+    if (period == 0)
+        period = 1;
+
+    memset(&sim->trace, 0, sizeof(sim->trace));
+    sim->trace.out = trace_open(path, period, image, sim->count, sim->regs);
+    sim->trace.period = period;
+    sim->trace.left = 1;
+    sim->trace.at_sample = 1;
+    free(image);
+    return sim->trace.out != NULL ? 0 : -1;
+}
+
+/**
+ * Records the last sample, ends the trace and closes it
+ * Returns -1 if it couldn't all be written
+ */
+int sim_trace_stop(sim_t *sim) {
+    sim_trace_t *t = &sim->trace;
+
+    if (t->out == NULL)
+        return 0;
+    if (t->pending)
+        trace_record(t->out, t->pc, t->word, t->dest == SIM_SINK ? -1 : t->dest, sim->regs[t->dest]);
+
+    int ret = trace_close(t->out, sim->steps);
+    memset(t, 0, sizeof(*t));
+    return ret;
+}
+
+/**
+ * Runs from sim->pc until the program exits, faults, or about max_steps more instructions have run
+ * The limit is checked on taken branches and jumps, so straight line code can finish past it
+ * Can be called again after SIM_LIMIT to carry on
+ */
+SimStatus sim_run(sim_t *sim, uint64_t max_steps) {
+#define X(id, mnemonic, type, opcode, funct, rt, params) [id] = &&op_##id,
+    static const void *const LABELS[SIM_NUM_OPS] = {
+        INSTR_TABLE(X)
+        [SIM_OP_INVALID] = &&op_invalid,
+        [SIM_OP_END] = &&op_end,
+        [SIM_OP_BAD_TARGET] = &&op_bad_target,
+    };
+#undef X
+    // with a trace open every op goes through traced on the way to its handler
+    static const void *const TRACE_LABELS[SIM_NUM_OPS] = { [0 ... SIM_NUM_OPS - 1] = &&traced };
+
+    const void *const *labels = sim->trace.out != NULL ? TRACE_LABELS : LABELS;
+    uint32_t trace_left = sim->trace.left;
+    uint32_t *regs = sim->regs;
+    sim_instr_t *code = sim->code;
+    sim_instr_t *ip = code + (sim->pc / 4 <= sim->count ? sim->pc / 4 : sim->count + 1);
+    const uint32_t code_bytes = sim->count * 4;
+    uint64_t steps = 0;
+    const char *what = NULL;
+    uint32_t value = 0;
+    SimStatus status;
+    int ret;
+
+    if (max_steps == 0)
+        max_steps = UINT64_MAX;
+
+    DISPATCH();
+
+#define X(id, body) op_##id: body; NEXT();
+    SIM_SIMPLE_OPS(X)
+#undef X
+
+op_BREAK:   status = SIM_BREAK; goto stop;
+op_JALR: {
+    // rd can be rs, so read and check the target before writing the link
+    uint32_t to = R(ip->rs);
+    if ((to & 3) != 0 || to / 4 > sim->count) { what = "Jump outside the program to 0x%08x"; value = to; goto fault; }
+    DEST = (ip - code) * 4 + 4;
+    JUMP(to / 4);
+}
+op_JR: {
+    uint32_t to = R(ip->rs);
+    if ((to & 3) != 0 || to / 4 > sim->count) { what = "Jump outside the program to 0x%08x"; value = to; goto fault; }
+    JUMP(to / 4);
+}
+op_SYSCALL:
+    sim->pc = (ip - code) * 4;
+    ret = do_syscall(sim);
+    if (ret < 0) {
+        status = SIM_FAULT;
+        goto stop;
+    }
+    if (ret > 0) {
+        status = SIM_EXIT;
+        goto stop;
+    }
+    NEXT();
+op_J:       JUMP(ip->imm);
+op_JAL:     DEST = (ip - code) * 4 + 4; JUMP(ip->imm);
+op_BEQ:     BRANCH(R(ip->rs) == R(ip->rt));
+op_BGEZ:    BRANCH(SR(ip->rs) >= 0);
+op_BGTZ:    BRANCH(SR(ip->rs) > 0);
+op_BLEZ:    BRANCH(SR(ip->rs) <= 0);
+op_BLTZ:    BRANCH(SR(ip->rs) < 0);
+op_BNE:     BRANCH(R(ip->rs) != R(ip->rt));
+
+traced:
+    if (--trace_left == 0)
+        trace_left = trace_instr(sim, ip - code);
+    goto *LABELS[ip->op];
+
+op_invalid:
+    what = "Reserved instruction";
+    goto fault;
+op_end:
+    // ran off the end of the image, the same as exiting
+    steps--;
+    status = SIM_EXIT;
+    goto stop;
+op_bad_target:
+    steps--;
+    // labels always land in the image, so only a hand made image gets here, and pc is past its end
+    what = "Branch or jump outside the program";
+    goto fault;
+
+limit:
+    status = SIM_LIMIT;
+    goto stop;
+fault:
+    status = SIM_FAULT;
+    set_fault(sim, what, value);
+stop:
+    sim->pc = (ip - code) * 4;
+    sim->steps += steps;
+    sim->trace.left = trace_left;
+    return status;
+}
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef BRANCH
+#undef AFTER_CODE_WRITE
+
+// ops only translated blocks have, past the ones sim_instr_t uses
+enum {
+    BLOCK_LI = SIM_NUM_OPS, // a constant, from lui (then ori), or addiu/ori/xori on $0
+    BLOCK_MOVE,             // addu/or/xor with $0
+    BLOCK_BEQZ,
+    BLOCK_BNEZ,
+    BLOCK_ADDIU_BEQ,        // addiu then a branch, the loop counter pattern
+    BLOCK_ADDIU_BNE,
+    BLOCK_SLT_BEQZ,         // a set on less than then a branch on its result
+    BLOCK_SLT_BNEZ,
+    BLOCK_SLTU_BEQZ,
+    BLOCK_SLTU_BNEZ,
+    BLOCK_SLTI_BEQZ,
+    BLOCK_SLTI_BNEZ,
+    BLOCK_SLTIU_BEQZ,
+    BLOCK_SLTIU_BNEZ,
+    BLOCK_FALL,             // the block ran out of room, carry on with the next one
+    BLOCK_STALE,            // put over the first op of a dropped block
+    BLOCK_NUM_OPS
+};
+
+/**
+ * Throws every block away, when they've taken SIM_BLOCK_CACHE_MAX
+ */
+static void flush_blocks(sim_t *sim) {
+    arena_reset(&sim->block_arena);
+    memset(sim->blocks, 0, (sim->count + 1) * sizeof(sim_block_t *));
+    memset(sim->live_pages, 0, sim->count / SIM_PAGE_WORDS + 1);
+    sim->block_stats.flushes++;
+}
+
+static int ends_block(int kind) {
+    switch (kind) {
+#define C(id) case id:
+        SIM_CONTROL_OPS(C)
+#undef C
+            return 1;
+        default:
+            // the specialized and fused branches
+            return kind >= BLOCK_BEQZ && kind <= BLOCK_SLTIU_BNEZ;
+    }
+}
+
+/**
+ * Folds the op just before a conditional branch into it when they make one of the fused pairs
+ * Returns the fused op, or -1
+ */
+static int fuse_branch(int prev, const sim_op_t *prev_op, InstrID branch, const sim_instr_t *in) {
+    int taken_if_zero = branch == BEQ;
+
+    if (prev == ADDIU)
+        return taken_if_zero ? BLOCK_ADDIU_BEQ : BLOCK_ADDIU_BNE;
+
+    // slt then beq/bne on its result against $0
+    if (in->rt != 0 || in->rs != prev_op->dest)
+        return -1;
+    switch (prev) {
+        case SLT:   return taken_if_zero ? BLOCK_SLT_BEQZ : BLOCK_SLT_BNEZ;
+        case SLTU:  return taken_if_zero ? BLOCK_SLTU_BEQZ : BLOCK_SLTU_BNEZ;
+        case SLTI:  return taken_if_zero ? BLOCK_SLTI_BEQZ : BLOCK_SLTI_BNEZ;
+        case SLTIU: return taken_if_zero ? BLOCK_SLTIU_BEQZ : BLOCK_SLTIU_BNEZ;
+        default:    return -1;
+    }
+}
+
+/**
+ * Translates the block starting at instruction index, up to and including the first instruction
+ * that can change the flow, SIM_BLOCK_MAX instructions, or the end of the page
+ * labels are sim_run_blocks' handlers, by op
+ * Returns the block, now in the cache, or NULL if out of memory
+ */
+static sim_block_t *translate(sim_t *sim, uint32_t index, const void *const *labels) {
+    sim_op_t ops[SIM_BLOCK_MAX + 1];
+    int kinds[SIM_BLOCK_MAX + 1];
+    uint32_t next_pc[2] = { 0, 0 };
+    const sim_instr_t *code = sim->code;
+    size_t n = 0;
+    uint32_t i = index;
+    uint32_t page_end = (index / SIM_PAGE_WORDS + 1) * SIM_PAGE_WORDS;
+
+    if (page_end > sim->count)
+        page_end = sim->count;
+    if (sim->block_arena.stats.used >= SIM_BLOCK_CACHE_MAX)
+        flush_blocks(sim);
+
+    if (index == sim->count) {
+        ops[n] = (sim_op_t) { 0 };
+        kinds[n++] = SIM_OP_END;
+    }
+
+    while (index < sim->count) {
+        if (i == page_end || i - index == SIM_BLOCK_MAX) {
+            ops[n] = (sim_op_t) { .at = i - index };
+            kinds[n++] = BLOCK_FALL;
+            next_pc[1] = i * 4;
+            break;
+        }
+
+        const sim_instr_t *in = &code[i];
+        sim_op_t *op = &ops[n];
+        int kind = in->op;
+        *op = (sim_op_t) { .imm = in->imm, .dest = in->dest, .rs = in->rs, .rt = in->rt, .at = i - index };
+
+        if (kind == SIM_OP_INVALID) {
+            // only a block of its own faults on it, otherwise it starts the next block
+            if (n == 0) {
+                kinds[n++] = kind;
+                i++;
+            } else {
+                ops[n] = (sim_op_t) { .at = i - index };
+                kinds[n++] = BLOCK_FALL;
+                next_pc[1] = i * 4;
+            }
+            break;
+        }
+
+        switch (kind) {
+            case BEQ: case BNE: {
+                int fused = n > 0 ? fuse_branch(kinds[n - 1], &ops[n - 1], kind, in) : -1;
+                if (fused >= 0) {
+                    op = &ops[--n];
+                    op->rs2 = in->rs;
+                    op->rt2 = in->rt;
+                    kind = fused;
+                } else if (in->rt == 0)
+                    kind = kind == BEQ ? BLOCK_BEQZ : BLOCK_BNEZ;
+                next_pc[0] = in->imm * 4;
+                next_pc[1] = (i + 1) * 4;
+                break;
+            }
+            case BGEZ: case BGTZ: case BLEZ: case BLTZ:
+                next_pc[0] = in->imm * 4;
+                next_pc[1] = (i + 1) * 4;
+                break;
+            case J:
+                next_pc[0] = in->imm * 4;
+                break;
+            case JAL:
+                op->imm = (i + 1) * 4; // the link, the target is the block's exit
+                next_pc[0] = in->imm * 4;
+                break;
+            case JALR:
+                op->imm = (i + 1) * 4;
+                break;
+            case SYSCALL:
+                next_pc[1] = (i + 1) * 4;
+                break;
+            case LUI:
+                kind = BLOCK_LI;
+                if (i + 1 < page_end && i + 1 - index < SIM_BLOCK_MAX && code[i + 1].op == ORI &&
+                    code[i + 1].rs == in->dest && code[i + 1].dest == in->dest) {
+                    op->imm |= code[i + 1].imm;
+                    i++;
+                }
+                break;
+            case ADDIU: case ORI: case XORI:
+                if (in->rs == 0)
+                    kind = BLOCK_LI;
+                break;
+            case ADDU: case OR: case XOR:
+                if (in->rt == 0)
+                    kind = BLOCK_MOVE;
+                else if (in->rs == 0) {
+                    op->rs = in->rt;
+                    kind = BLOCK_MOVE;
+                }
+                break;
+            default:
+                break;
+        }
+
+        kinds[n++] = kind;
+        i++;
+        if (ends_block(kind))
+            break;
+    }
+
+    sim_block_t *block = arena_alloc(&sim->block_arena, sizeof(sim_block_t) + n * sizeof(sim_op_t));
+    if (block == NULL)
+        return NULL;
+
+    block->next[0] = block->next[1] = NULL;
+    block->next_pc[0] = next_pc[0];
+    block->next_pc[1] = next_pc[1];
+    block->pc = index * 4;
+    block->len = i - index;
+    block->dead = 0;
+    for (size_t k = 0; k < n; k++) {
+        block->ops[k] = ops[k];
+        block->ops[k].handler = labels[kinds[k]];
+    }
+
+    sim->blocks[index] = block;
+    sim->live_pages[index / SIM_PAGE_WORDS] = 1;
+    sim->block_stats.translated++;
+    return block;
+}
+
+#define NEXT() do { ip++; goto *ip->handler; } while (0)
+// start block b, written out at every exit so each has its own indirect jump to predict
+#define ENTER(b) do { \
+        block = (b); \
+        if (steps >= max_steps) goto limit; \
+        steps += block->len; \
+        ip = block->ops; \
+        goto *ip->handler; \
+    } while (0)
+// leave the block by exit k, straight into the next block if it's been linked
+#define EXIT(k) do { \
+        prev = block; \
+        via = k; \
+        if (block->next[k] != NULL) { chains++; ENTER(block->next[k]); } \
+        pc = block->next_pc[k]; \
+        goto lookup; \
+    } while (0)
+#define TAKE(cond) do { if (cond) EXIT(0); EXIT(1); } while (0)
+// the rest of the block may have just changed, look up what's there now
+#define AFTER_CODE_WRITE goto code_written
+
+/**
+ * sim_run a block at a time through the block cache, see sim.h
+ * The limit is checked as each block starts
+ */
+SimStatus sim_run_blocks(sim_t *sim, uint64_t max_steps) {
+#define X(id, body) [id] = &&op_##id,
+#define C(id) [id] = &&block_##id,
+    static const void *const LABELS[BLOCK_NUM_OPS] = {
+        SIM_SIMPLE_OPS(X)
+        SIM_CONTROL_OPS(C)
+        [SIM_OP_INVALID] = &&op_invalid,
+        [SIM_OP_END] = &&op_end,
+        [BLOCK_LI] = &&block_li,
+        [BLOCK_MOVE] = &&block_move,
+        [BLOCK_BEQZ] = &&block_beqz,
+        [BLOCK_BNEZ] = &&block_bnez,
+        [BLOCK_ADDIU_BEQ] = &&block_addiu_beq,
+        [BLOCK_ADDIU_BNE] = &&block_addiu_bne,
+        [BLOCK_SLT_BEQZ] = &&block_slt_beqz,
+        [BLOCK_SLT_BNEZ] = &&block_slt_bnez,
+        [BLOCK_SLTU_BEQZ] = &&block_sltu_beqz,
+        [BLOCK_SLTU_BNEZ] = &&block_sltu_bnez,
+        [BLOCK_SLTI_BEQZ] = &&block_slti_beqz,
+        [BLOCK_SLTI_BNEZ] = &&block_slti_bnez,
+        [BLOCK_SLTIU_BEQZ] = &&block_sltiu_beqz,
+        [BLOCK_SLTIU_BNEZ] = &&block_sltiu_bnez,
+        [BLOCK_FALL] = &&block_fall,
+        [BLOCK_STALE] = &&block_stale,
+    };
+#undef X
+#undef C
+
+    // blocks don't stop between instructions, so traces are only taken one at a time
+    if (sim->trace.out != NULL)
+        return sim_run(sim, max_steps);
+
+    sim->stale_handler = LABELS[BLOCK_STALE];
+    if (sim->blocks == NULL) {
+        sim->blocks = calloc(sim->count + 1, sizeof(sim_block_t *));
+        sim->live_pages = calloc(sim->count / SIM_PAGE_WORDS + 1, 1);
+        if (sim->blocks == NULL || sim->live_pages == NULL) {
+            free(sim->blocks);
+            free(sim->live_pages);
+            sim->blocks = NULL;
+            sim->live_pages = NULL;
+            set_fault(sim, "Out of memory for the block cache", 0);
+            return SIM_FAULT;
+        }
+    }
+
+    uint32_t *regs = sim->regs;
+    const uint32_t code_bytes = sim->count * 4;
+    sim_block_t *block = NULL;
+    sim_block_t *prev = NULL; // block whose exit via is being looked up, to link it
+    int via = 0;
+    const sim_op_t *ip = NULL;
+    uint32_t pc = sim->pc;
+    uint64_t steps = 0, hits = 0, misses = 0, chains = 0;
+    const char *what = NULL;
+    uint32_t value = 0;
+    SimStatus status;
+    int ret;
+
+    if (max_steps == 0)
+        max_steps = UINT64_MAX;
+
+lookup:
+    if ((pc & 3) != 0 || pc / 4 > sim->count) {
+        // labels always land in the image, so only a hand made image gets here
+        set_fault(sim, "Branch or jump outside the program", 0);
+        status = SIM_FAULT;
+        sim->pc = pc;
+        goto done;
+    }
+    block = sim->blocks[pc / 4];
+    if (block != NULL)
+        hits++;
+    else {
+        uint64_t flushes = sim->block_stats.flushes;
+        misses++;
+        block = translate(sim, pc / 4, LABELS);
+        if (block == NULL) {
+            set_fault(sim, "Out of memory for the block cache", 0);
+            status = SIM_FAULT;
+            sim->pc = pc;
+            goto done;
+        }
+        if (sim->block_stats.flushes != flushes)
+            prev = NULL; // it went with the rest
+    }
+    if (prev != NULL && !prev->dead)
+        prev->next[via] = block;
+    ENTER(block);
+
+#define X(id, body) op_##id: body; NEXT();
+    SIM_SIMPLE_OPS(X)
+#undef X
+
+block_li:           DEST = ip->imm; NEXT();
+block_move:         DEST = R(ip->rs); NEXT();
+block_fall:         EXIT(1);
+block_stale:
+    // came over a link to a dropped block, relink prev to whatever's there now
+    steps -= block->len;
+    chains--;
+    pc = block->pc;
+    goto lookup;
+
+block_BEQ:          TAKE(R(ip->rs) == R(ip->rt));
+block_BNE:          TAKE(R(ip->rs) != R(ip->rt));
+block_beqz:         TAKE(R(ip->rs) == 0);
+block_bnez:         TAKE(R(ip->rs) != 0);
+block_BGEZ:         TAKE(SR(ip->rs) >= 0);
+block_BGTZ:         TAKE(SR(ip->rs) > 0);
+block_BLEZ:         TAKE(SR(ip->rs) <= 0);
+block_BLTZ:         TAKE(SR(ip->rs) < 0);
+block_addiu_beq:    DEST = R(ip->rs) + ip->imm; TAKE(R(ip->rs2) == R(ip->rt2));
+block_addiu_bne:    DEST = R(ip->rs) + ip->imm; TAKE(R(ip->rs2) != R(ip->rt2));
+block_slt_beqz:     TAKE((DEST = SR(ip->rs) < SR(ip->rt)) == 0);
+block_slt_bnez:     TAKE((DEST = SR(ip->rs) < SR(ip->rt)) != 0);
+block_sltu_beqz:    TAKE((DEST = R(ip->rs) < R(ip->rt)) == 0);
+block_sltu_bnez:    TAKE((DEST = R(ip->rs) < R(ip->rt)) != 0);
+block_slti_beqz:    TAKE((DEST = SR(ip->rs) < (int32_t) ip->imm) == 0);
+block_slti_bnez:    TAKE((DEST = SR(ip->rs) < (int32_t) ip->imm) != 0);
+block_sltiu_beqz:   TAKE((DEST = R(ip->rs) < ip->imm) == 0);
+block_sltiu_bnez:   TAKE((DEST = R(ip->rs) < ip->imm) != 0);
+
+block_J:            EXIT(0);
+block_JAL:          DEST = ip->imm; EXIT(0);
+block_JALR:
+    pc = R(ip->rs);
+    if ((pc & 3) != 0 || pc / 4 > sim->count) goto bad_jump_register;
+    DEST = ip->imm;
+    goto jump_register;
+block_JR:
+    pc = R(ip->rs);
+    if ((pc & 3) != 0 || pc / 4 > sim->count) goto bad_jump_register;
+jump_register:
+    prev = NULL;
+    goto lookup;
+bad_jump_register:
+    what = "Jump outside the program to 0x%08x";
+    value = pc;
+    goto fault;
+block_SYSCALL:
+    sim->pc = block->pc + ip->at * 4;
+    ret = do_syscall(sim);
+    if (ret < 0) {
+        status = SIM_FAULT;
+        goto stop;
+    }
+    if (ret > 0) {
+        status = SIM_EXIT;
+        goto stop;
+    }
+    EXIT(1);
+block_BREAK:
+    status = SIM_BREAK;
+    goto stop;
+
+op_invalid:
+    what = "Reserved instruction";
+    goto fault;
+op_end:
+    // ran off the end of the image, the same as exiting
+    status = SIM_EXIT;
+    sim->pc = block->pc;
+    goto done;
+
+limit:
+    status = SIM_LIMIT;
+    sim->pc = block->pc;
+    goto done;
+code_written:
+    // carry on after the store, whatever's there now
+    steps -= block->len - ip->at - 1;
+    pc = block->pc + ip->at * 4 + 4;
+    prev = NULL;
+    goto lookup;
+
+fault:
+    status = SIM_FAULT;
+    set_fault(sim, what, value);
+stop:
+    // stopped partway through the block, only count it up to ip
+    steps -= block->len - ip->at - 1;
+    sim->pc = block->pc + ip->at * 4;
+done:
+    sim->steps += steps;
+    sim->block_stats.hits += hits;
+    sim->block_stats.misses += misses;
+    sim->block_stats.chains += chains;
+    return status;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "arena.h"
+#include "instr.h"
+#include "trace.h"
+
+// in-process MIPS simulator for the images the assembler produces
+// the image is loaded at address 0 and predecoded once, each word into a sim_instr_t whose op is
+// its InstrID, so the run loop jumps straight to a handler per instruction (computed goto) and
+// never looks at the encoding again
+// there are no delay slots, like SPIM's default, the heap (sbrk) starts after the image and the
+// stack grows down from SIM_STACK_TOP
+//
+// memory is the whole 4 GiB address space in host byte order, as 4K pages behind a two level
+// table (the top 10 bits of an address pick a second level table, the next 10 a page)
+// untouched pages all map to one shared zero page, and untouched second level tables to one
+// shared table of them, so a read never has to check, and the first store into a page gets it
+// its own from the sim's page pool
+// only mem_limit bytes of pages can be touched, past that a store faults
+// stores into the image decode the words they hit again, so self modifying code runs as written
+//
+// sim_run_blocks runs the same program a basic block at a time, translating each block once into
+// ops that carry their handler's address, so there's no table lookup or step count per
+// instruction, with common pairs fused (lui/ori, addiu or slt then a branch) and moves and
+// constants from $0 specialized, and each block's exits linked straight to the next block once
+// it's been looked up
+// blocks never cross a SIM_PAGE, a store into a page drops every block in it, and a block linked
+// to a dropped one lands on a stale op in its place that looks the block up again and relinks
+//
+// sim_trace_start records every instruction (or every Nth) sim_run runs into a trace, see trace.h
+// while a trace is open every dispatch goes through one more label first, and sim_run_blocks
+// runs one instruction at a time like sim_run, untraced runs don't pay anything for it
+
+// writes to $0 go to this extra register instead, so no handler has to check for $0
+#define SIM_SINK (32)
+#define SIM_NUM_REGS (33)
+
+#define SIM_DEFAULT_MEMORY ((size_t) 64 << 20)
+#define SIM_STACK_TOP (0x7ffffff8)
+
+#define SIM_PAGE_SHIFT (12)
+#define SIM_PAGE_SIZE ((uint32_t) 1 << SIM_PAGE_SHIFT)
+#define SIM_PAGE_WORDS (SIM_PAGE_SIZE / 4)
+#define SIM_L2_SHIFT (10)
+#define SIM_L2_ENTRIES ((uint32_t) 1 << SIM_L2_SHIFT)
+#define SIM_L1_ENTRIES ((uint32_t) 1 << (32 - SIM_PAGE_SHIFT - SIM_L2_SHIFT))
+// guest instructions in a block at most
+#define SIM_BLOCK_MAX (64)
+// translated blocks are thrown away and started again once they take this much memory
+#define SIM_BLOCK_CACHE_MAX ((size_t) 32 << 20)
+
+typedef enum {
+    SIM_EXIT,   // exit syscall, or ran off the end of the image
+    SIM_BREAK,  // break instruction
+    SIM_FAULT,  // bad address, overflow, bad syscall or instruction, see fault
+    SIM_LIMIT   // max_steps instructions ran
+} SimStatus;
+
+// one predecoded instruction
+typedef struct {
+    uint8_t op;    // InstrID, or one of the SIM_OP_ pseudo instructions past them
+    uint8_t dest;  // register written, SIM_SINK for $0
+    uint8_t rs;
+    uint8_t rt;
+    uint32_t imm;  // extended immediate, shift amount, or branch/jump target as an instruction index
+} sim_instr_t;
+
+// one op of a translated block, fused pairs use rs2/rt2 for the branch
+typedef struct {
+    const void *handler;
+    uint32_t imm;
+    uint8_t dest, rs, rt;
+    uint8_t at;    // which of the block's instructions this op starts at
+    uint8_t rs2, rt2;
+} sim_op_t;
+
+typedef struct sim_block {
+    struct sim_block *next[2]; // linked successors, taken then fall through
+    uint32_t next_pc[2];
+    uint32_t pc;               // entry
+    uint32_t len;              // guest instructions, counted as a whole when the block starts
+    int dead;                  // its page was written, don't link from it
+    sim_op_t ops[];
+} sim_block_t;
+
+typedef struct {
+    uint64_t translated;  // blocks made
+    uint64_t hits;        // block looked up and found
+    uint64_t misses;      // block looked up and translated
+    uint64_t chains;      // went straight to the next block over a link, no lookup
+    uint64_t invalidated; // blocks dropped by stores into their page
+    uint64_t flushes;     // times the whole cache was thrown away for taking too much memory
+} sim_block_stats_t;
+
+// what sim_run needs to record samples, only used while out is open
+typedef struct {
+    trace_t *out;
+    uint32_t period;
+    uint32_t left;     // instructions until the run loop calls into the tracer again
+    int at_sample;     // that call takes a sample, rather than finishing the last one
+    int pending;       // the last sample still needs the register it wrote
+    uint32_t pc, word;
+    uint8_t dest;
+} sim_trace_t;
+
+// second level of the page table
+typedef struct {
+    uint8_t *pages[SIM_L2_ENTRIES];
+} sim_l2_t;
+
+typedef struct {
+    sim_instr_t *code;        // the image followed by the sentinels run off the end and bad targets go to
+    size_t count;             // instructions in the image
+    uint32_t regs[SIM_NUM_REGS];
+    uint32_t hi, lo;
+    uint32_t fpr[32];         // lwc1/swc1 only move words in and out, there's no FPU
+    sim_l2_t *l1[SIM_L1_ENTRIES];
+    arena_t page_pool;        // the pages and second level tables stores have touched
+    size_t mem_used;          // bytes of pages touched
+    size_t mem_limit;
+    uint32_t brk;             // next address sbrk hands out
+    uint32_t pc;              // where the last run stopped
+    uint64_t steps;           // instructions executed over every run
+    int exit_code;
+    char fault[96];
+    FILE *in, *out;           // syscall I/O
+    // basic block cache, only set up by sim_run_blocks
+    sim_block_t **blocks;     // live block by entry instruction, count + 1
+    uint8_t *live_pages;      // pages with a live block in them
+    arena_t block_arena;
+    const void *stale_handler; // put over the first op of dropped blocks by code_write
+    sim_block_stats_t block_stats;
+    sim_trace_t trace;
+} sim_t;
+
+int sim_init(sim_t *sim, const uint32_t *words, size_t count, size_t mem_limit);
+void sim_free(sim_t *sim);
+SimStatus sim_run(sim_t *sim, uint64_t max_steps);
+SimStatus sim_run_blocks(sim_t *sim, uint64_t max_steps);
+int sim_trace_start(sim_t *sim, const char *path, uint32_t period);
+int sim_trace_stop(sim_t *sim);
@@ -0,0 +1,207 @@
+#include "source.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define READ_CHUNK (64 * 1024)
+
+/**
+ * Reads everything from fd into a malloc'd buffer
+ * Used for pipes and anything else that can't be mapped
+ */
+static int read_all(source_t *src, int fd) {
+    size_t cap = READ_CHUNK;
+    size_t len = 0;
+    char *buf = malloc(cap);
+
+    if (buf == NULL)
+        return -1;
+
+    while (1) {
+        if (len == cap) {
+            char *grown = realloc(buf, cap * 2);
+            if (grown == NULL) {
+                free(buf);
+                return -1;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+
+        ssize_t n = read(fd, buf + len, cap - len);
+
+        if (n == 0)
+            break;
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        len += n;
+    }
+
+    src->data = buf;
+    src->len = len;
+    src->mapped = 0;
+    return 0;
+}
+
+/**
+ * Opens path and makes its whole contents available as one buffer
+ * Returns 0 on success, -1 on failure
+ */
+int source_open(source_t *src, const char *path) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    // mmap refuses zero length mappings, so empty files take the read path too
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            close(fd);
+            src->data = map;
+            src->len = st.st_size;
+            src->mapped = 1;
+            return 0;
+        }
+        // fall through and read it the slow way
+    }
+
+    int ret = read_all(src, fd);
+    close(fd);
+    return ret;
+}
+
+void source_close(source_t *src) {
+    if (src->mapped)
+        munmap((void *) src->data, src->len);
+    else
+        free((void *) src->data);
+
+    src->data = NULL;
+    src->len = 0;
+    src->mapped = 0;
+}
+
+// bytes mapped at once, a line has to fit in one window
+#define WINDOW_BYTES ((size_t) 64 << 20)
+// bytes read at once from a pipe, a line has to fit in the buffer
+#define BUFFER_BYTES ((size_t) 256 << 10)
+
+/**
+ * Maps the window holding offset, reusing nothing from the last one
+ * Returns -1 on failure
+ */
+static int map_window(source_window_t *win, uint64_t offset) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(page - 1);
+    size_t len = win->size - start < WINDOW_BYTES ? win->size - start : WINDOW_BYTES;
+
+    if (win->map != NULL)
+        munmap(win->map, win->map_len);
+    win->map = NULL;
+    win->map_len = 0;
+
+    if (len > 0) {
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, win->fd, start);
+        if (map == MAP_FAILED)
+            return -1;
+
+        // readahead for the kernel, and pages behind us can go as soon as they're unmapped
+        madvise(map, len, MADV_SEQUENTIAL);
+        win->map = map;
+        win->map_len = len;
+    }
+
+    win->offset = offset;
+    win->data = len > 0 ? (const char *) win->map + (offset - start) : "";
+    win->len = len - (offset - start);
+    win->last = start + len == win->size;
+    win->full = !win->last;
+    return 0;
+}
+
+/**
+ * Reads once into the free end of the buffer
+ * Returns -1 on failure
+ */
+static int fill_buffer(source_window_t *win) {
+    size_t want = win->cap - win->len;
+    ssize_t n;
+
+    do
+        n = read(win->fd, win->buf + win->len, want);
+    while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        return -1;
+
+    // a full buffer reads nothing, that's not the end of the input
+    win->len += n;
+    win->last = n == 0 && want > 0;
+    win->full = win->len == win->cap;
+    return 0;
+}
+
+/**
+ * Opens a window on fd, which stays owned by the caller, and fills it
+ * Returns 0 on success, -1 on failure
+ */
+int source_window_open(source_window_t *win, int fd) {
+    struct stat st;
+
+    memset(win, 0, sizeof(*win));
+    win->fd = fd;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        win->mapped = 1;
+        win->size = st.st_size;
+        return map_window(win, 0);
+    }
+
+    win->buf = malloc(BUFFER_BYTES);
+    if (win->buf == NULL)
+        return -1;
+
+    win->cap = BUFFER_BYTES;
+    win->data = win->buf;
+    return fill_buffer(win);
+}
+
+/**
+ * Drops the first used bytes of the window and moves on to more input
+ * Returns 0 on success, -1 on failure
+ */
+int source_window_next(source_window_t *win, size_t used) {
+    if (win->mapped)
+        return map_window(win, win->offset + used);
+
+    memmove(win->buf, win->buf + used, win->len - used);
+    win->len -= used;
+    win->offset += used;
+    return fill_buffer(win);
+}
+
+/**
+ * Goes back to the start of the input, only mapped inputs can
+ * Returns 0 on success, -1 on failure
+ */
+int source_window_rewind(source_window_t *win) {
+    if (!win->mapped)
+        return -1;
+    return map_window(win, 0);
+}
+
+void source_window_close(source_window_t *win) {
+    if (win->map != NULL)
+        munmap(win->map, win->map_len);
+    free(win->buf);
+    memset(win, 0, sizeof(*win));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// read-only view of a whole input file
+// regular files are mmap'd, anything else (pipes, ttys) is read once into a heap buffer
+typedef struct {
+    const char *data;
+    size_t len;
+    int mapped; // 1 if data is an mmap'd region, 0 if it was malloc'd
+} source_t;
+
+int source_open(source_t *src, const char *path);
+void source_close(source_t *src);
+
+// regular files bigger than this are assembled a window at a time instead of being mapped whole
+#define SOURCE_STREAM_MIN_BYTES ((uint64_t) 1 << 30)
+
+// forward-only view of an input too big to hold at once
+// regular files are mapped a window at a time with MADV_SEQUENTIAL, and unmapping the window
+// behind drops its pages, so RSS stays at the window size; anything else is read through a buffer
+// the caller uses up whole lines and asks for the next window, whatever it didn't use (a line
+// straddling the end of the window) is at the start of the next one
+typedef struct {
+    int fd;
+    int mapped;       // 1 if windows are mmap'd, which also means the input can be rewound
+    const char *data; // current window
+    size_t len;
+    int full;         // the window can't get any longer, so a line that doesn't fit never will
+    int last;         // the window reaches the end of the input
+    uint64_t offset;  // input offset of data[0]
+    uint64_t size;    // file size, mapped only
+    void *map;        // page aligned mapping behind data
+    size_t map_len;
+    char *buf;        // read buffer, unmapped only
+    size_t cap;
+} source_window_t;
+
+int source_window_open(source_window_t *win, int fd);
+int source_window_next(source_window_t *win, size_t used);
+int source_window_rewind(source_window_t *win);
+void source_window_close(source_window_t *win);
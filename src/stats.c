@@ -0,0 +1,96 @@
+#include "stats.h"
+#include <time.h>
+
+static const char *PHASE_NAMES[NUM_PHASES] = {
+    "read", "pass_one", "pass_two", "operands", "encode", "fixups", "swap", "write", "verify"
+};
+
+static const char *TYPE_NAMES[J_TYPE + 1] = { "R", "I", "J" };
+
+/**
+ * Monotonic clock in nanoseconds
+ */
+uint64_t stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Adds every timer and counter of src to dst
+ */
+void stats_merge(masm_stats_t *dst, const masm_stats_t *src) {
+    for (int i = 0; i < NUM_PHASES; i++)
+        dst->ns[i] += src->ns[i];
+    for (int i = 0; i <= J_TYPE; i++)
+        dst->instrs[i] += src->instrs[i];
+
+    dst->lines += src->lines;
+    dst->mnemonic_lookups += src->mnemonic_lookups;
+    dst->register_lookups += src->register_lookups;
+    dst->immediate_parses += src->immediate_parses;
+    dst->label_lookups += src->label_lookups;
+    dst->errors += src->errors;
+    dst->bytes_read += src->bytes_read;
+    dst->bytes_written += src->bytes_written;
+    dst->arena_peak += src->arena_peak;
+    dst->arena_reserved += src->arena_reserved;
+}
+
+static void print_text(const masm_stats_t *stats, FILE *fp) {
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_PHASES; i++)
+        total += stats->ns[i];
+    // operands and encode are part of pass two already
+    total -= stats->ns[PHASE_OPERANDS] + stats->ns[PHASE_ENCODE];
+
+    fprintf(fp, "phase          ms\n");
+    for (int i = 0; i < NUM_PHASES; i++)
+        fprintf(fp, "%-9s %7.3f\n", PHASE_NAMES[i], stats->ns[i] / 1e6);
+    fprintf(fp, "%-9s %7.3f\n", "total", total / 1e6);
+
+    uint64_t instrs = 0;
+    for (int i = 0; i <= J_TYPE; i++)
+        instrs += stats->instrs[i];
+
+    fprintf(fp, "lines            %llu\n", (unsigned long long) stats->lines);
+    fprintf(fp, "instructions     %llu (", (unsigned long long) instrs);
+    for (int i = 0; i <= J_TYPE; i++)
+        fprintf(fp, "%s%s %llu", i ? ", " : "", TYPE_NAMES[i], (unsigned long long) stats->instrs[i]);
+    fprintf(fp, ")\n");
+    fprintf(fp, "mnemonic lookups %llu\n", (unsigned long long) stats->mnemonic_lookups);
+    fprintf(fp, "register lookups %llu\n", (unsigned long long) stats->register_lookups);
+    fprintf(fp, "immediate parses %llu\n", (unsigned long long) stats->immediate_parses);
+    fprintf(fp, "label lookups    %llu\n", (unsigned long long) stats->label_lookups);
+    fprintf(fp, "errors           %llu\n", (unsigned long long) stats->errors);
+    fprintf(fp, "bytes read       %llu\n", (unsigned long long) stats->bytes_read);
+    fprintf(fp, "bytes written    %llu\n", (unsigned long long) stats->bytes_written);
+    fprintf(fp, "arena peak       %llu\n", (unsigned long long) stats->arena_peak);
+    fprintf(fp, "arena reserved   %llu\n", (unsigned long long) stats->arena_reserved);
+}
+
+static void print_json(const masm_stats_t *stats, FILE *fp) {
+    fprintf(fp, "{\"phases_ns\":{");
+    for (int i = 0; i < NUM_PHASES; i++)
+        fprintf(fp, "%s\"%s\":%llu", i ? "," : "", PHASE_NAMES[i], (unsigned long long) stats->ns[i]);
+
+    fprintf(fp, "},\"lines\":%llu,\"instructions\":{", (unsigned long long) stats->lines);
+    for (int i = 0; i <= J_TYPE; i++)
+        fprintf(fp, "%s\"%s\":%llu", i ? "," : "", TYPE_NAMES[i], (unsigned long long) stats->instrs[i]);
+
+    fprintf(fp, "},\"lookups\":{\"mnemonic\":%llu,\"register\":%llu,\"immediate\":%llu,\"label\":%llu}",
+            (unsigned long long) stats->mnemonic_lookups, (unsigned long long) stats->register_lookups,
+            (unsigned long long) stats->immediate_parses, (unsigned long long) stats->label_lookups);
+    fprintf(fp, ",\"errors\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu",
+            (unsigned long long) stats->errors, (unsigned long long) stats->bytes_read,
+            (unsigned long long) stats->bytes_written);
+    fprintf(fp, ",\"arena\":{\"peak\":%llu,\"reserved\":%llu}}\n",
+            (unsigned long long) stats->arena_peak, (unsigned long long) stats->arena_reserved);
+}
+
+void stats_print(const masm_stats_t *stats, StatsFormat format, FILE *fp) {
+    if (format == STATS_JSON)
+        print_json(stats, fp);
+    else if (format == STATS_TEXT)
+        print_text(stats, fp);
+}
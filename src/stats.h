@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "instr.h"
+
+// phase timers and hot path counters
+// only compiled in with -DMASM_STATS (make STATS=1, the default), without it every STAT_ macro
+// expands to nothing and the assembler does no extra work at all
+// MASM_STATS=2 also times operand decoding and encoding per instruction, which costs a clock read each
+
+typedef enum {
+    STATS_OFF,
+    STATS_TEXT,
+    STATS_JSON
+} StatsFormat;
+
+typedef enum {
+    PHASE_READ,     // opening and mapping the source
+    PHASE_PASS_ONE, // label addresses
+    PHASE_PASS_TWO, // encoding, includes the two below
+    PHASE_OPERANDS, // set_params, only with MASM_STATS=2
+    PHASE_ENCODE,   // pack_instr, only with MASM_STATS=2
+    PHASE_FIXUPS,   // one-pass backpatching
+    PHASE_SWAP,     // byte swapping for --endian
+    PHASE_WRITE,    // writing the output file
+    PHASE_VERIFY,   // decoding and repacking the image for --verify
+    NUM_PHASES
+} Phase;
+
+typedef struct {
+    uint64_t ns[NUM_PHASES]; // with -j the detailed phases are summed over every thread
+    uint64_t lines;
+    uint64_t instrs[J_TYPE + 1]; // encoded instructions per InstrType
+    uint64_t mnemonic_lookups;
+    uint64_t register_lookups;
+    uint64_t immediate_parses;
+    uint64_t label_lookups;
+    uint64_t errors;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t arena_peak;     // most bytes allocated from the arenas at once, summed over threads with -j
+    uint64_t arena_reserved; // most bytes the arenas held from the allocator
+} masm_stats_t;
+
+uint64_t stats_now();
+void stats_merge(masm_stats_t *dst, const masm_stats_t *src);
+void stats_print(const masm_stats_t *stats, StatsFormat format, FILE *fp);
+
+#ifdef MASM_STATS
+#define STAT_INC(stats, field)       ((stats)->field++)
+#define STAT_ADD(stats, field, n)    ((stats)->field += (n))
+#define STAT_SET(stats, field, n)    ((stats)->field = (n))
+#define STAT_TIMER(name)             uint64_t name = stats_now()
+#define STAT_PHASE(stats, phase, t0) ((stats)->ns[phase] += stats_now() - (t0))
+#else
+#define STAT_INC(stats, field)       ((void) 0)
+#define STAT_ADD(stats, field, n)    ((void) 0)
+#define STAT_SET(stats, field, n)    ((void) 0)
+#define STAT_TIMER(name)             ((void) 0)
+#define STAT_PHASE(stats, phase, t0) ((void) 0)
+#endif
+
+#if defined(MASM_STATS) && MASM_STATS >= 2
+#define STAT_DETAIL_TIMER(name)             STAT_TIMER(name)
+#define STAT_DETAIL_PHASE(stats, phase, t0) STAT_PHASE(stats, phase, t0)
+#else
+#define STAT_DETAIL_TIMER(name)             ((void) 0)
+#define STAT_DETAIL_PHASE(stats, phase, t0) ((void) 0)
+#endif
@@ -0,0 +1,150 @@
+#include "symtab.h"
+#include <string.h>
+
+#define INITIAL_SLOTS (1024)
+
+static inline uint32_t hash_name(const char *name, size_t len) {
+    // FNV-1a with a final avalanche so linear probing doesn't see clustered low bits
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t) name[i]) * 16777619u;
+
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    return h;
+}
+
+int symtab_init(symtab_t *tab, const masm_allocator_t *alloc) {
+    tab->alloc = alloc;
+    tab->count = 0;
+    tab->cap = INITIAL_SLOTS / 2;
+    tab->syms = mem_alloc(alloc, tab->cap * sizeof(symbol_t));
+    tab->slots = mem_alloc(alloc, INITIAL_SLOTS * sizeof(uint32_t));
+    tab->slot_mask = INITIAL_SLOTS - 1;
+    arena_init(&tab->names, alloc);
+
+    if (tab->syms == NULL || tab->slots == NULL) {
+        symtab_free(tab);
+        return -1;
+    }
+
+    memset(tab->slots, 0, INITIAL_SLOTS * sizeof(uint32_t));
+    return 0;
+}
+
+void symtab_free(symtab_t *tab) {
+    mem_free(tab->alloc, tab->syms, tab->cap * sizeof(symbol_t));
+    mem_free(tab->alloc, tab->slots, (tab->slot_mask + 1) * sizeof(uint32_t));
+    arena_free(&tab->names);
+    tab->syms = NULL;
+    tab->slots = NULL;
+    tab->count = 0;
+    tab->cap = 0;
+}
+
+/**
+ * Empties the table, keeping the arrays at their current size for the next run
+ */
+void symtab_clear(symtab_t *tab) {
+    memset(tab->slots, 0, (tab->slot_mask + 1) * sizeof(uint32_t));
+    arena_reset(&tab->names);
+    tab->count = 0;
+}
+
+/**
+ * Doubles the slot array and reinserts every symbol using its stored hash
+ */
+static int grow(symtab_t *tab) {
+    uint32_t nslots = (tab->slot_mask + 1) * 2;
+    uint32_t *slots = mem_alloc(tab->alloc, nslots * sizeof(uint32_t));
+
+    if (slots == NULL)
+        return -1;
+
+    symbol_t *syms = mem_realloc(tab->alloc, tab->syms, tab->cap * sizeof(symbol_t), (nslots / 2) * sizeof(symbol_t));
+
+    if (syms == NULL) {
+        mem_free(tab->alloc, slots, nslots * sizeof(uint32_t));
+        return -1;
+    }
+
+    memset(slots, 0, nslots * sizeof(uint32_t));
+
+    for (uint32_t id = 0; id < tab->count; id++) {
+        uint32_t i = syms[id].hash & (nslots - 1);
+        while (slots[i] != 0)
+            i = (i + 1) & (nslots - 1);
+        slots[i] = id + 1;
+    }
+
+    mem_free(tab->alloc, tab->slots, (tab->slot_mask + 1) * sizeof(uint32_t));
+    tab->slots = slots;
+    tab->slot_mask = nslots - 1;
+    tab->syms = syms;
+    tab->cap = nslots / 2;
+    return 0;
+}
+
+/**
+ * Returns the slot name hashes to, which either holds it or is the empty slot it would go in
+ */
+static inline uint32_t probe(const symtab_t *tab, const char *name, size_t len, uint32_t hash) {
+    uint32_t i = hash & tab->slot_mask;
+
+    while (tab->slots[i] != 0) {
+        const symbol_t *sym = &tab->syms[tab->slots[i] - 1];
+        if (sym->hash == hash && sym->len == len && memcmp(sym->name, name, len) == 0)
+            break;
+        i = (i + 1) & tab->slot_mask;
+    }
+    return i;
+}
+
+/**
+ * Finds the id of name, returns -1 if it's not in the table
+ */
+int32_t symtab_find(const symtab_t *tab, const char *name, size_t len) {
+    uint32_t slot = probe(tab, name, len, hash_name(name, len));
+    return (int32_t) tab->slots[slot] - 1;
+}
+
+/**
+ * Finds the id of name, adding it as an undefined symbol if it's new
+ * name doesn't need to be null terminated, a copy is kept in the table's arena
+ * Returns -1 if out of memory
+ */
+int32_t symtab_intern(symtab_t *tab, const char *name, size_t len) {
+    uint32_t hash = hash_name(name, len);
+    uint32_t slot = probe(tab, name, len, hash);
+
+    if (tab->slots[slot] != 0)
+        return tab->slots[slot] - 1;
+
+    // keep the load factor at or under 1/2
+    if (tab->count == tab->cap) {
+        if (grow(tab) != 0)
+            return -1;
+        slot = probe(tab, name, len, hash);
+    }
+
+    const char *copy = arena_strndup(&tab->names, name, len);
+    if (copy == NULL)
+        return -1;
+
+    uint32_t id = tab->count++;
+    tab->syms[id] = (symbol_t) { .name = copy, .len = len, .hash = hash };
+    tab->slots[slot] = id + 1;
+    return id;
+}
+
+/**
+ * Prints every defined symbol in definition order as "address name line:col"
+ */
+void symtab_dump(const symtab_t *tab, FILE *fp) {
+    for (uint32_t id = 0; id < tab->count; id++) {
+        const symbol_t *sym = &tab->syms[id];
+        if (sym->defined)
+            fprintf(fp, "%08x %s %zu:%d\n", sym->pc, sym->name, sym->line, sym->col);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "arena.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// a label, ids are handed out in the order names are first seen
+typedef struct {
+    const char *name; // interned, null terminated
+    uint32_t len;
+    uint32_t hash;
+    uint32_t pc;      // address the label points at
+    size_t line;      // where the label was defined
+    int col;
+    int defined;      // 0 if the name has only been referenced so far
+} symbol_t;
+
+// open addressing (linear probing) hash table over a dense array of symbols
+typedef struct {
+    symbol_t *syms;     // indexed by symbol id
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *slots;    // id + 1 of the symbol in each slot, 0 if empty
+    uint32_t slot_mask; // number of slots - 1, always a power of two
+    arena_t names;      // interned label names
+    const masm_allocator_t *alloc;
+} symtab_t;
+
+int symtab_init(symtab_t *tab, const masm_allocator_t *alloc);
+void symtab_free(symtab_t *tab);
+void symtab_clear(symtab_t *tab);
+int32_t symtab_intern(symtab_t *tab, const char *name, size_t len);
+int32_t symtab_find(const symtab_t *tab, const char *name, size_t len);
+void symtab_dump(const symtab_t *tab, FILE *fp);
+
+static inline symbol_t *symtab_get(const symtab_t *tab, int32_t id) {
+    return &tab->syms[id];
+}
@@ -0,0 +1,336 @@
+#include "trace.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// a header byte, a jump, a word and a write
+#define RECORD_MAX (1 + 5 + 4 + 5)
+// how long the writer sleeps when the ring is empty
+#define WRITER_IDLE_NS (100000)
+
+// head only moves on the simulating side and tail on the writer's, each on its own cache line
+typedef struct {
+    _Atomic size_t head; // bytes put in
+    char pad0[64 - sizeof(size_t)];
+    _Atomic size_t tail; // bytes written out
+    char pad1[64 - sizeof(size_t)];
+    _Atomic int closed;  // set after the last byte is in
+    uint8_t *buf;
+} ring_t;
+
+struct trace {
+    ring_t ring;
+    size_t cached_tail; // the producer's last look at tail, it only looks again when the ring seems full
+    pthread_t writer;
+    FILE *fp;
+    int failed;         // set by the writer, read after it's joined
+    uint32_t last_pc;
+    uint32_t regs[TRACE_NUM_REGS]; // value last recorded for each register
+    uint32_t *words;               // word last recorded at each address of the image
+    size_t count;
+};
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+    return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t) v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+    return p;
+}
+
+static inline uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static void *write_ring(void *arg) {
+    trace_t *trace = arg;
+    ring_t *ring = &trace->ring;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    while (1) {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        if (head == tail) {
+            // closed goes up after the last head, so one more look at head sees everything
+            if (atomic_load(&ring->closed)) {
+                if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+                    break;
+                continue;
+            }
+            struct timespec idle = { 0, WRITER_IDLE_NS };
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        // up to the end of the buffer, the rest on the next time round
+        size_t at = tail & (TRACE_RING_SIZE - 1);
+        size_t len = head - tail < TRACE_RING_SIZE - at ? head - tail : TRACE_RING_SIZE - at;
+        // after a failed write keep draining, so the simulating side never waits on a full ring forever
+        if (!trace->failed && fwrite(ring->buf + at, 1, len, trace->fp) != len)
+            trace->failed = 1;
+        tail += len;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+static void ring_push(trace_t *trace, const uint8_t *data, size_t len) {
+    ring_t *ring = &trace->ring;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    while (head + len - trace->cached_tail > TRACE_RING_SIZE) {
+        trace->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head + len - trace->cached_tail > TRACE_RING_SIZE)
+            sched_yield();
+    }
+
+    size_t at = head & (TRACE_RING_SIZE - 1);
+    size_t first = len < TRACE_RING_SIZE - at ? len : TRACE_RING_SIZE - at;
+    memcpy(ring->buf + at, data, first);
+    memcpy(ring->buf, data + first, len - first);
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+/**
+ * Creates path and writes the header, with the image and registers the program starts from
+ * Records every period-th instruction from then on, see trace_record
+ * Returns NULL if the file can't be written or out of memory
+ */
+trace_t *trace_open(const char *path, uint32_t period, const uint32_t *image, size_t count, const uint32_t *regs) {
+    trace_t *trace = calloc(1, sizeof(trace_t));
+    if (trace == NULL)
+        return NULL;
+
+    trace->ring.buf = malloc(TRACE_RING_SIZE);
+    trace->words = malloc(count ? count * sizeof(uint32_t) : 1);
+    trace->fp = fopen(path, "wb");
+    if (trace->ring.buf == NULL || trace->words == NULL || trace->fp == NULL)
+        goto fail;
+
+    memcpy(trace->words, image, count * sizeof(uint32_t));
+    memcpy(trace->regs, regs, sizeof(trace->regs));
+    trace->count = count;
+    trace->last_pc = (uint32_t) -4;
+
+    uint8_t header[4 + 3 * 4 + TRACE_NUM_REGS * 4], *p = header;
+    memcpy(p, TRACE_MAGIC, 4);
+    p = put_u32(p + 4, TRACE_VERSION);
+    p = put_u32(p, period);
+    p = put_u32(p, count);
+    for (int i = 0; i < TRACE_NUM_REGS; i++)
+        p = put_u32(p, regs[i]);
+
+    int ok = fwrite(header, 1, sizeof(header), trace->fp) == sizeof(header);
+    for (size_t i = 0; i < count && ok; i++) {
+        uint8_t word[4];
+        put_u32(word, image[i]);
+        ok = fwrite(word, 1, 4, trace->fp) == 4;
+    }
+    if (!ok)
+        goto fail;
+
+    atomic_init(&trace->ring.head, 0);
+    atomic_init(&trace->ring.tail, 0);
+    atomic_init(&trace->ring.closed, 0);
+    if (pthread_create(&trace->writer, NULL, write_ring, trace) != 0)
+        goto fail;
+    return trace;
+
+fail:
+    if (trace->fp != NULL)
+        fclose(trace->fp);
+    free(trace->ring.buf);
+    free(trace->words);
+    free(trace);
+    return NULL;
+}
+
+/**
+ * Records that the instruction word at pc ran and wrote value to reg (-1 for no register)
+ * Only waits if the writer is a whole ring behind
+ */
+void trace_record(trace_t *trace, uint32_t pc, uint32_t word, int reg, uint32_t value) {
+    uint8_t rec[RECORD_MAX], *p = rec + 1;
+    uint8_t header = 0;
+
+    if (pc != trace->last_pc + 4) {
+        header |= TRACE_JUMP;
+        p = put_varint(p, zigzag((int32_t) (pc - trace->last_pc - 4) >> 2));
+    }
+
+    size_t i = pc / 4;
+    if (i >= trace->count || trace->words[i] != word) {
+        header |= TRACE_WORD;
+        p = put_u32(p, word);
+        if (i < trace->count)
+            trace->words[i] = word;
+    }
+
+    if (reg > 0 && reg < TRACE_NUM_REGS) {
+        header |= TRACE_WRITE | reg << TRACE_REG_SHIFT;
+        p = put_varint(p, zigzag(value - trace->regs[reg]));
+        trace->regs[reg] = value;
+    }
+
+    rec[0] = header;
+    trace->last_pc = pc;
+    ring_push(trace, rec, p - rec);
+}
+
+/**
+ * Writes the end record with the number of instructions run, waits for the writer to catch up,
+ * and closes the file
+ * Returns -1 if any of it couldn't be written
+ */
+int trace_close(trace_t *trace, uint64_t steps) {
+    uint8_t end[1 + 10], *p = end;
+
+    *p++ = TRACE_END;
+    p = put_varint(p, steps);
+    ring_push(trace, end, p - end);
+    atomic_store(&trace->ring.closed, 1);
+    pthread_join(trace->writer, NULL);
+
+    int ret = trace->failed || fclose(trace->fp) != 0 ? -1 : 0;
+    if (trace->failed)
+        fclose(trace->fp);
+    free(trace->ring.buf);
+    free(trace->words);
+    free(trace);
+    return ret;
+}
+
+static int get_varint(trace_reader_t *reader, uint64_t *out) {
+    const uint8_t *data = (const uint8_t *) reader->src.data;
+    uint64_t v = 0;
+
+    for (int shift = 0; shift < 64 && reader->at < reader->src.len; shift += 7) {
+        uint8_t b = data[reader->at++];
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int get_u32(trace_reader_t *reader, uint32_t *out) {
+    const uint8_t *p = (const uint8_t *) reader->src.data + reader->at;
+
+    if (reader->src.len - reader->at < 4)
+        return -1;
+    *out = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+    reader->at += 4;
+    return 0;
+}
+
+/**
+ * Reads the header of the trace at path
+ * Returns -1 if it can't be read or isn't a trace
+ */
+int trace_reader_open(trace_reader_t *reader, const char *path) {
+    uint32_t version, count;
+
+    memset(reader, 0, sizeof(*reader));
+    if (source_open(&reader->src, path) != 0)
+        return -1;
+
+    if (reader->src.len < 4 || memcmp(reader->src.data, TRACE_MAGIC, 4) != 0)
+        goto fail;
+    reader->at = 4;
+    if (get_u32(reader, &version) != 0 || version != TRACE_VERSION
+        || get_u32(reader, &reader->period) != 0 || get_u32(reader, &count) != 0)
+        goto fail;
+    for (int i = 0; i < TRACE_NUM_REGS; i++) {
+        if (get_u32(reader, &reader->regs[i]) != 0)
+            goto fail;
+    }
+    if ((reader->src.len - reader->at) / 4 < count)
+        goto fail;
+
+    reader->count = count;
+    reader->image = malloc(count ? count * sizeof(uint32_t) : 1);
+    reader->words = malloc(count ? count * sizeof(uint32_t) : 1);
+    if (reader->image == NULL || reader->words == NULL)
+        goto fail;
+    for (size_t i = 0; i < count; i++)
+        get_u32(reader, &reader->image[i]);
+    memcpy(reader->words, reader->image, count * sizeof(uint32_t));
+    reader->last_pc = (uint32_t) -4;
+    return 0;
+
+fail:
+    trace_reader_close(reader);
+    return -1;
+}
+
+/**
+ * Decodes the next record into rec
+ * Returns 1 if there was one, 0 at the end record, -1 if the trace is cut short or corrupt
+ */
+int trace_next(trace_reader_t *reader, trace_record_t *rec) {
+    uint64_t v;
+
+    if (reader->at >= reader->src.len)
+        return -1;
+    uint8_t header = reader->src.data[reader->at++];
+
+    if (header == TRACE_END)
+        return get_varint(reader, &reader->steps) == 0 ? 0 : -1;
+    if ((header & TRACE_WRITE) == 0 && header >> TRACE_REG_SHIFT != 0)
+        return -1;
+
+    rec->pc = reader->last_pc + 4;
+    if (header & TRACE_JUMP) {
+        if (get_varint(reader, &v) != 0)
+            return -1;
+        rec->pc += (uint32_t) unzigzag(v) << 2;
+    }
+    reader->last_pc = rec->pc;
+
+    size_t i = rec->pc / 4;
+    if (header & TRACE_WORD) {
+        if (get_u32(reader, &rec->word) != 0)
+            return -1;
+        if (i < reader->count)
+            reader->words[i] = rec->word;
+    } else if (i < reader->count)
+        rec->word = reader->words[i];
+    else
+        return -1;
+
+    rec->reg = -1;
+    if (header & TRACE_WRITE) {
+        if (get_varint(reader, &v) != 0)
+            return -1;
+        rec->reg = header >> TRACE_REG_SHIFT;
+        rec->value = reader->regs[rec->reg] += (uint32_t) unzigzag(v);
+    }
+    return 1;
+}
+
+void trace_reader_close(trace_reader_t *reader) {
+    source_close(&reader->src);
+    free(reader->image);
+    free(reader->words);
+    reader->image = NULL;
+    reader->words = NULL;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "source.h"
+
+// compact binary execution traces of simulated programs
+// the simulating thread encodes records into a ring of its own and a writer thread drains it to
+// the file, there's no lock between them, just the two counters of a single producer single
+// consumer ring, so the run only ever waits when the writer falls a whole ring behind
+//
+// the file is little endian: "MTRC", version, sample period, image word count, the 32 registers
+// and the image as loaded, then one record per traced instruction and an end record
+// a record is a header byte and whatever it says follows:
+//   TRACE_JUMP   pc isn't the last record's + 4, zigzag varint of the difference in words
+//   TRACE_WORD   the word at pc isn't the one last seen there (or in the image), 4 bytes
+//   TRACE_WRITE  the instruction wrote register header >> TRACE_REG_SHIFT, zigzag varint of
+//                the difference from the value last recorded for it
+// so straight line code that writes a register is usually 2 bytes an instruction
+// the end record is TRACE_END then a varint of every instruction run, sampled or not
+// with a sample period of N only every Nth instruction is recorded, deltas are between samples
+// a syscall counts as writing $v0, hi/lo and the fprs aren't recorded
+
+#define TRACE_MAGIC "MTRC"
+#define TRACE_VERSION (1)
+#define TRACE_NUM_REGS (32)
+// bytes between the simulating thread and the writer, a power of two
+#define TRACE_RING_SIZE ((size_t) 4 << 20)
+
+#define TRACE_JUMP (0x01)
+#define TRACE_WORD (0x02)
+#define TRACE_WRITE (0x04)
+#define TRACE_REG_SHIFT (3)
+// register bits without TRACE_WRITE, which no instruction record has
+#define TRACE_END (0xf8)
+
+typedef struct trace trace_t;
+
+trace_t *trace_open(const char *path, uint32_t period, const uint32_t *image, size_t count, const uint32_t *regs);
+void trace_record(trace_t *trace, uint32_t pc, uint32_t word, int reg, uint32_t value);
+int trace_close(trace_t *trace, uint64_t steps);
+
+typedef struct {
+    uint32_t pc;
+    uint32_t word;
+    int reg;        // register written, -1 for none
+    uint32_t value;
+} trace_record_t;
+
+// reads a trace back a record at a time, keeping the same state the writer did
+typedef struct {
+    source_t src;
+    size_t at;
+    uint32_t period;
+    size_t count;
+    uint32_t *image;             // as loaded, in host order
+    uint32_t *words;             // image as the records have changed it
+    uint32_t regs[TRACE_NUM_REGS]; // as loaded, then as recorded
+    uint32_t last_pc;
+    uint64_t steps;              // from the end record, once trace_next has returned 0
+} trace_reader_t;
+
+int trace_reader_open(trace_reader_t *reader, const char *path);
+int trace_next(trace_reader_t *reader, trace_record_t *rec);
+void trace_reader_close(trace_reader_t *reader);
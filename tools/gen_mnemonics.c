@@ -0,0 +1,68 @@
+#include "instr_table.h"
+#include "mnemonic_hash.h"
+#include <stdio.h>
+#include <string.h>
+
+// writes the mnemonic hash table instr.c looks instructions up in, see mnemonic_hash.h
+// tries seeds from 0 until every mnemonic hashes to its own slot, and gives up loudly if none does
+
+#define X(id, mnemonic, type, opcode, funct, rt, params) mnemonic,
+static const char *MNEMONICS[] = { INSTR_TABLE(X) };
+#undef X
+
+#define NUM_MNEMONICS (sizeof(MNEMONICS) / sizeof(MNEMONICS[0]))
+// 54 instructions in 128 slots take about half a million tries
+#define MAX_TRIES (1u << 24)
+
+/**
+ * Fills slots with id + 1 for every mnemonic, 0 for empty slots
+ * Returns -1 if two mnemonics land in the same slot under seed
+ */
+static int fill_slots(uint32_t seed, uint8_t *slots) {
+    memset(slots, 0, MNEMONIC_SLOTS_LEN);
+
+    for (size_t i = 0; i < NUM_MNEMONICS; i++) {
+        uint32_t slot = hash_mnemonic(MNEMONICS[i], strlen(MNEMONICS[i]), seed);
+        if (slots[slot] != 0)
+            return -1;
+        slots[slot] = i + 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint8_t slots[MNEMONIC_SLOTS_LEN];
+    uint32_t seed;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s mnemonic_table.h\n", argv[0]);
+        return 1;
+    }
+
+    for (seed = 0; seed < MAX_TRIES && fill_slots(seed, slots) != 0; seed++)
+        ;
+    if (seed == MAX_TRIES) {
+        fprintf(stderr, "%s: no seed under %u gives the %zu mnemonics a slot each, grow MNEMONIC_SLOTS_LEN\n",
+                argv[0], MAX_TRIES, NUM_MNEMONICS);
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[1], "w");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: couldn't write %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    fprintf(fp, "// generated from instr_table.h by tools/gen_mnemonics.c, don't edit\n");
+    fprintf(fp, "#define MNEMONIC_SEED (%uu)\n", seed);
+    fprintf(fp, "static const uint8_t MNEMONIC_SLOTS[MNEMONIC_SLOTS_LEN] = {");
+    for (int i = 0; i < MNEMONIC_SLOTS_LEN; i++)
+        fprintf(fp, "%s%d,", i % 16 == 0 ? "\n    " : " ", slots[i]);
+    fprintf(fp, "\n};\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "%s: couldn't write %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    return 0;
+}